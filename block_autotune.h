@@ -0,0 +1,169 @@
+#pragma once
+// ===============================================
+// BLOCK SIZE AUTOTUNER
+// ===============================================
+// Measures read throughput of the filesystem a dataset is written to and
+// picks its block sizes and read method (preprocess_dataset --autotune).
+// A scratch file is written in the target directory and read back with
+// pread() and through mmap(), sequentially and in a shuffled order of
+// aligned requests, for request sizes from 64 KB up to 64 MB. Cached pages
+// are dropped before every pass (posix_fadvise DONTNEED), so each pass reads
+// from the device where the filesystem allows it.
+//
+// The knee is the smallest request size whose shuffled reads reach
+// AUTOTUNE_KNEE_FRACTION of the best sequential throughput: below it each
+// request pays for a seek or a round trip, above it reads stream. Blocks are
+// AUTOTUNE_KNEE_MULTIPLE knees long, so whole-block reads stream while block
+// zone maps keep skipping at a fine grain; attribute blocks keep the default
+// proportions to the accessibility block. The read method is the faster one
+// for shuffled requests of the knee size.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "dataset_container.h"
+#include "dataset_format.h"
+
+constexpr uint64_t AUTOTUNE_DEFAULT_PROBE_BYTES = 256ull << 20;  // scratch file
+constexpr size_t AUTOTUNE_MIN_REQUEST = 64 << 10;
+constexpr size_t AUTOTUNE_MAX_REQUEST = 64 << 20;
+constexpr double AUTOTUNE_KNEE_FRACTION = 0.9;
+constexpr size_t AUTOTUNE_KNEE_MULTIPLE = 16;
+constexpr size_t AUTOTUNE_MIN_ACC_BLOCK = 16 << 20;
+constexpr size_t AUTOTUNE_MAX_ACC_BLOCK = size_t(1) << 30;
+constexpr size_t AUTOTUNE_MIN_ATTR_BLOCK = 1 << 20;
+
+// Throughput of one pass
+struct ReadProbe {
+    ReadMethod method;
+    bool sequential;
+    size_t request_bytes;
+    double mb_per_s;
+};
+
+struct AutotuneResult {
+    BlockSizes sizes;
+    ReadMethod method = ReadMethod::Pread;
+    size_t knee_bytes = 0;
+    std::vector<ReadProbe> probes;
+};
+
+namespace autotune_detail {
+
+// Reads the whole probe file once in requests of `request` bytes, in file
+// order or shuffled. Returns MB/s, negative on error.
+inline double run_pass(int fd, uint64_t file_bytes, ReadMethod method, bool sequential, size_t request,
+                       std::vector<char>& buf) {
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    std::vector<uint64_t> order(file_bytes / request);
+    std::iota(order.begin(), order.end(), 0);
+    if (!sequential) std::shuffle(order.begin(), order.end(), std::mt19937_64(request));
+
+    auto t0 = std::chrono::steady_clock::now();
+    bool ok = true;
+    if (method == ReadMethod::Pread) {
+        for (uint64_t i : order) ok = ok && pread_all(fd, buf.data(), request, i * request);
+    } else {
+        void* p = mmap(nullptr, file_bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) return -1;
+        const char* map = static_cast<const char*>(p);
+        for (uint64_t i : order) memcpy(buf.data(), map + i * request, request);
+        munmap(p, file_bytes);
+    }
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (!ok) return -1;
+    return double(order.size() * request) / (1024.0 * 1024.0) / std::max(s, 1e-9);
+}
+
+inline size_t floor_pow2(size_t n) {
+    size_t p = 1;
+    while (p * 2 <= n) p *= 2;
+    return p;
+}
+
+}  // namespace autotune_detail
+
+// Runs the probes in dir with a scratch file of about probe_bytes and fills
+// result. The scratch file is removed afterwards.
+inline bool autotune_block_sizes(const std::string& dir, uint64_t probe_bytes, AutotuneResult& result,
+                                 std::string* error = nullptr) {
+    using namespace autotune_detail;
+    auto fail = [&](const std::string& msg) {
+        if (error) *error = msg;
+        return false;
+    };
+    // Every request size must fit several times into the file
+    probe_bytes = std::max<uint64_t>(probe_bytes, 4 * AUTOTUNE_MIN_REQUEST) / AUTOTUNE_MIN_REQUEST * AUTOTUNE_MIN_REQUEST;
+    size_t max_request = std::min<size_t>(AUTOTUNE_MAX_REQUEST, floor_pow2(probe_bytes / 4));
+
+    std::string path = dir + "/.autotune_probe";
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return fail("Cannot create " + path);
+    unlink(path.c_str());  // the descriptor keeps it alive until close()
+
+    // Incompressible contents, in case the filesystem compresses
+    std::vector<char> buf(max_request);
+    std::mt19937_64 rng(42);
+    for (size_t i = 0; i + 8 <= buf.size(); i += 8) {
+        uint64_t v = rng();
+        memcpy(buf.data() + i, &v, 8);
+    }
+    for (uint64_t off = 0; off < probe_bytes; off += buf.size()) {
+        size_t n = std::min<uint64_t>(buf.size(), probe_bytes - off);
+        if (!pwrite_all(fd, buf.data(), n, off)) {
+            ::close(fd);
+            return fail("Cannot write " + path);
+        }
+    }
+
+    // Request sizes x4 from the minimum, always ending at max_request: the
+    // knee falls back to it, so it must have been measured
+    std::vector<size_t> requests;
+    for (size_t request = AUTOTUNE_MIN_REQUEST; request < max_request; request *= 4) requests.push_back(request);
+    requests.push_back(max_request);
+
+    result = AutotuneResult();
+    double best_seq = 0;
+    for (ReadMethod method : {ReadMethod::Pread, ReadMethod::Mmap}) {
+        for (bool sequential : {true, false}) {
+            for (size_t request : requests) {
+                double mbs = run_pass(fd, probe_bytes, method, sequential, request, buf);
+                if (mbs < 0) {
+                    ::close(fd);
+                    return fail("Cannot read " + path);
+                }
+                result.probes.push_back({method, sequential, request, mbs});
+                if (sequential) best_seq = std::max(best_seq, mbs);
+            }
+        }
+    }
+    ::close(fd);
+
+    // Smallest request size whose shuffled reads stream, by either method
+    result.knee_bytes = max_request;
+    for (const ReadProbe& p : result.probes)
+        if (!p.sequential && p.mb_per_s >= AUTOTUNE_KNEE_FRACTION * best_seq)
+            result.knee_bytes = std::min(result.knee_bytes, p.request_bytes);
+    double best_at_knee = -1;
+    for (const ReadProbe& p : result.probes) {
+        if (p.sequential || p.request_bytes != result.knee_bytes || p.mb_per_s <= best_at_knee) continue;
+        best_at_knee = p.mb_per_s;
+        result.method = p.method;
+    }
+
+    BlockSizes defaults;
+    size_t acc = floor_pow2(result.knee_bytes * AUTOTUNE_KNEE_MULTIPLE);
+    result.sizes.acc = std::clamp(acc, AUTOTUNE_MIN_ACC_BLOCK, AUTOTUNE_MAX_ACC_BLOCK);
+    result.sizes.origin_attr =
+        std::max(AUTOTUNE_MIN_ATTR_BLOCK, result.sizes.acc / (defaults.acc / defaults.origin_attr));
+    result.sizes.dest_attr = std::max(AUTOTUNE_MIN_ATTR_BLOCK, result.sizes.acc / (defaults.acc / defaults.dest_attr));
+    return true;
+}
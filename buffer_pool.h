@@ -0,0 +1,184 @@
+#pragma once
+// ===============================================
+// BLOCK BUFFER POOL
+// ===============================================
+// User-space cache of block file bytes under a fixed memory budget, shared by
+// the threads of a query. Block files are cut into aligned frames
+// (BUFFER_POOL_DEFAULT_FRAME bytes of one descriptor); a read copies out of
+// the frames it overlaps, filling missing ones with pread(). Consecutive runs
+// stored in the same block therefore hit frames already resident instead of
+// issuing their own reads.
+//
+// Frames are allocated up to the budget and then recycled with the CLOCK
+// algorithm: the hand clears the reference bit of recently used frames and
+// takes the first unpinned frame whose bit is already clear. After a frame is
+// filled its pages are dropped from the kernel page cache (POSIX_FADV_DONTNEED),
+// so block data is held once, in the pool, and the footprint of a query is
+// the budget rather than whatever the page cache keeps.
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "dataset_container.h"
+
+constexpr size_t BUFFER_POOL_DEFAULT_FRAME = 1 << 20;
+
+class BufferPool {
+public:
+    // At least one frame is kept whatever the budget
+    explicit BufferPool(uint64_t budget_bytes, size_t frame_bytes = BUFFER_POOL_DEFAULT_FRAME)
+        : frame_bytes_(frame_bytes), max_frames_(std::max<uint64_t>(1, budget_bytes / frame_bytes)) {
+        frames_.reserve(max_frames_);  // frames are handed out by address
+    }
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // len bytes at offset of region.fd (offsets include region.offset, as for
+    // DatasetFiles::read_at). Thread-safe; each thread pins one frame at a time.
+    bool read_at(const FileRegion& region, void* data, size_t len, uint64_t offset) {
+        char* dst = static_cast<char*>(data);
+        while (len > 0) {
+            uint64_t index = offset / frame_bytes_;
+            size_t in_frame = offset - index * frame_bytes_;
+            size_t n = std::min<size_t>(len, frame_bytes_ - in_frame);
+            Frame* f = pin(region.fd, index);
+            if (!f) return false;
+            bool ok = in_frame + n <= f->valid;
+            if (ok) memcpy(dst, f->data.get() + in_frame, n);
+            unpin(f);
+            if (!ok) return false;  // past the end of the file
+            dst += n;
+            len -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+    uint64_t budget() const { return max_frames_ * frame_bytes_; }
+    size_t frame_bytes() const { return frame_bytes_; }
+    // Bytes of allocated frames (grows up to budget())
+    uint64_t resident_bytes() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return uint64_t(frames_.size()) * frame_bytes_;
+    }
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+    uint64_t evictions() const { return evictions_; }
+    // Bytes read from the files into frames
+    uint64_t bytes_filled() const { return bytes_filled_; }
+
+private:
+    struct Frame {
+        uint64_t key = 0;
+        bool used = false;     // holds (or is loading) the frame of key
+        bool loading = false;
+        bool referenced = false;
+        uint32_t pins = 0;
+        size_t valid = 0;      // bytes before the end of the file
+        std::unique_ptr<char[]> data;
+    };
+
+    static uint64_t key_of(int fd, uint64_t index) { return uint64_t(fd) << 40 | index; }
+
+    // The frame holding (fd, index), filled and pinned; nullptr on a read error
+    Frame* pin(int fd, uint64_t index) {
+        uint64_t key = key_of(fd, index);
+        std::unique_lock<std::mutex> lk(mu_);
+        for (;;) {
+            auto it = map_.find(key);
+            if (it != map_.end()) {
+                Frame* f = &frames_[it->second];
+                if (f->loading) {
+                    changed_.wait(lk);
+                    continue;  // filled, failed or recycled meanwhile: look again
+                }
+                f->pins++;
+                f->referenced = true;
+                hits_++;
+                return f;
+            }
+            Frame* f = victim();
+            if (!f) {
+                changed_.wait(lk);  // every frame pinned by another thread
+                continue;
+            }
+            if (f->used) {
+                map_.erase(f->key);
+                evictions_++;
+            }
+            f->key = key;
+            f->used = f->loading = f->referenced = true;
+            f->pins = 1;
+            map_[key] = f - frames_.data();
+            misses_++;
+            lk.unlock();
+            bool ok = fill(fd, index, *f);
+            lk.lock();
+            f->loading = false;
+            if (!ok) {
+                map_.erase(key);
+                f->used = false;
+                f->pins = 0;
+            }
+            changed_.notify_all();
+            return ok ? f : nullptr;
+        }
+    }
+
+    void unpin(Frame* f) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (--f->pins == 0) changed_.notify_all();
+    }
+
+    // A new frame while under budget, else CLOCK over the unpinned frames.
+    // Called with mu_ held.
+    Frame* victim() {
+        if (frames_.size() < max_frames_) {
+            frames_.emplace_back();
+            frames_.back().data.reset(new char[frame_bytes_]);
+            return &frames_.back();
+        }
+        for (size_t step = 0; step < 2 * frames_.size(); ++step) {
+            Frame& f = frames_[hand_];
+            hand_ = (hand_ + 1) % frames_.size();
+            if (f.pins > 0) continue;
+            if (f.used && f.referenced) {
+                f.referenced = false;
+                continue;
+            }
+            return &f;
+        }
+        return nullptr;
+    }
+
+    bool fill(int fd, uint64_t index, Frame& f) {
+        uint64_t start = index * frame_bytes_;
+        size_t done = 0;
+        while (done < frame_bytes_) {
+            ssize_t n = pread(fd, f.data.get() + done, frame_bytes_ - done, start + done);
+            if (n < 0) return false;
+            if (n == 0) break;  // end of file
+            done += n;
+        }
+        f.valid = done;
+        bytes_filled_ += done;
+        posix_fadvise(fd, start, done, POSIX_FADV_DONTNEED);
+        return true;
+    }
+
+    const size_t frame_bytes_;
+    const uint64_t max_frames_;
+    mutable std::mutex mu_;
+    std::condition_variable changed_;
+    std::vector<Frame> frames_;
+    std::unordered_map<uint64_t, size_t> map_;  // key -> frame
+    size_t hand_ = 0;
+    std::atomic<uint64_t> hits_{0}, misses_{0}, evictions_{0}, bytes_filled_{0};
+};
@@ -0,0 +1,320 @@
+#pragma once
+// ===============================================
+// LIGHTWEIGHT COLUMN CODECS
+// ===============================================
+// A column of 32-bit words (uint32 IDs or float bits) is stored as one
+// self-describing stream: a ColumnHeader followed by `bytes` of payload.
+// The encoder tries every codec and keeps the smallest stream:
+//   CODEC_RAW         the words as-is
+//   CODEC_FOR         frame of reference: base + bit-packed (v - base)
+//   CODEC_DELTA       non-decreasing runs: first value + bit-packed (delta - step)
+//   CODEC_BYTE_PLANE  the four byte planes of each word, each one FOR bit-packed
+//                     (exponent/high bytes of floats in a narrow range pack tightly)
+// Bit-packed value i occupies bits [i*bits, (i+1)*bits) of a little-endian
+// byte stream. Payloads carry CODEC_SLACK trailing bytes so the unpack kernels
+// can always load a full word. Unpacking uses AVX-512/AVX2 gathers when the
+// CPU supports them (selected at runtime).
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <immintrin.h>
+
+enum Codec : uint8_t { CODEC_RAW = 0, CODEC_FOR = 1, CODEC_DELTA = 2, CODEC_BYTE_PLANE = 3, CODEC_COUNT = 4 };
+
+inline const char* codec_name(uint8_t codec) {
+    static const char* names[CODEC_COUNT] = {"raw", "for", "delta", "byte-plane"};
+    return codec < CODEC_COUNT ? names[codec] : "unknown";
+}
+
+struct ColumnHeader {
+    uint8_t codec;
+    uint8_t bits;        // bit width of packed values (FOR, DELTA)
+    uint8_t reserved[2];
+    uint32_t count;      // number of words
+    uint32_t base;       // FOR reference, or first value (DELTA)
+    uint32_t step;       // smallest delta (DELTA)
+    uint64_t bytes;      // payload bytes following the header
+};
+
+constexpr size_t CODEC_SLACK = 8;
+
+// Block codec option of the writers (metadata keys "attribute_codec" / "accessibility_codec")
+enum class BlockCodec { None, Auto };
+
+inline const char* block_codec_name(BlockCodec codec) { return codec == BlockCodec::Auto ? "auto" : "none"; }
+
+inline bool parse_block_codec(const std::string& name, BlockCodec& codec) {
+    if (name == "none") codec = BlockCodec::None;
+    else if (name == "auto") codec = BlockCodec::Auto;
+    else return false;
+    return true;
+}
+
+// Streams written per codec and bytes before/after encoding
+struct CodecStats {
+    uint64_t streams[CODEC_COUNT] = {};
+    uint64_t raw_bytes = 0, encoded_bytes = 0;
+
+    std::string summary() const {
+        std::string s;
+        for (int c = 0; c < CODEC_COUNT; ++c)
+            s += std::string(c ? ", " : "") + codec_name(c) + " " + std::to_string(streams[c]);
+        return s;
+    }
+};
+
+// ===============================================
+// BIT PACKING
+// ===============================================
+inline uint32_t bit_width(uint32_t v) { return v ? 32 - __builtin_clz(v) : 0; }
+
+inline size_t packed_bytes(size_t n, uint32_t bits) { return (n * bits + 7) / 8 + CODEC_SLACK; }
+
+// Packs (v[i] - base) with `bits` bits each; out must hold packed_bytes(n, bits) zeroed bytes
+inline void bitpack(const uint32_t* v, size_t n, uint32_t base, uint32_t bits, uint8_t* out) {
+    if (bits == 0) return;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t bit = uint64_t(i) * bits;
+        uint64_t w;
+        memcpy(&w, out + bit / 8, 8);
+        w |= uint64_t(v[i] - base) << (bit % 8);
+        memcpy(out + bit / 8, &w, 8);
+    }
+}
+
+// out[i] = base + packed value i
+using UnpackFn = void (*)(const uint8_t* in, uint32_t bits, size_t n, uint32_t base, uint32_t* out);
+
+inline void unpack_scalar(const uint8_t* in, uint32_t bits, size_t n, uint32_t base, uint32_t* out) {
+    uint64_t mask = (uint64_t(1) << bits) - 1;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t bit = uint64_t(i) * bits;
+        uint64_t w;
+        memcpy(&w, in + bit / 8, 8);
+        out[i] = base + uint32_t((w >> (bit % 8)) & mask);
+    }
+}
+
+// Groups of 8 values start on a byte boundary (8 * bits bits), so every lane
+// gathers the 32-bit word at a fixed byte offset of the group and shifts it.
+// Needs bits + 7 <= 32; wider values use the scalar kernel.
+__attribute__((target("avx2")))
+inline void unpack_avx2(const uint8_t* in, uint32_t bits, size_t n, uint32_t base, uint32_t* out) {
+    size_t i = 0;
+    if (bits > 0 && bits <= 25) {
+        __m256i lane_bit = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(bits));
+        __m256i byte_off = _mm256_srli_epi32(lane_bit, 3);
+        __m256i shift = _mm256_and_si256(lane_bit, _mm256_set1_epi32(7));
+        __m256i mask = _mm256_set1_epi32((1u << bits) - 1);
+        __m256i vbase = _mm256_set1_epi32(base);
+        for (; i + 8 <= n; i += 8) {
+            const int* group = reinterpret_cast<const int*>(in + (i / 8) * bits);
+            __m256i w = _mm256_i32gather_epi32(group, byte_off, 1);
+            w = _mm256_and_si256(_mm256_srlv_epi32(w, shift), mask);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_add_epi32(w, vbase));
+        }
+    } else if (bits == 0) {
+        std::fill(out, out + n, base);
+        return;
+    }
+    if (i < n) {
+        // The tail starts on a byte boundary as well (i is a multiple of 8)
+        unpack_scalar(in + (i / 8) * bits, bits, n - i, base, out + i);
+    }
+}
+
+// GCC 12 warns about the undefined source register of the unmasked gather
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+inline void unpack_avx512(const uint8_t* in, uint32_t bits, size_t n, uint32_t base, uint32_t* out) {
+    size_t i = 0;
+    if (bits > 0 && bits <= 25) {
+        __m512i lane_bit = _mm512_mullo_epi32(
+            _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(bits));
+        __m512i byte_off = _mm512_srli_epi32(lane_bit, 3);
+        __m512i shift = _mm512_and_si512(lane_bit, _mm512_set1_epi32(7));
+        __m512i mask = _mm512_set1_epi32((1u << bits) - 1);
+        __m512i vbase = _mm512_set1_epi32(base);
+        for (; i + 16 <= n; i += 16) {
+            const void* group = in + (i / 8) * bits;
+            __m512i w = _mm512_i32gather_epi32(byte_off, group, 1);
+            w = _mm512_and_si512(_mm512_srlv_epi32(w, shift), mask);
+            _mm512_storeu_si512(out + i, _mm512_add_epi32(w, vbase));
+        }
+    } else if (bits == 0) {
+        std::fill(out, out + n, base);
+        return;
+    }
+    if (i < n) unpack_scalar(in + (i / 8) * bits, bits, n - i, base, out + i);
+}
+#pragma GCC diagnostic pop
+
+// In-place inclusive prefix sum (DELTA decode)
+inline void prefix_sum_scalar(uint32_t* v, size_t n) {
+    for (size_t i = 1; i < n; ++i) v[i] += v[i - 1];
+}
+
+__attribute__((target("avx2")))
+inline void prefix_sum_avx2(uint32_t* v, size_t n) {
+    __m256i carry = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+        // Scan inside each 128-bit half, then add the low half's total to the high half
+        x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+        x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+        __m256i low_total = _mm256_permutevar8x32_epi32(x, _mm256_set1_epi32(3));
+        x = _mm256_add_epi32(x, _mm256_blend_epi32(_mm256_setzero_si256(), low_total, 0xF0));
+        x = _mm256_add_epi32(x, carry);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(v + i), x);
+        carry = _mm256_permutevar8x32_epi32(x, _mm256_set1_epi32(7));
+    }
+    for (; i < n; ++i) v[i] += i ? v[i - 1] : 0;
+}
+
+struct CodecKernels {
+    UnpackFn unpack;
+    void (*prefix_sum)(uint32_t*, size_t);
+    const char* name;
+};
+
+// Widest kernels the CPU supports
+inline const CodecKernels& codec_kernels() {
+    static const CodecKernels k = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return CodecKernels{unpack_avx512, prefix_sum_avx2, "avx512"};
+        if (__builtin_cpu_supports("avx2")) return CodecKernels{unpack_avx2, prefix_sum_avx2, "avx2"};
+        return CodecKernels{unpack_scalar, prefix_sum_scalar, "scalar"};
+    }();
+    return k;
+}
+
+// ===============================================
+// ENCODE / DECODE
+// ===============================================
+// Values per byte-plane decode step (a multiple of 8, so every step starts on a byte)
+constexpr size_t BYTE_PLANE_CHUNK = 4096;
+
+// Appends the smallest encoding of v[0..n) to out
+inline void encode_column(const uint32_t* v, size_t n, std::vector<char>& out, CodecStats* stats = nullptr) {
+    ColumnHeader h;
+    memset(&h, 0, sizeof(h));
+    h.codec = CODEC_RAW;
+    h.count = n;
+    h.bytes = n * 4;
+
+    uint32_t lo = n ? *std::min_element(v, v + n) : 0;
+    uint32_t hi = n ? *std::max_element(v, v + n) : 0;
+    uint32_t for_bits = bit_width(hi - lo);
+    if (packed_bytes(n, for_bits) < h.bytes) {
+        h.codec = CODEC_FOR;
+        h.bits = for_bits;
+        h.base = lo;
+        h.bytes = packed_bytes(n, for_bits);
+    }
+
+    bool sorted = n > 1 && std::is_sorted(v, v + n);
+    uint32_t dmin = UINT32_MAX, dmax = 0;
+    for (size_t i = 1; sorted && i < n; ++i) {
+        dmin = std::min(dmin, v[i] - v[i - 1]);
+        dmax = std::max(dmax, v[i] - v[i - 1]);
+    }
+    uint32_t delta_bits = sorted ? bit_width(dmax - dmin) : 32;
+    if (sorted && packed_bytes(n - 1, delta_bits) < h.bytes) {
+        h.codec = CODEC_DELTA;
+        h.bits = delta_bits;
+        h.base = v[0];
+        h.step = dmin;
+        h.bytes = packed_bytes(n - 1, delta_bits);
+    }
+
+    uint8_t plane_base[4], plane_bits[4];
+    uint64_t plane_total = 8 + CODEC_SLACK;
+    for (int p = 0; p < 4; ++p) {
+        uint8_t pl = 0xFF, ph = 0;
+        for (size_t i = 0; i < n; ++i) {
+            uint8_t b = v[i] >> (8 * p);
+            pl = std::min(pl, b);
+            ph = std::max(ph, b);
+        }
+        plane_base[p] = n ? pl : 0;
+        plane_bits[p] = n ? bit_width(ph - pl) : 0;
+        plane_total += packed_bytes(n, plane_bits[p]) - CODEC_SLACK;
+    }
+    if (plane_total < h.bytes) {
+        h.codec = CODEC_BYTE_PLANE;
+        h.bytes = plane_total;
+    }
+
+    size_t at = out.size();
+    out.resize(at + sizeof(h) + h.bytes, 0);
+    memcpy(out.data() + at, &h, sizeof(h));
+    uint8_t* payload = reinterpret_cast<uint8_t*>(out.data() + at + sizeof(h));
+    if (h.codec == CODEC_RAW) {
+        memcpy(payload, v, n * 4);
+    } else if (h.codec == CODEC_FOR) {
+        bitpack(v, n, h.base, h.bits, payload);
+    } else if (h.codec == CODEC_DELTA) {
+        std::vector<uint32_t> deltas(n - 1);
+        for (size_t i = 1; i < n; ++i) deltas[i - 1] = v[i] - v[i - 1];
+        bitpack(deltas.data(), n - 1, h.step, h.bits, payload);
+    } else {
+        memcpy(payload, plane_base, 4);
+        memcpy(payload + 4, plane_bits, 4);
+        uint8_t* dst = payload + 8;
+        std::vector<uint32_t> plane(n);
+        for (int p = 0; p < 4; ++p) {
+            for (size_t i = 0; i < n; ++i) plane[i] = (v[i] >> (8 * p)) & 0xFF;
+            bitpack(plane.data(), n, plane_base[p], plane_bits[p], dst);
+            dst += packed_bytes(n, plane_bits[p]) - CODEC_SLACK;
+        }
+    }
+    if (stats) {
+        stats->streams[h.codec]++;
+        stats->raw_bytes += n * 4;
+        stats->encoded_bytes += sizeof(h) + h.bytes;
+    }
+}
+
+// Decodes the payload of a stream described by h into out[0..h.count)
+inline bool decode_column(const ColumnHeader& h, const uint8_t* payload, uint32_t* out) {
+    const CodecKernels& k = codec_kernels();
+    size_t n = h.count;
+    switch (h.codec) {
+    case CODEC_RAW:
+        memcpy(out, payload, n * 4);
+        return true;
+    case CODEC_FOR:
+        k.unpack(payload, h.bits, n, h.base, out);
+        return true;
+    case CODEC_DELTA:
+        if (n == 0) return true;
+        out[0] = h.base;
+        k.unpack(payload, h.bits, n - 1, h.step, out + 1);
+        k.prefix_sum(out, n);
+        return true;
+    case CODEC_BYTE_PLANE: {
+        const uint8_t* plane_base = payload;
+        const uint8_t* plane_bits = payload + 4;
+        const uint8_t* plane_data[4];
+        const uint8_t* p = payload + 8;
+        for (int b = 0; b < 4; ++b) {
+            plane_data[b] = p;
+            p += (n * plane_bits[b] + 7) / 8;
+        }
+        uint32_t tmp[4][BYTE_PLANE_CHUNK];
+        for (size_t i = 0; i < n; i += BYTE_PLANE_CHUNK) {
+            size_t m = std::min(BYTE_PLANE_CHUNK, n - i);
+            for (int b = 0; b < 4; ++b)
+                k.unpack(plane_data[b] + i / 8 * plane_bits[b], plane_bits[b], m, plane_base[b], tmp[b]);
+            for (size_t j = 0; j < m; ++j)
+                out[i + j] = tmp[0][j] | tmp[1][j] << 8 | tmp[2][j] << 16 | tmp[3][j] << 24;
+        }
+        return true;
+    }
+    }
+    return false;
+}
@@ -0,0 +1,504 @@
+#pragma once
+// ===============================================
+// PACKED DATASET CONTAINER
+// ===============================================
+// Optional single-file form of a preprocessed dataset, <base>/dataset.aspa:
+//   offset 0   ContainerHeader (schema the dataset was written with)
+//   ...        file directory: one ContainerEntry per file, sorted by path
+//   ...        indexes, validity bitmaps, metadata and manifest, 64-byte aligned
+//   ...        block files, 4096-byte aligned
+// Paths are relative to the dataset directory, as in the loose layout
+// (dataset_format.h). One mmap() of the container exposes the directory and
+// every index; blocks are read with pread() at their container offset, or
+// copied from the mapping when the dataset's metadata says read_method=mmap.
+// DatasetFiles resolves dataset-relative paths against the container when
+// there is one and against the directory tree otherwise.
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "dataset_format.h"
+
+constexpr char CONTAINER_MAGIC[8] = {'A', 'S', 'P', 'A', 'P', 'A', 'C', 'K'};
+constexpr uint32_t CONTAINER_VERSION = 1;
+constexpr const char* CONTAINER_FILE = "dataset.aspa";
+constexpr uint64_t CONTAINER_INDEX_ALIGN = 64;
+constexpr uint64_t CONTAINER_BLOCK_ALIGN = 4096;
+
+struct ContainerHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    // Schema: attribute counts and record layouts of the build that wrote it
+    uint32_t origin_attrs;              // ORIGIN_ATTRS
+    uint32_t destination_attrs;         // DEST_ATTRS
+    uint32_t accessibility_bytes;       // sizeof(Accessibility)
+    uint32_t attr_value_bytes;          // sizeof(AttrValue)
+    uint32_t attribute_index_bytes;     // sizeof(AttributeIndex)
+    uint32_t acc_index_bytes;           // sizeof(AccIndexEntry)
+    uint32_t acc_column_index_bytes;    // sizeof(AccColumnIndexEntry)
+    uint32_t column_header_bytes;       // sizeof(ColumnHeader)
+    uint64_t directory_offset;
+    uint64_t blocks_offset;             // end of the index region
+    uint64_t total_bytes;
+};
+
+struct ContainerEntry {
+    uint64_t offset;
+    uint64_t size;
+    char path[112];                     // NUL-terminated, relative to the dataset directory
+};
+
+inline ContainerHeader container_schema() {
+    ContainerHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CONTAINER_MAGIC, sizeof(h.magic));
+    h.version = CONTAINER_VERSION;
+    h.origin_attrs = ORIGIN_ATTRS;
+    h.destination_attrs = DEST_ATTRS;
+    h.accessibility_bytes = sizeof(Accessibility);
+    h.attr_value_bytes = sizeof(AttrValue);
+    h.attribute_index_bytes = sizeof(AttributeIndex);
+    h.acc_index_bytes = sizeof(AccIndexEntry);
+    h.acc_column_index_bytes = sizeof(AccColumnIndexEntry);
+    h.column_header_bytes = sizeof(ColumnHeader);
+    return h;
+}
+
+inline std::string container_path(const std::string& base) { return base + "/" + CONTAINER_FILE; }
+
+// How block bytes are fetched: pread() into the caller's buffer, or memcpy()
+// from a mapping of the file (page faults instead of syscalls)
+enum class ReadMethod { Pread, Mmap };
+
+inline const char* read_method_name(ReadMethod m) { return m == ReadMethod::Mmap ? "mmap" : "pread"; }
+
+inline bool parse_read_method(const std::string& s, ReadMethod& m) {
+    if (s == "pread") m = ReadMethod::Pread;
+    else if (s == "mmap") m = ReadMethod::Mmap;
+    else return false;
+    return true;
+}
+
+// pread() exactly len bytes
+inline bool pread_all(int fd, void* data, size_t len, uint64_t offset) {
+    char* dst = static_cast<char*>(data);
+    while (len > 0) {
+        ssize_t n = pread(fd, dst, len, offset);
+        if (n <= 0) return false;
+        dst += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Byte range of one dataset file
+struct FileRegion {
+    int fd = -1;
+    uint64_t offset = 0;            // position of the file's first byte in fd
+    uint64_t size = 0;
+    const char* data = nullptr;     // mapped bytes (packed datasets, or loose files read with mmap)
+};
+
+class DatasetFiles {
+public:
+    DatasetFiles() = default;
+    DatasetFiles(const DatasetFiles&) = delete;
+    DatasetFiles& operator=(const DatasetFiles&) = delete;
+    ~DatasetFiles() {
+        if (map_) munmap(map_, map_bytes_);
+        if (fd_ >= 0) ::close(fd_);
+        for (auto& [path, region] : loose_) {
+            if (region.data) munmap(const_cast<char*>(region.data), region.size);
+            ::close(region.fd);
+        }
+    }
+
+    // base is the dataset directory (<dir>/<N>p). Opens <base>/dataset.aspa if
+    // present (rejecting containers of another schema), else the directory tree.
+    // The read method is the one recorded in the dataset's metadata.
+    bool open(const std::string& base, std::string* error = nullptr) {
+        base_ = base;
+        auto fail = [&](const std::string& msg) {
+            if (error) *error = msg;
+            return false;
+        };
+        std::string path = container_path(base);
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            if (!std::filesystem::is_directory(base)) return fail("Cannot open dataset " + base);
+            return open_metadata(fail);
+        }
+        struct stat st;
+        if (fstat(fd_, &st) != 0 || uint64_t(st.st_size) < sizeof(ContainerHeader)) return fail("Truncated " + path);
+        map_bytes_ = st.st_size;
+        void* p = mmap(nullptr, map_bytes_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) return fail("Cannot map " + path);
+        map_ = static_cast<char*>(p);
+
+        const ContainerHeader& h = header();
+        ContainerHeader expect = container_schema();
+        if (memcmp(h.magic, expect.magic, sizeof(h.magic)) != 0 || h.version != expect.version)
+            return fail(path + " is not a dataset container");
+        if (memcmp(&h.origin_attrs, &expect.origin_attrs,
+                   offsetof(ContainerHeader, directory_offset) - offsetof(ContainerHeader, origin_attrs)) != 0)
+            return fail(path + " was written with another schema");
+        if (h.total_bytes > map_bytes_ || h.directory_offset + uint64_t(h.file_count) * sizeof(ContainerEntry) > h.blocks_offset ||
+            h.blocks_offset > h.total_bytes)
+            return fail("Truncated " + path);
+        // The index region is read at startup: fault it in with one request
+        madvise(map_, h.blocks_offset, MADV_WILLNEED);
+        return open_metadata(fail);
+    }
+
+    ReadMethod read_method() const { return method_; }
+    // Overrides the recorded read method for files located from now on
+    void set_read_method(ReadMethod m) { method_ = m; }
+
+    bool packed() const { return map_ != nullptr; }
+    const std::string& base() const { return base_; }
+    size_t packed_files() const { return packed() ? header().file_count : 0; }
+    uint64_t packed_bytes() const { return packed() ? header().total_bytes : 0; }
+    std::vector<std::string> packed_paths() const {
+        std::vector<std::string> paths;
+        for (size_t i = 0; i < packed_files(); ++i) paths.push_back(entries()[i].path);
+        return paths;
+    }
+
+    // Locates a file by its dataset-relative path. Thread-safe.
+    bool find(const std::string& rel, FileRegion& region) const {
+        if (packed()) {
+            const ContainerEntry* first = entries();
+            const ContainerEntry* last = first + header().file_count;
+            const ContainerEntry* e = std::lower_bound(
+                first, last, rel, [](const ContainerEntry& a, const std::string& p) { return strcmp(a.path, p.c_str()) < 0; });
+            if (e == last || rel != e->path) return false;
+            region.fd = fd_;
+            region.offset = e->offset;
+            region.size = e->size;
+            region.data = map_ + e->offset;
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(loose_mutex_);
+        auto it = loose_.find(rel);
+        if (it == loose_.end()) {
+            int fd = ::open((base_ + "/" + rel).c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            FileRegion r;
+            r.fd = fd;
+            r.size = fstat(fd, &st) == 0 ? st.st_size : 0;
+            if (method_ == ReadMethod::Mmap && r.size > 0) {
+                void* p = mmap(nullptr, r.size, PROT_READ, MAP_SHARED, fd, 0);
+                if (p != MAP_FAILED) r.data = static_cast<const char*>(p);
+            }
+            it = loose_.emplace(rel, r).first;
+        }
+        region = it->second;
+        return true;
+    }
+
+    // len bytes at offset of region.fd (offsets include region.offset, as for pread)
+    bool read_at(const FileRegion& region, void* data, size_t len, uint64_t offset) const {
+        if (method_ == ReadMethod::Mmap && region.data) {
+            const char* p = view_at(region, len, offset);
+            if (!p) return false;
+            memcpy(data, p, len);
+            return true;
+        }
+        return pread_all(region.fd, data, len, offset);
+    }
+
+    // The same bytes in place in the mapping (packed datasets, or loose files
+    // under ReadMethod::Mmap), valid while this object lives; nullptr if the
+    // region is not mapped
+    const char* view_at(const FileRegion& region, size_t len, uint64_t offset) const {
+        if (!region.data) return nullptr;
+        if (offset < region.offset || offset - region.offset + len > region.size) return nullptr;
+        return region.data + (offset - region.offset);
+    }
+
+    // Whole file as text (metadata, manifest)
+    bool read(const std::string& rel, std::string& out) const {
+        FileRegion r;
+        if (!find(rel, r)) return false;
+        if (r.data) {
+            out.assign(r.data, r.size);
+            return true;
+        }
+        out.resize(r.size);
+        return pread_all(r.fd, out.data(), r.size, r.offset);
+    }
+
+    // Whole file as an array of fixed-size records (index files)
+    template <typename T>
+    bool read_array(const std::string& rel, std::vector<T>& out) const {
+        FileRegion r;
+        if (!find(rel, r)) return false;
+        out.resize(r.size / sizeof(T));
+        if (r.data) {
+            memcpy(out.data(), r.data, out.size() * sizeof(T));
+            return true;
+        }
+        return pread_all(r.fd, out.data(), out.size() * sizeof(T), r.offset);
+    }
+
+    // Total size of the files under a dataset-relative directory
+    uint64_t bytes_under(const std::string& dir) const {
+        uint64_t total = 0;
+        if (packed()) {
+            std::string prefix = dir + "/";
+            for (uint32_t i = 0; i < header().file_count; ++i)
+                if (strncmp(entries()[i].path, prefix.c_str(), prefix.size()) == 0) total += entries()[i].size;
+            return total;
+        }
+        std::error_code ec;
+        std::string path = base_ + "/" + dir;
+        if (!std::filesystem::is_directory(path, ec)) return 0;
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(path, ec))
+            if (entry.is_regular_file(ec)) total += entry.file_size(ec);
+        return total;
+    }
+
+private:
+    template <typename Fail>
+    bool open_metadata(Fail& fail) {
+        std::string text;
+        if (!read("metadata.txt", text)) return true;
+        std::istringstream in(text);
+        auto meta = parse_dataset_metadata(in);
+        auto it = meta.find("read_method");
+        if (it != meta.end() && !parse_read_method(it->second, method_))
+            return fail("Unknown read method in " + base_ + "/metadata.txt: " + it->second);
+        return true;
+    }
+
+    const ContainerHeader& header() const { return *reinterpret_cast<const ContainerHeader*>(map_); }
+    const ContainerEntry* entries() const {
+        return reinterpret_cast<const ContainerEntry*>(map_ + header().directory_offset);
+    }
+
+    std::string base_;
+    int fd_ = -1;
+    char* map_ = nullptr;
+    uint64_t map_bytes_ = 0;
+    ReadMethod method_ = ReadMethod::Pread;
+    mutable std::mutex loose_mutex_;
+    mutable std::map<std::string, FileRegion> loose_;  // descriptors of loose files opened so far
+};
+
+// Path of a file of one manifest segment, relative to the dataset directory
+inline std::string segment_path(const DatasetSegment& seg, const std::string& rel) {
+    return seg.path == "." ? rel : seg.path + "/" + rel;
+}
+
+inline std::map<std::string, std::string> read_dataset_metadata(const DatasetFiles& files, const std::string& rel) {
+    std::string text;
+    files.read(rel, text);
+    std::istringstream in(text);
+    return parse_dataset_metadata(in);
+}
+
+// Manifest of the dataset, or a single base segment for datasets without one.
+// Attribute counts of a base without manifest come from its index files.
+inline DatasetManifest load_manifest(const DatasetFiles& files) {
+    DatasetManifest manifest;
+    std::string text;
+    if (files.read("manifest.txt", text)) {
+        std::istringstream in(text);
+        parse_manifest(in, manifest);
+        return manifest;
+    }
+    DatasetSegment seg;
+    FileRegion r;
+    seg.origin_attrs = files.find("attributes/origin/index.bin", r) ? r.size / sizeof(AttributeIndex) : 0;
+    seg.destination_attrs = files.find("attributes/destination/index.bin", r) ? r.size / sizeof(AttributeIndex) : 0;
+    manifest.segments.push_back(seg);
+    return manifest;
+}
+
+inline DatasetManifest load_manifest(const std::string& base) {
+    DatasetFiles files;
+    files.open(base);
+    return load_manifest(files);
+}
+
+// Copies len bytes between descriptors, in the kernel when possible
+inline bool copy_region(int in, uint64_t in_offset, int out, uint64_t out_offset, uint64_t len) {
+    while (len > 0) {
+        loff_t src = in_offset, dst = out_offset;
+        ssize_t n = copy_file_range(in, &src, out, &dst, len, 0);
+        if (n <= 0) break;
+        in_offset += n;
+        out_offset += n;
+        len -= n;
+    }
+    std::vector<char> buf(std::min<uint64_t>(len, 16 * 1024 * 1024));
+    while (len > 0) {
+        size_t n = std::min<uint64_t>(len, buf.size());
+        if (!pread_all(in, buf.data(), n, in_offset) || !pwrite_all(out, buf.data(), n, out_offset)) return false;
+        in_offset += n;
+        out_offset += n;
+        len -= n;
+    }
+    return true;
+}
+
+struct PackStats {
+    uint32_t files = 0;
+    uint64_t bytes = 0;
+};
+
+// Packs the dataset at base into <base>/dataset.aspa and removes the loose
+// files it now holds. Files of an existing container are carried over, loose
+// files replacing them (a repack after --append). Only the segments of the
+// manifest are packed: other directories under segments/ (left by an
+// unpublished append) stay loose, and are dropped from an old container.
+// Reports stay loose.
+inline bool pack_dataset(const std::string& base, PackStats& stats, std::string& error) {
+    namespace fs = std::filesystem;
+    struct Source {
+        std::string loose;          // absolute path, or empty for a file of the old container
+        FileRegion packed;
+    };
+    DatasetFiles old;
+    if (!old.open(base, &error)) return false;
+    // The manifest to pack: a loose one (just written by --append) replaces
+    // the container's copy, which old would otherwise read
+    DatasetManifest manifest;
+    std::ifstream loose_manifest(manifest_path(base));
+    if (loose_manifest) parse_manifest(loose_manifest, manifest);
+    else manifest = load_manifest(old);
+    auto referenced = [&](const std::string& rel) {
+        if (rel.rfind("segments/", 0) != 0) return true;
+        for (const DatasetSegment& seg : manifest.segments)
+            if (seg.path != "." && rel.rfind(seg.path + "/", 0) == 0) return true;
+        return false;
+    };
+    std::map<std::string, Source> files;
+    for (const std::string& rel : old.packed_paths())
+        if (referenced(rel)) old.find(rel, files[rel].packed);
+    std::error_code ec, walk_ec;
+    for (const auto& entry : fs::recursive_directory_iterator(base, walk_ec)) {
+        if (!entry.is_regular_file(ec)) continue;
+        std::string name = entry.path().filename().string();
+        if (name.rfind(CONTAINER_FILE, 0) == 0 || name.rfind("preprocessing_report_", 0) == 0) continue;
+        std::string rel = fs::relative(entry.path(), base, ec).string();
+        if (ec || rel.empty()) {
+            error = "Cannot resolve " + entry.path().string() + " under " + base;
+            return false;
+        }
+        if (!referenced(rel)) continue;
+        if (rel.size() >= sizeof(ContainerEntry::path)) {
+            error = "Path too long for the container: " + rel;
+            return false;
+        }
+        files[rel] = Source{entry.path().string(), FileRegion()};
+    }
+    if (walk_ec) {
+        error = "Cannot list " + base;
+        return false;
+    }
+
+    // Index region first (small files, read at startup), then the blocks
+    std::vector<std::string> order;
+    for (int blocks = 0; blocks < 2; ++blocks)
+        for (const auto& [rel, src] : files)
+            if ((rel.find("blocks/") != std::string::npos) == bool(blocks)) order.push_back(rel);
+
+    ContainerHeader h = container_schema();
+    h.file_count = order.size();
+    h.directory_offset = (sizeof(ContainerHeader) + CONTAINER_INDEX_ALIGN - 1) / CONTAINER_INDEX_ALIGN * CONTAINER_INDEX_ALIGN;
+    std::vector<ContainerEntry> dir(order.size());
+    std::vector<uint64_t> sizes(order.size());
+    uint64_t at = h.directory_offset + dir.size() * sizeof(ContainerEntry);
+    bool in_blocks = false;
+    for (size_t i = 0; i < order.size(); ++i) {
+        const Source& src = files[order[i]];
+        if (src.loose.empty()) {
+            sizes[i] = src.packed.size;
+        } else {
+            sizes[i] = fs::file_size(src.loose, ec);
+            if (ec) {
+                error = "Cannot stat " + src.loose;
+                return false;
+            }
+        }
+        bool block = order[i].find("blocks/") != std::string::npos;
+        if (block && !in_blocks) {
+            at = (at + CONTAINER_BLOCK_ALIGN - 1) / CONTAINER_BLOCK_ALIGN * CONTAINER_BLOCK_ALIGN;
+            h.blocks_offset = at;
+            in_blocks = true;
+        }
+        uint64_t align = block ? CONTAINER_BLOCK_ALIGN : CONTAINER_INDEX_ALIGN;
+        at = (at + align - 1) / align * align;
+        memset(&dir[i], 0, sizeof(ContainerEntry));
+        dir[i].offset = at;
+        dir[i].size = sizes[i];
+        memcpy(dir[i].path, order[i].data(), order[i].size());
+        at += sizes[i];
+    }
+    if (!in_blocks) h.blocks_offset = at;
+    h.total_bytes = at;
+    // Directory sorted by path for binary search
+    std::sort(dir.begin(), dir.end(),
+              [](const ContainerEntry& a, const ContainerEntry& b) { return strcmp(a.path, b.path) < 0; });
+
+    std::string tmp = container_path(base) + ".tmp";
+    int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0 || ftruncate(out, h.total_bytes) != 0) {
+        if (out >= 0) ::close(out);
+        error = "Cannot create " + tmp;
+        return false;
+    }
+    bool ok = pwrite_all(out, reinterpret_cast<const char*>(&h), sizeof(h), 0) &&
+              pwrite_all(out, reinterpret_cast<const char*>(dir.data()), dir.size() * sizeof(ContainerEntry),
+                         h.directory_offset);
+    for (const auto& e : dir) {
+        if (!ok) break;
+        const Source& src = files[e.path];
+        if (src.loose.empty()) {
+            ok = copy_region(src.packed.fd, src.packed.offset, out, e.offset, e.size);
+        } else {
+            int in = ::open(src.loose.c_str(), O_RDONLY);
+            ok = in >= 0 && copy_region(in, 0, out, e.offset, e.size);
+            if (in >= 0) ::close(in);
+        }
+    }
+    ok = ::close(out) == 0 && ok;
+    if (!ok) {
+        fs::remove(tmp, ec);
+        error = "Cannot write " + tmp;
+        return false;
+    }
+    fs::rename(tmp, container_path(base), ec);
+    if (ec) {
+        error = "Cannot replace " + container_path(base);
+        return false;
+    }
+
+    // The container now holds the loose files: remove them and any directory left empty
+    std::vector<fs::path> dirs;
+    for (const auto& [rel, src] : files) {
+        if (src.loose.empty()) continue;
+        fs::remove(src.loose, ec);
+        for (fs::path d = fs::path(rel).parent_path(); !d.empty(); d = d.parent_path()) dirs.push_back(base / d);
+    }
+    std::sort(dirs.begin(), dirs.end(), [](const fs::path& a, const fs::path& b) { return a.native().size() > b.native().size(); });
+    for (const auto& d : dirs) fs::remove(d, ec);  // fails (and is skipped) while not empty
+    stats.files = h.file_count;
+    stats.bytes = h.total_bytes;
+    return true;
+}
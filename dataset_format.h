@@ -0,0 +1,1097 @@
+#pragma once
+// ===============================================
+// PREPROCESSED DATASET FORMAT
+// ===============================================
+// Layout written by preprocess_dataset (and by the fused generator mode):
+//   <base>/attributes/{origin,destination}/blocks/block_N.bin  (id, value) pairs, one run per attribute
+//   <base>/attributes/{origin,destination}/index.bin           one AttributeIndex per attribute
+//   <base>/attributes/{origin,destination}/validity.bin        roaring bitmap of non-null IDs per attribute
+//   <base>/attributes/{origin,destination}/validity_index.bin  one ValidityIndex per attribute
+//   <base>/attributes/{origin,destination}/zones.bin           one AttrZone per attribute
+//   <base>/accessibility/blocks/block_N.bin                     records grouped by destination (see AccLayout)
+//   <base>/accessibility/index.bin                              one index entry per destination run piece
+//   <base>/accessibility/zones.bin                              one AccZone per index entry, same order
+//   <base>/accessibility/block_zones.bin                        one AccZone per block
+//   <base>/accessibility_by_origin/...                          optional origin-major copy (same layout)
+//   <base>/accessibility_tiles/{blocks,index.bin,zones.bin}     optional copy in 2D tiles (AccTileIndexEntry)
+//   <base>/metadata.txt                                         key=value dataset properties
+//   <base>/manifest.txt                                         segments of an incrementally extended dataset
+//   <base>/segments/seg_N/...                                   one appended segment (same layout as <base>)
+//   <base>/dataset.aspa                                         all of the above packed (dataset_container.h)
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "codecs.h"
+#include "roaring.h"
+#include "stream_writer.h"
+#include "thread_pool.h"
+
+// ===============================================
+// SCHEMA PARAMETERS (IMMUTABLE)
+// ===============================================
+// These values define the fundamental binary file structure.
+// They MUST be known beforehand and cannot be auto-calculated
+// from file size due to the unreliability of inferring binary
+// formats at runtime.
+constexpr uint32_t ORIGIN_ATTRS = 5000;
+constexpr uint32_t DEST_ATTRS   = 2000;
+
+// ===============================================
+// OPTIMAL BLOCK SIZES FOR I/O EFFICIENCY
+// ===============================================
+// Targets chosen for Linux x64 I/O performance optimization. They are the
+// defaults: preprocess_dataset --autotune measures the target filesystem
+// (block_autotune.h) and records the sizes it picked in metadata.txt.
+constexpr size_t TARGET_DEST_ATTR_BLOCK_SIZE_BYTES   = 8 * 1024 * 1024;    // 8 MB
+constexpr size_t TARGET_ORIGIN_ATTR_BLOCK_SIZE_BYTES = 32 * 1024 * 1024;   // 32 MB
+constexpr size_t TARGET_ACC_BLOCK_SIZE_BYTES         = 256 * 1024 * 1024;  // 256 MB
+
+// Block sizes a dataset was written with
+struct BlockSizes {
+    size_t origin_attr = TARGET_ORIGIN_ATTR_BLOCK_SIZE_BYTES;
+    size_t dest_attr = TARGET_DEST_ATTR_BLOCK_SIZE_BYTES;
+    size_t acc = TARGET_ACC_BLOCK_SIZE_BYTES;
+};
+
+struct Accessibility {
+    uint32_t origin_id;
+    uint32_t destination_id;
+    float time;
+    float distance;
+};
+
+// One non-null attribute cell as stored in attribute blocks
+using AttrValue = std::pair<uint32_t, float>;
+
+struct AttributeIndex {
+    uint32_t block_id;
+    uint64_t offset;
+    uint32_t count;
+};
+
+// Serialized RoaringBitmap of one attribute in validity.bin
+struct ValidityIndex {
+    uint64_t offset;
+    uint32_t bytes;
+    uint32_t cardinality;
+};
+
+struct AccIndexEntry {
+    uint32_t id;        // destination_id
+    uint32_t block_id;
+    uint64_t offset;
+    uint32_t count;
+};
+
+// Accessibility block layouts (metadata key "accessibility_layout"):
+//   rows      16-byte Accessibility records; index.bin holds AccIndexEntry
+//   columnar  per run piece: time[count] floats, distance[count] floats and,
+//             unless the origins are dense, origin_id[count] (each column a
+//             codec stream if ACC_PIECE_ENCODED); index.bin holds AccColumnIndexEntry
+enum class AccLayout { Rows, Columnar };
+
+inline const char* acc_layout_name(AccLayout layout) {
+    return layout == AccLayout::Columnar ? "columnar" : "rows";
+}
+
+inline bool parse_acc_layout(const std::string& name, AccLayout& layout) {
+    if (name == "rows") layout = AccLayout::Rows;
+    else if (name == "columnar") layout = AccLayout::Columnar;
+    else return false;
+    return true;
+}
+
+// Origins of the piece are first_origin, first_origin + 1, ... (no origin column)
+constexpr uint32_t ACC_ORIGINS_DENSE = 1;
+// Columns of the piece are codec streams (codecs.h) instead of raw arrays
+constexpr uint32_t ACC_PIECE_ENCODED = 2;
+
+struct AccColumnIndexEntry {
+    uint32_t id;            // destination_id
+    uint32_t block_id;
+    uint64_t offset;        // start of the time column
+    uint32_t count;
+    uint32_t flags;         // ACC_ORIGINS_DENSE, ACC_PIECE_ENCODED
+    uint32_t first_origin;
+    uint32_t reserved;
+};
+
+// Records buffered per columnar piece; longer runs are split into several pieces
+constexpr uint32_t ACC_COLUMN_PIECE_RECORDS = 1 << 20;
+
+// Accessibility tables. The origin-major copy stores every record with
+// origin_id and destination_id swapped, so the same writer and reader handle
+// it: runs (and the index ids) are origins, and the origin_id field/column of
+// a run holds the destinations.
+constexpr const char* ACC_TABLE = "accessibility";
+constexpr const char* ACC_BY_ORIGIN_TABLE = "accessibility_by_origin";
+
+inline void swap_accessibility_ids(Accessibility* recs, size_t n) {
+    for (size_t i = 0; i < n; ++i) std::swap(recs[i].origin_id, recs[i].destination_id);
+}
+
+// ===============================================
+// 2D TILES
+// ===============================================
+// The tiled copy cuts the (origin, destination) plane into tiles of
+// tile_origins x tile_dests IDs (metadata keys of the same names) and stores
+// each tile's 16-byte records contiguously, tiles in Z-order of their
+// (origin_tile, dest_tile) coordinates so that neighbouring tiles in both
+// dimensions stay close on disk. A query reads only the tiles whose origin and
+// destination ranges both hold selected IDs. index.bin has one entry per tile
+// piece (a tile cut by a block boundary continues in the next block), in
+// write order; zones.bin one AccZone per entry.
+constexpr const char* ACC_TILES_TABLE = "accessibility_tiles";
+constexpr uint64_t ACC_TILE_TARGET_RECORDS = 1 << 20;  // records of a full tile (16 MB)
+constexpr uint64_t ACC_TILE_MAX_TILES = 1 << 24;       // grid cells (the Z-order ranks take 4 bytes each)
+
+struct AccTileIndexEntry {
+    uint32_t origin_tile;   // origins [origin_tile * tile_origins, + tile_origins)
+    uint32_t dest_tile;     // destinations [dest_tile * tile_dests, + tile_dests)
+    uint32_t block_id;
+    uint32_t count;
+    uint64_t offset;
+};
+
+// Origins per tile: the largest power of two whose validity bits fill at most
+// half of the L1 data cache, so the filter's per-tile origin bitmap stays in L1
+inline uint32_t default_tile_origins() {
+    long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    if (l1 <= 0) l1 = 32 * 1024;
+    uint64_t bits = uint64_t(l1) * 8 / 2;
+    uint32_t n = 1;
+    while (uint64_t(n) * 2 <= bits) n *= 2;
+    return n;
+}
+
+inline uint32_t default_tile_dests(uint32_t tile_origins) {
+    return std::max<uint64_t>(1, ACC_TILE_TARGET_RECORDS / tile_origins);
+}
+
+// A tile size (flag or metadata value): a decimal number in [1, UINT32_MAX]
+inline bool parse_tile_size(const std::string& s, uint32_t& n) {
+    if (s.empty() || s.size() > 10 || s.find_first_not_of("0123456789") != std::string::npos) return false;
+    uint64_t v = std::stoull(s);
+    if (v == 0 || v > UINT32_MAX) return false;
+    n = uint32_t(v);
+    return true;
+}
+
+// Interleaves the bits of x (even positions) and y (odd positions)
+inline uint64_t morton_code(uint32_t x, uint32_t y) {
+    auto spread = [](uint64_t v) {
+        v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+        v = (v | (v << 8)) & 0x00FF00FF00FF00FFull;
+        v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0Full;
+        v = (v | (v << 2)) & 0x3333333333333333ull;
+        v = (v | (v << 1)) & 0x5555555555555555ull;
+        return v;
+    };
+    return spread(x) | spread(y) << 1;
+}
+
+// Position in Z-order of every tile of an origin_tiles x dest_tiles grid,
+// indexed by origin_tile * dest_tiles + dest_tile
+// (callers keep the grid within ACC_TILE_MAX_TILES)
+inline std::vector<uint32_t> z_order_ranks(uint32_t origin_tiles, uint32_t dest_tiles) {
+    std::vector<std::pair<uint64_t, uint64_t>> order;
+    order.reserve(uint64_t(origin_tiles) * dest_tiles);
+    for (uint32_t o = 0; o < origin_tiles; ++o)
+        for (uint32_t d = 0; d < dest_tiles; ++d) order.push_back({morton_code(d, o), uint64_t(o) * dest_tiles + d});
+    std::sort(order.begin(), order.end());
+    std::vector<uint32_t> rank(order.size());
+    for (size_t r = 0; r < order.size(); ++r) rank[order[r].second] = uint32_t(r);
+    return rank;
+}
+
+// ===============================================
+// ZONE MAPS
+// ===============================================
+// Min/max statistics written next to the indexes, so readers can skip runs
+// and blocks that cannot satisfy a range predicate. NaN values are ignored.
+struct AccZone {
+    float time_min = INFINITY, time_max = -INFINITY;
+    float distance_min = INFINITY, distance_max = -INFINITY;
+    uint64_t count = 0;
+
+    void add(float time, float distance) {
+        if (time < time_min) time_min = time;
+        if (time > time_max) time_max = time;
+        if (distance < distance_min) distance_min = distance;
+        if (distance > distance_max) distance_max = distance;
+        ++count;
+    }
+    void merge(const AccZone& z) {
+        time_min = std::min(time_min, z.time_min);
+        time_max = std::max(time_max, z.time_max);
+        distance_min = std::min(distance_min, z.distance_min);
+        distance_max = std::max(distance_max, z.distance_max);
+        count += z.count;
+    }
+};
+
+// Non-null values of one attribute
+struct AttrZone {
+    float min = INFINITY, max = -INFINITY;
+    uint32_t count = 0;         // non-null cells
+    uint32_t reserved = 0;
+};
+
+// Writes a side file (zone maps) in one go
+template <typename T>
+inline bool write_side_file(const std::string& path, const std::vector<T>& records, const WriterOptions& opts) {
+    OutputFile f;
+    return f.open(path, opts) && f.write_at(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(T), 0);
+}
+
+// ===============================================
+// DATASET METADATA
+// ===============================================
+inline std::string metadata_path(const std::string& base) { return base + "/metadata.txt"; }
+
+inline std::map<std::string, std::string> parse_dataset_metadata(std::istream& in) {
+    std::map<std::string, std::string> meta;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t eq = line.find('=');
+        if (eq != std::string::npos && line[0] != '#') meta[line.substr(0, eq)] = line.substr(eq + 1);
+    }
+    return meta;
+}
+
+inline std::map<std::string, std::string> read_dataset_metadata(const std::string& base) {
+    std::ifstream in(metadata_path(base));
+    return parse_dataset_metadata(in);
+}
+
+// Metadata keys of BlockSizes. Datasets written before they existed use the defaults.
+inline BlockSizes block_sizes_from_metadata(const std::map<std::string, std::string>& meta) {
+    BlockSizes sizes;
+    auto get = [&](const char* key, size_t& value) {
+        auto it = meta.find(key);
+        if (it != meta.end()) value = std::stoull(it->second);
+    };
+    get("origin_attr_block_bytes", sizes.origin_attr);
+    get("dest_attr_block_bytes", sizes.dest_attr);
+    get("acc_block_bytes", sizes.acc);
+    return sizes;
+}
+
+inline void add_block_sizes(std::map<std::string, std::string>& meta, const BlockSizes& sizes) {
+    meta["origin_attr_block_bytes"] = std::to_string(sizes.origin_attr);
+    meta["dest_attr_block_bytes"] = std::to_string(sizes.dest_attr);
+    meta["acc_block_bytes"] = std::to_string(sizes.acc);
+}
+
+inline bool write_dataset_metadata(const std::string& base, const std::map<std::string, std::string>& meta) {
+    std::ofstream out(metadata_path(base));
+    for (const auto& [key, value] : meta) out << key << "=" << value << "\n";
+    return bool(out);
+}
+
+// ===============================================
+// VERSIONED MANIFEST
+// ===============================================
+// A dataset is the base output of preprocess_dataset plus the segments added
+// by --append runs. Each segment is a directory with the same layout; its
+// attribute tables hold attributes [attr_begin, attr_begin + attrs) for the
+// rows it contains, and its accessibility blocks the records it added.
+// Readers union the segments listed by the manifest they open. Without a
+// manifest the base directory is the only segment (load_manifest in
+// dataset_container.h).
+struct DatasetSegment {
+    std::string path = ".";  // relative to the dataset directory
+    uint32_t origin_attr_begin = 1, origin_attrs = 0;
+    uint32_t destination_attr_begin = 1, destination_attrs = 0;
+    int accessibility = -1;  // 1 if it added accessibility records, 0 if not, -1 unrecorded (older manifests)
+};
+
+struct DatasetManifest {
+    uint32_t version = 0;
+    std::vector<DatasetSegment> segments;
+};
+
+inline std::string manifest_path(const std::string& base) { return base + "/manifest.txt"; }
+
+inline void parse_manifest(std::istream& in, DatasetManifest& manifest) {
+    manifest = DatasetManifest();
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t eq = line.find('=');
+        if (eq == std::string::npos || line[0] == '#') continue;
+        std::string key = line.substr(0, eq), value = line.substr(eq + 1);
+        if (key == "version") {
+            manifest.version = std::stoul(value);
+            continue;
+        }
+        // segment.<i>.<field>
+        size_t dot = key.find('.', 8);
+        if (key.compare(0, 8, "segment.") != 0 || dot == std::string::npos) continue;
+        size_t i = std::stoul(key.substr(8, dot - 8));
+        if (i >= manifest.segments.size()) manifest.segments.resize(i + 1);
+        DatasetSegment& seg = manifest.segments[i];
+        std::string field = key.substr(dot + 1);
+        if (field == "path") seg.path = value;
+        else if (field == "origin_attr_begin") seg.origin_attr_begin = std::stoul(value);
+        else if (field == "origin_attrs") seg.origin_attrs = std::stoul(value);
+        else if (field == "destination_attr_begin") seg.destination_attr_begin = std::stoul(value);
+        else if (field == "destination_attrs") seg.destination_attrs = std::stoul(value);
+        else if (field == "accessibility") seg.accessibility = std::stoi(value) != 0;
+    }
+}
+
+inline bool read_manifest(const std::string& base, DatasetManifest& manifest) {
+    std::ifstream in(manifest_path(base));
+    if (!in) return false;
+    parse_manifest(in, manifest);
+    return true;
+}
+
+// Replaces the manifest atomically (write + rename), so readers see either version
+inline bool write_manifest(const std::string& base, const DatasetManifest& manifest) {
+    std::string tmp = manifest_path(base) + ".tmp";
+    {
+        std::ofstream out(tmp);
+        out << "# dataset manifest: segments are read in order\n";
+        out << "version=" << manifest.version << "\n";
+        for (size_t i = 0; i < manifest.segments.size(); ++i) {
+            const DatasetSegment& seg = manifest.segments[i];
+            std::string k = "segment." + std::to_string(i) + ".";
+            out << k << "path=" << seg.path << "\n";
+            out << k << "origin_attr_begin=" << seg.origin_attr_begin << "\n";
+            out << k << "origin_attrs=" << seg.origin_attrs << "\n";
+            out << k << "destination_attr_begin=" << seg.destination_attr_begin << "\n";
+            out << k << "destination_attrs=" << seg.destination_attrs << "\n";
+            if (seg.accessibility >= 0) out << k << "accessibility=" << seg.accessibility << "\n";
+        }
+        if (!out) return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, manifest_path(base), ec);
+    return !ec;
+}
+
+inline std::string block_path(const std::string& dir, uint32_t block_id) {
+    return dir + "/blocks/block_" + std::to_string(block_id) + ".bin";
+}
+
+// Writes the runs of one attribute table in attribute order. A new block is
+// started when the next run would push the current one past the target size.
+// With BlockCodec::Auto a run is an ID stream followed by a value stream
+// (codecs.h) instead of (id, value) pairs. The non-null IDs of every
+// attribute are also written as a roaring bitmap to validity.bin.
+class AttributeBlockWriter {
+public:
+    AttributeBlockWriter(const std::string& dir, size_t target_block_size, const WriterOptions& opts = {},
+                         BlockCodec codec = BlockCodec::None)
+        : dir_(dir), target_(target_block_size), opts_(opts), codec_(codec) {}
+    ~AttributeBlockWriter() { close(); }
+
+    bool open() {
+        std::filesystem::create_directories(dir_ + "/blocks");
+        index_file_ = std::make_unique<OutputFile>();
+        if (!index_file_->open(dir_ + "/index.bin", opts_)) return false;
+        index_ = std::make_unique<StreamWriter>(*index_file_);
+        validity_file_ = std::make_unique<OutputFile>();
+        validity_index_file_ = std::make_unique<OutputFile>();
+        if (!validity_file_->open(dir_ + "/validity.bin", opts_) ||
+            !validity_index_file_->open(dir_ + "/validity_index.bin", opts_))
+            return false;
+        validity_ = std::make_unique<StreamWriter>(*validity_file_);
+        validity_index_ = std::make_unique<StreamWriter>(*validity_index_file_);
+        return true;
+    }
+
+    // Appends the non-null cells of the next attribute
+    bool append(const AttrValue* data, uint32_t count) {
+        size_t attr_bytes = size_t(count) * sizeof(AttrValue);
+        const void* payload = data;
+        column_.resize(count);
+        AttrZone zone;
+        for (uint32_t i = 0; i < count; ++i) {
+            column_[i] = data[i].first;
+            float v = data[i].second;
+            if (v < zone.min) zone.min = v;
+            if (v > zone.max) zone.max = v;
+        }
+        zone.count = count;
+        zones_.push_back(zone);
+        if (!append_validity()) return false;
+        if (codec_ == BlockCodec::Auto) {
+            encoded_.clear();
+            encode_column(column_.data(), count, encoded_, &stats_);
+            for (uint32_t i = 0; i < count; ++i) memcpy(&column_[i], &data[i].second, 4);
+            encode_column(column_.data(), count, encoded_, &stats_);
+            payload = encoded_.data();
+            attr_bytes = encoded_.size();
+        }
+
+        // Check if adding this attribute would exceed block size
+        if (current_block_bytes_ > 0 && current_block_bytes_ + attr_bytes > target_) {
+            close_block();
+            current_block_++;
+        }
+        if (!block_) {
+            block_file_ = std::make_unique<OutputFile>();
+            if (!block_file_->open(block_path(dir_, current_block_), opts_)) return false;
+            block_ = std::make_unique<StreamWriter>(*block_file_);
+        }
+
+        AttributeIndex idx;
+        memset(&idx, 0, sizeof(idx));  // deterministic padding bytes on disk
+        idx.block_id = current_block_;
+        idx.offset = block_->offset();
+        idx.count = count;
+        block_->write(payload, attr_bytes);
+        current_block_bytes_ += attr_bytes;
+        index_->write(&idx, sizeof(idx));
+        return block_->ok() && index_->ok();
+    }
+
+    bool close() {
+        bool ok = true;
+        if (block_) ok = close_block();
+        if (index_) {
+            ok = index_->flush() && ok;
+            index_.reset();
+            index_file_.reset();
+        }
+        if (validity_) {
+            ok = validity_->flush() && validity_index_->flush() && ok;
+            validity_.reset();
+            validity_index_.reset();
+            validity_file_.reset();
+            validity_index_file_.reset();
+            ok = write_side_file(dir_ + "/zones.bin", zones_, opts_) && ok;
+        }
+        return ok;
+    }
+
+    uint32_t blocks() const { return current_block_ + 1; }
+    std::string index_path() const { return dir_ + "/index.bin"; }
+    const CodecStats& codec_stats() const { return stats_; }
+    // Roaring containers written, by RoaringType
+    const uint64_t* validity_containers() const { return containers_; }
+
+private:
+    // Validity bitmap of the IDs in column_
+    bool append_validity() {
+        RoaringBitmap bm = RoaringBitmap::from_sorted(column_.data(), column_.size());
+        bm.container_counts(containers_);
+        bitmap_.clear();
+        bm.serialize(bitmap_);
+        ValidityIndex v;
+        memset(&v, 0, sizeof(v));
+        v.offset = validity_->offset();
+        v.bytes = bitmap_.size();
+        v.cardinality = column_.size();
+        validity_->write(bitmap_.data(), bitmap_.size());
+        validity_index_->write(&v, sizeof(v));
+        return validity_->ok() && validity_index_->ok();
+    }
+
+    bool close_block() {
+        bool ok = block_->flush();
+        block_.reset();
+        block_file_.reset();
+        current_block_bytes_ = 0;
+        return ok;
+    }
+
+    std::string dir_;
+    size_t target_;
+    WriterOptions opts_;
+    BlockCodec codec_;
+    std::unique_ptr<OutputFile> index_file_, block_file_;
+    std::unique_ptr<StreamWriter> index_, block_;
+    uint32_t current_block_ = 0;
+    size_t current_block_bytes_ = 0;
+    std::unique_ptr<OutputFile> validity_file_, validity_index_file_;
+    std::unique_ptr<StreamWriter> validity_, validity_index_;
+    std::vector<uint32_t> column_;
+    std::vector<char> encoded_, bitmap_;
+    std::vector<AttrZone> zones_;
+    CodecStats stats_;
+    uint64_t containers_[3] = {};
+};
+
+// Writes accessibility records that arrive grouped by destination. A block is
+// closed once it reaches the target size, even in the middle of a destination
+// run; the run then continues in the next block under a new index entry.
+// With AccLayout::Columnar each index entry describes one column piece, and
+// BlockCodec::Auto stores its columns as codec streams (rows stay raw).
+class AccessibilityBlockWriter {
+public:
+    AccessibilityBlockWriter(const std::string& dir, size_t target_block_size, const WriterOptions& opts = {},
+                             AccLayout layout = AccLayout::Rows, BlockCodec codec = BlockCodec::None)
+        : dir_(dir), target_(target_block_size), opts_(opts), layout_(layout), codec_(codec) {}
+    ~AccessibilityBlockWriter() { close(); }
+
+    bool open() {
+        std::filesystem::create_directories(dir_ + "/blocks");
+        index_file_ = std::make_unique<OutputFile>();
+        if (!index_file_->open(dir_ + "/index.bin", opts_)) return false;
+        index_ = std::make_unique<StreamWriter>(*index_file_);
+        return true;
+    }
+
+    bool append(const Accessibility* recs, size_t n) {
+        if (layout_ == AccLayout::Columnar) return append_columnar(recs, n);
+        size_t i = 0;
+        while (i < n) {
+            if (!open_block()) return false;
+
+            // If new destination_id, record previous index entry
+            if (recs[i].destination_id != last_dest_id_ && last_dest_id_ != UINT32_MAX) {
+                write_index_entry();
+                dest_start_offset_ = block_offset_;
+                dest_count_ = 0;
+            }
+
+            // Longest stretch of the same destination that still fits the block
+            size_t records_to_fill = (target_ - block_offset_ + sizeof(Accessibility) - 1) / sizeof(Accessibility);
+            size_t j = i + 1;
+            size_t limit = std::min(n, i + records_to_fill);
+            while (j < limit && recs[j].destination_id == recs[i].destination_id) ++j;
+            for (size_t k = i; k < j; ++k) piece_zone_.add(recs[k].time, recs[k].distance);
+
+            block_->write(recs + i, (j - i) * sizeof(Accessibility));
+            block_offset_ += (j - i) * sizeof(Accessibility);
+            dest_count_ += j - i;
+            last_dest_id_ = recs[i].destination_id;
+            i = j;
+
+            // If block size exceeded, close and start new block
+            if (block_offset_ >= target_) {
+                write_index_entry();
+                if (!close_block()) return false;
+                current_block_id_++;
+                block_offset_ = 0;
+                dest_start_offset_ = 0;
+                dest_count_ = 0;
+                last_dest_id_ = UINT32_MAX;
+            }
+        }
+        return index_->ok();
+    }
+
+    bool close() {
+        bool ok = true;
+        if (index_) {
+            // Write last index entry
+            if (layout_ == AccLayout::Columnar) ok = flush_piece();
+            else if (dest_count_ > 0 && last_dest_id_ != UINT32_MAX) write_index_entry();
+            dest_count_ = 0;
+            if (block_) ok = close_block() && ok;
+            ok = index_->flush() && ok;
+            index_.reset();
+            index_file_.reset();
+            ok = write_side_file(dir_ + "/zones.bin", zones_, opts_) && ok;
+            ok = write_side_file(dir_ + "/block_zones.bin", block_zones_, opts_) && ok;
+        }
+        return ok;
+    }
+
+    uint32_t blocks() const { return current_block_id_ + 1; }
+    std::string index_path() const { return dir_ + "/index.bin"; }
+    const CodecStats& codec_stats() const { return stats_; }
+
+private:
+    void write_index_entry() {
+        AccIndexEntry idx;
+        memset(&idx, 0, sizeof(idx));  // deterministic padding bytes on disk
+        idx.id = last_dest_id_;
+        idx.block_id = current_block_id_;
+        idx.offset = dest_start_offset_;
+        idx.count = dest_count_;
+        index_->write(&idx, sizeof(idx));
+        add_zone();
+    }
+
+    // Zone of the index entry just written
+    void add_zone() {
+        zones_.push_back(piece_zone_);
+        block_zone_.merge(piece_zone_);
+        piece_zone_ = AccZone();
+    }
+
+    // Flushes the current block and records its zone
+    bool close_block() {
+        bool ok = block_->flush();
+        block_.reset();
+        block_file_.reset();
+        block_zones_.push_back(block_zone_);
+        block_zone_ = AccZone();
+        return ok;
+    }
+
+    bool open_block() {
+        if (block_) return true;
+        block_file_ = std::make_unique<OutputFile>();
+        if (!block_file_->open(block_path(dir_, current_block_id_), opts_)) return false;
+        block_ = std::make_unique<StreamWriter>(*block_file_);
+        block_offset_ = 0;
+        return true;
+    }
+
+    // Columnar layout: records are buffered into the columns of the current
+    // piece, which is written when the destination changes, the piece is full
+    // or it fills the rest of the block
+    bool append_columnar(const Accessibility* recs, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            const Accessibility& a = recs[i];
+            if (!piece_time_.empty() &&
+                (a.destination_id != last_dest_id_ || piece_time_.size() == ACC_COLUMN_PIECE_RECORDS))
+                if (!flush_piece()) return false;
+            if (piece_time_.empty()) {
+                last_dest_id_ = a.destination_id;
+                piece_first_origin_ = a.origin_id;
+                piece_dense_ = true;
+            }
+            piece_dense_ = piece_dense_ && a.origin_id == piece_first_origin_ + piece_time_.size();
+            piece_zone_.add(a.time, a.distance);
+            piece_time_.push_back(a.time);
+            piece_distance_.push_back(a.distance);
+            piece_origin_.push_back(a.origin_id);
+            size_t piece_bytes = piece_time_.size() * (piece_dense_ ? 8 : 12);
+            if (block_offset_ + piece_bytes >= target_)
+                if (!flush_piece()) return false;
+        }
+        return index_->ok();
+    }
+
+    bool flush_piece() {
+        if (piece_time_.empty()) return true;
+        if (!open_block()) return false;
+        AccColumnIndexEntry idx;
+        memset(&idx, 0, sizeof(idx));  // deterministic padding bytes on disk
+        idx.id = last_dest_id_;
+        idx.block_id = current_block_id_;
+        idx.offset = block_offset_;
+        idx.count = piece_time_.size();
+        idx.flags = (piece_dense_ ? ACC_ORIGINS_DENSE : 0) | (codec_ == BlockCodec::Auto ? ACC_PIECE_ENCODED : 0);
+        idx.first_origin = piece_first_origin_;
+        index_->write(&idx, sizeof(idx));
+        add_zone();
+
+        size_t n = piece_time_.size();
+        if (codec_ == BlockCodec::Auto) {
+            encoded_.clear();
+            encode_column(reinterpret_cast<const uint32_t*>(piece_time_.data()), n, encoded_, &stats_);
+            encode_column(reinterpret_cast<const uint32_t*>(piece_distance_.data()), n, encoded_, &stats_);
+            if (!piece_dense_) encode_column(piece_origin_.data(), n, encoded_, &stats_);
+            block_->write(encoded_.data(), encoded_.size());
+            block_offset_ += encoded_.size();
+        } else {
+            size_t col_bytes = n * sizeof(float);
+            block_->write(piece_time_.data(), col_bytes);
+            block_->write(piece_distance_.data(), col_bytes);
+            if (!piece_dense_) block_->write(piece_origin_.data(), col_bytes);
+            block_offset_ += col_bytes * (piece_dense_ ? 2 : 3);
+        }
+        piece_time_.clear();
+        piece_distance_.clear();
+        piece_origin_.clear();
+
+        if (block_offset_ >= target_) {
+            if (!close_block()) return false;
+            current_block_id_++;
+            block_offset_ = 0;
+        }
+        return !block_ || block_->ok();
+    }
+
+    std::string dir_;
+    size_t target_;
+    WriterOptions opts_;
+    AccLayout layout_;
+    BlockCodec codec_;
+    std::unique_ptr<OutputFile> index_file_, block_file_;
+    std::unique_ptr<StreamWriter> index_, block_;
+    uint32_t current_block_id_ = 0;
+    uint64_t block_offset_ = 0;
+    uint32_t last_dest_id_ = UINT32_MAX;
+    uint64_t dest_start_offset_ = 0;
+    uint32_t dest_count_ = 0;
+    // Columnar piece being buffered
+    std::vector<float> piece_time_, piece_distance_;
+    std::vector<uint32_t> piece_origin_;
+    uint32_t piece_first_origin_ = 0;
+    bool piece_dense_ = true;
+    std::vector<char> encoded_;
+    // Zone maps of the index entries and blocks written so far
+    AccZone piece_zone_, block_zone_;
+    std::vector<AccZone> zones_, block_zones_;
+    CodecStats stats_;
+};
+
+// Writes accessibility records that arrive grouped by tile (see ACC_TILES_TABLE).
+// Blocks are cut like AccessibilityBlockWriter's rows layout.
+class AccessibilityTileWriter {
+public:
+    AccessibilityTileWriter(const std::string& dir, size_t target_block_size, const WriterOptions& opts,
+                            uint32_t tile_origins, uint32_t tile_dests)
+        : dir_(dir), target_(target_block_size), opts_(opts), tile_origins_(tile_origins), tile_dests_(tile_dests) {}
+    ~AccessibilityTileWriter() { close(); }
+
+    bool open() {
+        std::filesystem::create_directories(dir_ + "/blocks");
+        index_file_ = std::make_unique<OutputFile>();
+        if (!index_file_->open(dir_ + "/index.bin", opts_)) return false;
+        index_ = std::make_unique<StreamWriter>(*index_file_);
+        return true;
+    }
+
+    bool append(const Accessibility* recs, size_t n) {
+        size_t i = 0;
+        while (i < n) {
+            uint32_t ot = recs[i].origin_id / tile_origins_, dt = recs[i].destination_id / tile_dests_;
+            if (piece_.count > 0 && (ot != piece_.origin_tile || dt != piece_.dest_tile)) write_index_entry();
+            if (!block_) {
+                block_file_ = std::make_unique<OutputFile>();
+                if (!block_file_->open(block_path(dir_, current_block_id_), opts_)) return false;
+                block_ = std::make_unique<StreamWriter>(*block_file_);
+                block_offset_ = 0;
+            }
+            if (piece_.count == 0) {
+                piece_.origin_tile = ot;
+                piece_.dest_tile = dt;
+                piece_.block_id = current_block_id_;
+                piece_.offset = block_offset_;
+            }
+
+            // Longest stretch of the same tile that still fits the block
+            size_t records_to_fill = (target_ - block_offset_ + sizeof(Accessibility) - 1) / sizeof(Accessibility);
+            size_t j = i + 1;
+            size_t limit = std::min(n, i + records_to_fill);
+            while (j < limit && recs[j].origin_id / tile_origins_ == ot && recs[j].destination_id / tile_dests_ == dt) ++j;
+            for (size_t k = i; k < j; ++k) zone_.add(recs[k].time, recs[k].distance);
+            block_->write(recs + i, (j - i) * sizeof(Accessibility));
+            block_offset_ += (j - i) * sizeof(Accessibility);
+            piece_.count += j - i;
+            i = j;
+
+            if (block_offset_ >= target_) {
+                write_index_entry();
+                if (!close_block()) return false;
+                current_block_id_++;
+            }
+        }
+        return index_->ok();
+    }
+
+    bool close() {
+        bool ok = true;
+        if (index_) {
+            if (piece_.count > 0) write_index_entry();
+            if (block_) ok = close_block();
+            ok = index_->flush() && ok;
+            index_.reset();
+            index_file_.reset();
+            ok = write_side_file(dir_ + "/zones.bin", zones_, opts_) && ok;
+        }
+        return ok;
+    }
+
+    uint32_t blocks() const { return current_block_id_ + 1; }
+    uint64_t tiles() const { return zones_.size(); }
+
+private:
+    void write_index_entry() {
+        index_->write(&piece_, sizeof(piece_));
+        zones_.push_back(zone_);
+        zone_ = AccZone();
+        memset(&piece_, 0, sizeof(piece_));
+    }
+
+    bool close_block() {
+        bool ok = block_->flush();
+        block_.reset();
+        block_file_.reset();
+        return ok;
+    }
+
+    std::string dir_;
+    size_t target_;
+    WriterOptions opts_;
+    uint32_t tile_origins_, tile_dests_;
+    std::unique_ptr<OutputFile> index_file_, block_file_;
+    std::unique_ptr<StreamWriter> index_, block_;
+    uint32_t current_block_id_ = 0;
+    uint64_t block_offset_ = 0;
+    AccTileIndexEntry piece_ = {};
+    AccZone zone_;
+    std::vector<AccZone> zones_;
+};
+
+// ===============================================
+// PRE-SIZED MAPPED OUTPUT
+// ===============================================
+// Raw (BlockCodec::None, rows layout) tables whose layout follows from counts
+// known before any record is written (preprocess_dataset --mmap-output): the
+// index is written first, every block file is allocated at its final size
+// and mapped, and threads fill disjoint ranges of the mappings concurrently.
+// Blocks are cut as the streaming writers cut them, so the files are identical.
+// Space is allocated up front so that a full disk fails open() instead of
+// faulting a filler thread, and close() syncs the mappings to report write-back
+// errors.
+
+// Calls fn(begin, end) for n_threads slices of [0, n) in parallel, as tasks
+// of the shared thread pool
+template <typename Fn>
+inline void for_each_slice(size_t n, unsigned n_threads, Fn fn) {
+    n_threads = std::max(1u, n_threads);
+    ThreadPool::shared().parallel_for(n, (n + n_threads - 1) / n_threads, fn);
+}
+
+// Creates `path` with `bytes` bytes and maps it for writing, at `at` if given
+// (MAP_FIXED inside a reserved range). Empty files are created but not mapped.
+// With prealloc the bytes are fallocate()d; only filesystems without
+// fallocate() get a sparse file.
+inline bool map_output_file(const std::string& path, uint64_t bytes, bool prealloc, char*& map, char* at = nullptr) {
+    map = nullptr;
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = true;
+    if (bytes > 0 && !(prealloc && fallocate(fd, 0, 0, bytes) == 0)) {
+        // A full disk is an error; only a missing fallocate() falls back
+        bool unsupported = !prealloc || errno == EOPNOTSUPP || errno == ENOSYS;
+        ok = unsupported && ftruncate(fd, bytes) == 0;
+    }
+    if (ok && bytes > 0) {
+        void* p = mmap(at, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | (at ? MAP_FIXED : 0), fd, 0);
+        ok = p != MAP_FAILED;
+        if (ok) map = static_cast<char*>(p);
+    }
+    ::close(fd);  // the mapping keeps the file open
+    return ok;
+}
+
+// Attribute table of AttributeBlockWriter's layout. Run a starts at run(a);
+// its filler writes exactly count(a) cells there.
+class MappedAttributeTable {
+public:
+    MappedAttributeTable(const std::string& dir, size_t target_block_size, const WriterOptions& opts = {})
+        : dir_(dir), target_(target_block_size), opts_(opts) {}
+    MappedAttributeTable(const MappedAttributeTable&) = delete;
+    MappedAttributeTable& operator=(const MappedAttributeTable&) = delete;
+    ~MappedAttributeTable() { unmap(); }
+
+    // counts: non-null cells per attribute. Writes index.bin and maps the blocks.
+    bool open(const std::vector<uint32_t>& counts) {
+        std::filesystem::create_directories(dir_ + "/blocks");
+        counts_ = counts;
+        std::vector<AttributeIndex> index(counts.size());
+        memset(index.data(), 0, index.size() * sizeof(AttributeIndex));  // deterministic padding bytes on disk
+        std::vector<uint64_t> block_bytes(1, 0);
+        for (size_t a = 0; a < counts.size(); ++a) {
+            uint64_t bytes = uint64_t(counts[a]) * sizeof(AttrValue);
+            if (block_bytes.back() > 0 && block_bytes.back() + bytes > target_) block_bytes.push_back(0);
+            index[a].block_id = block_bytes.size() - 1;
+            index[a].offset = block_bytes.back();
+            index[a].count = counts[a];
+            block_bytes.back() += bytes;
+        }
+        blocks_ = block_bytes.size();
+        maps_.resize(blocks_);
+        for (size_t b = 0; b < block_bytes.size(); ++b) {
+            if (!map_output_file(block_path(dir_, b), block_bytes[b], opts_.prealloc, maps_[b].data)) return false;
+            maps_[b].bytes = block_bytes[b];
+        }
+        runs_.resize(counts.size());
+        for (size_t a = 0; a < counts.size(); ++a)
+            runs_[a] = reinterpret_cast<AttrValue*>(maps_[index[a].block_id].data + index[a].offset);
+        return write_side_file(dir_ + "/index.bin", index, opts_);
+    }
+
+    AttrValue* run(uint32_t a) const { return runs_[a]; }
+    uint32_t count(uint32_t a) const { return counts_[a]; }
+    uint32_t blocks() const { return blocks_; }
+    const uint64_t* validity_containers() const { return containers_; }
+
+    // Builds the validity bitmaps and zone maps of the filled runs and unmaps the blocks
+    bool close(unsigned n_threads = 1) {
+        if (maps_.empty()) return true;
+        size_t n = runs_.size();
+        std::vector<AttrZone> zones(n);
+        std::vector<ValidityIndex> validity(n);
+        OutputFile validity_file;
+        if (!validity_file.open(dir_ + "/validity.bin", opts_)) return false;
+        StreamWriter out(validity_file);
+        // Bitmaps are serialized in parallel a batch at a time and written in attribute order
+        size_t batch = 16 * std::max(1u, n_threads);
+        std::vector<std::vector<char>> bitmaps(batch);
+        std::vector<std::array<uint64_t, 3>> containers(batch);
+        for (size_t a0 = 0; a0 < n; a0 += batch) {
+            size_t a1 = std::min(n, a0 + batch);
+            for_each_slice(a1 - a0, n_threads, [&](size_t begin, size_t end) {
+                std::vector<uint32_t> ids;
+                for (size_t i = begin; i < end; ++i) {
+                    const AttrValue* cells = runs_[a0 + i];
+                    uint32_t count = counts_[a0 + i];
+                    AttrZone& zone = zones[a0 + i];
+                    ids.resize(count);
+                    for (uint32_t k = 0; k < count; ++k) {
+                        ids[k] = cells[k].first;
+                        float v = cells[k].second;
+                        if (v < zone.min) zone.min = v;
+                        if (v > zone.max) zone.max = v;
+                    }
+                    zone.count = count;
+                    RoaringBitmap bm = RoaringBitmap::from_sorted(ids.data(), ids.size());
+                    containers[i] = {};
+                    bm.container_counts(containers[i].data());
+                    bitmaps[i].clear();
+                    bm.serialize(bitmaps[i]);
+                }
+            });
+            for (size_t a = a0; a < a1; ++a) {
+                const std::vector<char>& bytes = bitmaps[a - a0];
+                ValidityIndex& v = validity[a];
+                memset(&v, 0, sizeof(v));
+                v.offset = out.offset();
+                v.bytes = bytes.size();
+                v.cardinality = counts_[a];
+                out.write(bytes.data(), bytes.size());
+                for (int c = 0; c < 3; ++c) containers_[c] += containers[a - a0][c];
+            }
+        }
+        bool ok = out.flush();
+        ok = write_side_file(dir_ + "/validity_index.bin", validity, opts_) && ok;
+        ok = write_side_file(dir_ + "/zones.bin", zones, opts_) && ok;
+        for (const Block& b : maps_)
+            if (b.data && msync(b.data, b.bytes, MS_SYNC) != 0) ok = false;
+        unmap();
+        return ok;
+    }
+
+private:
+    struct Block {
+        char* data = nullptr;
+        uint64_t bytes = 0;
+    };
+
+    void unmap() {
+        for (Block& b : maps_)
+            if (b.data) munmap(b.data, b.bytes);
+        maps_.clear();
+    }
+
+    std::string dir_;
+    size_t target_;
+    WriterOptions opts_;
+    std::vector<uint32_t> counts_;
+    std::vector<Block> maps_;
+    uint32_t blocks_ = 0;
+    std::vector<AttrValue*> runs_;
+    uint64_t containers_[3] = {};
+};
+
+// Accessibility table of AccessibilityBlockWriter's rows layout: every block
+// but the last holds block_records() records, so a record's block follows from
+// its position. The blocks are mapped back to back into one range and data()
+// is the whole table in run order, ready for a scatter.
+class MappedAccessibilityTable {
+public:
+    MappedAccessibilityTable(const std::string& dir, size_t target_block_size, const WriterOptions& opts = {})
+        : dir_(dir), block_records_(block_records(target_block_size)), opts_(opts) {}
+    MappedAccessibilityTable(const MappedAccessibilityTable&) = delete;
+    MappedAccessibilityTable& operator=(const MappedAccessibilityTable&) = delete;
+    ~MappedAccessibilityTable() { unmap(); }
+
+    static uint64_t block_records(size_t target) { return (target + sizeof(Accessibility) - 1) / sizeof(Accessibility); }
+    // Back-to-back mapping needs blocks that end on page boundaries
+    static bool supported(size_t target) {
+        return block_records(target) * sizeof(Accessibility) % uint64_t(sysconf(_SC_PAGESIZE)) == 0;
+    }
+
+    // counts: records per run id. Writes index.bin and maps the blocks.
+    bool open(const std::vector<uint64_t>& counts) {
+        std::filesystem::create_directories(dir_ + "/blocks");
+        records_ = 0;
+        for (uint32_t id = 0; id < counts.size(); ++id) {
+            uint64_t c = counts[id];
+            if (c == 0) continue;
+            // A run is cut where it crosses a block boundary, one index entry per piece
+            for (uint64_t pos = records_, end = records_ + c; pos < end;) {
+                uint64_t block = pos / block_records_;
+                uint64_t n = std::min(end, (block + 1) * block_records_) - pos;
+                AccIndexEntry e;
+                memset(&e, 0, sizeof(e));  // deterministic padding bytes on disk
+                e.id = id;
+                e.block_id = block;
+                e.offset = (pos - block * block_records_) * sizeof(Accessibility);
+                e.count = n;
+                index_.push_back(e);
+                pos += n;
+            }
+            records_ += c;
+        }
+        if (records_ > 0) {
+            uint64_t page = sysconf(_SC_PAGESIZE);
+            reserved_ = (records_ * sizeof(Accessibility) + page - 1) / page * page;
+            void* p = mmap(nullptr, reserved_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (p == MAP_FAILED) return false;
+            base_ = static_cast<char*>(p);
+            uint64_t block_bytes = block_records_ * sizeof(Accessibility);
+            for (uint64_t b = 0; b * block_records_ < records_; ++b) {
+                uint64_t bytes = std::min(records_ - b * block_records_, block_records_) * sizeof(Accessibility);
+                char* map;
+                if (!map_output_file(block_path(dir_, b), bytes, opts_.prealloc, map, base_ + b * block_bytes)) return false;
+            }
+        }
+        return write_side_file(dir_ + "/index.bin", index_, opts_);
+    }
+
+    Accessibility* data() const { return reinterpret_cast<Accessibility*>(base_); }
+    // Numbered like AccessibilityBlockWriter::blocks()
+    uint32_t blocks() const { return records_ / block_records_ + 1; }
+
+    // Builds the zone maps of the filled table and unmaps the blocks
+    bool close(unsigned n_threads = 1) {
+        std::vector<AccZone> zones(index_.size());
+        for_each_slice(index_.size(), n_threads, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const AccIndexEntry& e = index_[i];
+                const Accessibility* recs = data() + e.block_id * block_records_ + e.offset / sizeof(Accessibility);
+                for (uint32_t k = 0; k < e.count; ++k) zones[i].add(recs[k].time, recs[k].distance);
+            }
+        });
+        std::vector<AccZone> block_zones((records_ + block_records_ - 1) / block_records_);
+        for (size_t i = 0; i < index_.size(); ++i) block_zones[index_[i].block_id].merge(zones[i]);
+        // The blocks end on page boundaries, so the reserved range is all file pages
+        bool ok = !base_ || msync(base_, reserved_, MS_SYNC) == 0;
+        unmap();
+        ok = write_side_file(dir_ + "/zones.bin", zones, opts_) && ok;
+        return write_side_file(dir_ + "/block_zones.bin", block_zones, opts_) && ok;
+    }
+
+private:
+    void unmap() {
+        if (base_) munmap(base_, reserved_);
+        base_ = nullptr;
+    }
+
+    std::string dir_;
+    uint64_t block_records_;
+    WriterOptions opts_;
+    std::vector<AccIndexEntry> index_;
+    uint64_t records_ = 0;
+    char* base_ = nullptr;
+    uint64_t reserved_ = 0;
+};
@@ -0,0 +1,778 @@
+#pragma once
+// ===============================================
+// PREPROCESSED DATASET READER
+// ===============================================
+// Read side of dataset_format.h shared by the query tools. The accessibility
+// reader understands both block layouts and returns destination runs as
+// columns, reading only the bytes of the requested columns (pread() or a copy
+// from the mapping, per DatasetFiles::read_method(), or through a shared
+// BufferPool when one is attached), or hands out views of
+// uncompressed pieces in place when the blocks are mapped (zero-copy scans).
+// Codec streams (codecs.h) are decoded transparently. Files are resolved
+// through DatasetFiles, so loose and packed datasets read the same way.
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "buffer_pool.h"
+#include "dataset_container.h"
+#include "dataset_format.h"
+
+// Columns to load from an accessibility run
+constexpr unsigned ACC_COL_ORIGIN   = 1;
+constexpr unsigned ACC_COL_TIME     = 2;
+constexpr unsigned ACC_COL_DISTANCE = 4;
+constexpr unsigned ACC_COL_ALL      = ACC_COL_ORIGIN | ACC_COL_TIME | ACC_COL_DISTANCE;
+
+// One destination run in columnar form
+struct AccColumns {
+    uint32_t destination_id = 0;  // run id (an origin in the origin-major copy)
+    uint32_t count = 0;
+    // Origin of row i: origin_id[i], or first_origin + i when origin_id is empty (dense run)
+    uint32_t first_origin = 0;
+    std::vector<uint32_t> origin_id;
+    std::vector<float> time, distance;
+
+    uint32_t origin(size_t i) const { return origin_id.empty() ? first_origin + uint32_t(i) : origin_id[i]; }
+};
+
+// One piece of a run in place in a mapped block (AccessibilityReader::view()):
+// rows for the rows layout, columns for the columnar one
+struct AccPieceView {
+    uint32_t count = 0;
+    const Accessibility* rows = nullptr;
+    const float* time = nullptr;
+    const float* distance = nullptr;
+    const uint32_t* origin_id = nullptr;  // columnar; nullptr for dense pieces
+    uint32_t first_origin = 0;
+
+    uint32_t origin(size_t i) const { return origin_id ? origin_id[i] : first_origin + uint32_t(i); }
+};
+
+// Asks the kernel to start reading a mapped range, page-aligned outwards
+inline void prefetch_mapped(const void* p, size_t len) {
+    static const uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(p) & ~(page - 1);
+    madvise(reinterpret_cast<void*>(begin), reinterpret_cast<uintptr_t>(p) + len - begin, MADV_WILLNEED);
+}
+
+// Range predicate on accessibility records. Readers test it against the zone
+// maps to skip whole pieces and blocks; the rows they return still need matches().
+struct AccPredicate {
+    float time_min = -INFINITY, time_max = INFINITY;
+    float distance_min = -INFINITY, distance_max = INFINITY;
+
+    bool active() const {
+        return time_min != -INFINITY || time_max != INFINITY || distance_min != -INFINITY || distance_max != INFINITY;
+    }
+    bool matches(float time, float distance) const {
+        return time >= time_min && time <= time_max && distance >= distance_min && distance <= distance_max;
+    }
+    // False only if no record summarized by z can match
+    bool overlaps(const AccZone& z) const {
+        return z.count > 0 && z.time_max >= time_min && z.time_min <= time_max && z.distance_max >= distance_min &&
+               z.distance_min <= distance_max;
+    }
+};
+
+// Block bytes through the buffer pool when there is one, else from the files
+inline bool read_block(const DatasetFiles& files, BufferPool* pool, const FileRegion& file, void* data, size_t len,
+                       uint64_t offset) {
+    return pool ? pool->read_at(file, data, len, offset) : files.read_at(file, data, len, offset);
+}
+
+// Reads the codec stream at `offset`. If `out` is set the stream is decoded
+// into it (ColumnHeader::count words). Returns the offset past the stream, 0 on error.
+inline uint64_t read_column_stream(const DatasetFiles& files, const FileRegion& file, uint64_t offset, uint32_t* out,
+                                   std::vector<uint8_t>& scratch, std::atomic<uint64_t>& bytes_read,
+                                   BufferPool* pool = nullptr) {
+    ColumnHeader h;
+    if (!read_block(files, pool, file, &h, sizeof(h), offset)) return 0;
+    bytes_read += sizeof(h);
+    if (out) {
+        scratch.resize(h.bytes);
+        if (!read_block(files, pool, file, scratch.data(), h.bytes, offset + sizeof(h))) return 0;
+        bytes_read += h.bytes;
+        if (!decode_column(h, scratch.data(), out)) return 0;
+    }
+    return offset + sizeof(h) + h.bytes;
+}
+
+// Attribute runs of one table (attributes/origin or attributes/destination),
+// across all segments of the dataset manifest
+class AttributeReader {
+public:
+    AttributeReader() = default;
+    AttributeReader(const AttributeReader&) = delete;
+    AttributeReader& operator=(const AttributeReader&) = delete;
+
+    // base is the dataset directory (<dir>/<N>p), table "origin" or "destination"
+    bool open(const std::string& base, const std::string& table) {
+        owned_ = std::make_unique<DatasetFiles>();
+        return owned_->open(base) && open(*owned_, table);
+    }
+
+    // Reads through files, which must outlive the reader
+    bool open(const DatasetFiles& files, const std::string& table) {
+        files_ = &files;
+        for (const DatasetSegment& seg : load_manifest(files).segments) {
+            Segment s;
+            s.attr_begin = table == "origin" ? seg.origin_attr_begin : seg.destination_attr_begin;
+            s.attrs = table == "origin" ? seg.origin_attrs : seg.destination_attrs;
+            if (s.attrs == 0) continue;
+            s.dir = segment_path(seg, "attributes/" + table);
+            auto meta = read_dataset_metadata(files, segment_path(seg, "metadata.txt"));
+            auto it = meta.find("attribute_codec");
+            if (it != meta.end() && !parse_block_codec(it->second, s.codec)) return false;
+            if (!files.read_array(s.dir + "/index.bin", s.entries)) return false;
+            // Validity bitmaps and zone maps are absent in datasets written before they existed
+            files.read_array(s.dir + "/validity_index.bin", s.validity);
+            files.read_array(s.dir + "/zones.bin", s.zones);
+            segments_.push_back(std::move(s));
+        }
+        return !segments_.empty();
+    }
+
+    BlockCodec codec() const { return segments_.front().codec; }
+    const std::string& dir() const { return segments_.front().dir; }
+    size_t segments() const { return segments_.size(); }
+
+    uint32_t attributes() const {
+        uint32_t n = 0;
+        for (const auto& s : segments_) n = std::max(n, s.attr_begin + s.attrs - 1);
+        return n;
+    }
+
+    // Index entry of attribute attr_num (1-based, as in "att5") in the first
+    // segment holding it; dir (optional) receives that segment's table directory,
+    // relative to the dataset
+    bool entry(uint32_t attr_num, AttributeIndex& idx, std::string* dir = nullptr) const {
+        for (const auto& s : segments_) {
+            if (!s.holds(attr_num)) continue;
+            idx = s.entries[attr_num - s.attr_begin];
+            if (dir) *dir = s.dir;
+            return true;
+        }
+        return false;
+    }
+
+    // Loads the non-null (id, value) cells of attribute attr_num from every segment
+    bool load(uint32_t attr_num, std::vector<uint32_t>& ids, std::vector<float>& values) {
+        ids.clear();
+        values.clear();
+        bool found = false;
+        for (const auto& s : segments_) {
+            if (!s.holds(attr_num)) continue;
+            found = true;
+            if (!load_segment(s, s.entries[attr_num - s.attr_begin], ids, values)) return false;
+        }
+        return found;
+    }
+
+    // Zone map of attribute attr_num, merged over the segments holding it.
+    // Returns false if a segment has no zone map.
+    bool zone(uint32_t attr_num, AttrZone& out) const {
+        out = AttrZone();
+        bool found = false;
+        for (const auto& s : segments_) {
+            if (!s.holds(attr_num)) continue;
+            if (s.zones.size() != s.entries.size()) return false;
+            const AttrZone& z = s.zones[attr_num - s.attr_begin];
+            out.min = std::min(out.min, z.min);
+            out.max = std::max(out.max, z.max);
+            out.count += z.count;
+            found = true;
+        }
+        return found;
+    }
+
+    bool has_validity() const {
+        for (const auto& s : segments_)
+            if (s.validity.size() != s.entries.size() || s.entries.empty()) return false;
+        return true;
+    }
+
+    // Loads the set of non-null IDs of attribute attr_num: a few bytes from
+    // validity.bin, or built from the run's IDs when there is no bitmap
+    bool load_validity(uint32_t attr_num, RoaringBitmap& out) {
+        if (!has_validity()) {
+            std::vector<uint32_t> ids;
+            std::vector<float> values;
+            if (!load(attr_num, ids, values)) return false;
+            return from_ids(ids, out);
+        }
+        // Rows added by later segments have their own bitmap: union of all of them
+        std::vector<uint32_t> ids;
+        size_t holding = 0;
+        for (const auto& s : segments_) {
+            if (!s.holds(attr_num)) continue;
+            const ValidityIndex& v = s.validity[attr_num - s.attr_begin];
+            FileRegion file;
+            if (!files_->find(s.dir + "/validity.bin", file)) return false;
+            std::vector<char> bytes(v.bytes);
+            RoaringBitmap bm;
+            bool ok = files_->read_at(file, bytes.data(), bytes.size(), file.offset + v.offset) &&
+                      bm.deserialize(bytes.data(), bytes.size());
+            bytes_read_ += v.bytes;
+            if (!ok) return false;
+            if (holding++ > 0) {
+                if (holding == 2) ids = out.to_vector();
+                auto seg_ids = bm.to_vector();
+                ids.insert(ids.end(), seg_ids.begin(), seg_ids.end());
+            }
+            out = std::move(bm);
+        }
+        if (holding == 0) return false;
+        return holding == 1 || from_ids(ids, out);
+    }
+
+    // Bytes read from block and validity files so far
+    uint64_t bytes_read() const { return bytes_read_; }
+
+private:
+    struct Segment {
+        std::string dir;
+        uint32_t attr_begin = 1, attrs = 0;
+        BlockCodec codec = BlockCodec::None;
+        std::vector<AttributeIndex> entries;
+        std::vector<ValidityIndex> validity;
+        std::vector<AttrZone> zones;
+
+        bool holds(uint32_t attr_num) const {
+            return attr_num >= attr_begin && attr_num - attr_begin < std::min<size_t>(attrs, entries.size());
+        }
+    };
+
+    static bool from_ids(std::vector<uint32_t>& ids, RoaringBitmap& out) {
+        if (!std::is_sorted(ids.begin(), ids.end())) std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        out = RoaringBitmap::from_sorted(ids.data(), ids.size());
+        return true;
+    }
+
+    // Appends the cells of one segment's run
+    bool load_segment(const Segment& s, const AttributeIndex& idx, std::vector<uint32_t>& ids,
+                      std::vector<float>& values) {
+        FileRegion file;
+        if (!files_->find(block_path(s.dir, idx.block_id), file)) return false;
+        uint64_t offset = file.offset + idx.offset;
+        size_t at = ids.size();
+        ids.resize(at + idx.count);
+        values.resize(at + idx.count);
+        bool ok = true;
+        if (s.codec == BlockCodec::Auto) {
+            std::vector<uint8_t> scratch;
+            uint64_t next = read_column_stream(*files_, file, offset, ids.data() + at, scratch, bytes_read_);
+            ok = next && read_column_stream(*files_, file, next, reinterpret_cast<uint32_t*>(values.data() + at), scratch,
+                                            bytes_read_);
+        } else {
+            std::vector<AttrValue> cells(idx.count);
+            ok = files_->read_at(file, cells.data(), cells.size() * sizeof(AttrValue), offset);
+            bytes_read_ += cells.size() * sizeof(AttrValue);
+            for (uint32_t i = 0; ok && i < idx.count; ++i) {
+                ids[at + i] = cells[i].first;
+                values[at + i] = cells[i].second;
+            }
+        }
+        return ok;
+    }
+
+    std::unique_ptr<DatasetFiles> owned_;
+    const DatasetFiles* files_ = nullptr;
+    std::vector<Segment> segments_;
+    std::atomic<uint64_t> bytes_read_{0};
+};
+
+class AccessibilityReader {
+public:
+    AccessibilityReader() = default;
+    AccessibilityReader(const AccessibilityReader&) = delete;
+    AccessibilityReader& operator=(const AccessibilityReader&) = delete;
+    // base is the dataset directory (<dir>/<N>p); runs of every manifest segment
+    // are read, each segment with the layout recorded in its own metadata.
+    // table ACC_BY_ORIGIN_TABLE reads the origin-major copy: run ids are then
+    // origins and AccColumns::origin() yields destinations.
+    bool open(const std::string& base, const std::string& table = ACC_TABLE) {
+        owned_ = std::make_unique<DatasetFiles>();
+        return owned_->open(base) && open(*owned_, table);
+    }
+
+    // Reads through files, which must outlive the reader
+    bool open(const DatasetFiles& files, const std::string& table = ACC_TABLE) {
+        files_ = &files;
+        struct Piece {
+            AccColumnIndexEntry entry;
+            AccZone zone;
+            uint32_t segment;
+        };
+        std::vector<Piece> pieces;
+        for (const DatasetSegment& seg : load_manifest(files).segments) {
+            if (seg.accessibility == 0) continue;  // attributes only
+            Segment s;
+            s.dir = segment_path(seg, table);
+            auto meta = read_dataset_metadata(files, segment_path(seg, "metadata.txt"));
+            auto it = meta.find("accessibility_layout");
+            if (it != meta.end() && !parse_acc_layout(it->second, s.layout)) return false;
+            uint32_t seg_id = segments_.size();
+            std::vector<AccColumnIndexEntry> index;
+            bool found;
+            if (s.layout == AccLayout::Columnar) {
+                found = files.read_array(s.dir + "/index.bin", index);
+            } else {
+                std::vector<AccIndexEntry> rows;
+                found = files.read_array(s.dir + "/index.bin", rows);
+                for (const AccIndexEntry& r : rows) {
+                    AccColumnIndexEntry e;
+                    memset(&e, 0, sizeof(e));
+                    e.id = r.id;
+                    e.block_id = r.block_id;
+                    e.offset = r.offset;
+                    e.count = r.count;
+                    index.push_back(e);
+                }
+            }
+            if (!found) {
+                // A table missing from a segment with records (an origin-major
+                // copy built for the base only, say) is incomplete. Manifests
+                // that do not record it tell attribute-only segments by their files.
+                FileRegion records;
+                if (segments_.empty() || seg.accessibility == 1 ||
+                    files.find(segment_path(seg, std::string(ACC_TABLE) + "/index.bin"), records))
+                    return false;
+                continue;
+            }
+            // Without zone maps (older datasets) nothing is skipped
+            std::vector<AccZone> zones;
+            if (!files.read_array(s.dir + "/zones.bin", zones) || zones.size() != index.size()) zones.clear();
+            files.read_array(s.dir + "/block_zones.bin", s.block_zones);
+            for (size_t i = 0; i < index.size(); ++i)
+                pieces.push_back({index[i], zones.empty() ? unbounded_zone(index[i].count) : zones[i], seg_id});
+            segments_.push_back(std::move(s));
+        }
+        // A run split over blocks (or segments) has several entries: keep them
+        // adjacent and in write order
+        std::stable_sort(pieces.begin(), pieces.end(),
+                         [](const Piece& a, const Piece& b) { return a.entry.id < b.entry.id; });
+        for (const Piece& p : pieces) {
+            entries_.push_back(p.entry);
+            zones_.push_back(p.zone);
+            entry_segments_.push_back(p.segment);
+        }
+        return !segments_.empty();
+    }
+
+    AccLayout layout() const { return segments_.front().layout; }
+    size_t index_entries() const { return entries_.size(); }
+    bool contains(uint32_t dest) const {
+        auto [first, last] = range(dest);
+        return first != last;
+    }
+
+    // Records in the run of id
+    uint64_t run_rows(uint32_t id) const {
+        auto [first, last] = range(id);
+        uint64_t n = 0;
+        for (auto e = first; e != last; ++e) n += e->count;
+        return n;
+    }
+
+    // Destination IDs present in the index, ascending
+    std::vector<uint32_t> destinations() const {
+        std::vector<uint32_t> ids;
+        for (const auto& e : entries_)
+            if (ids.empty() || ids.back() != e.id) ids.push_back(e.id);
+        return ids;
+    }
+
+    // True if every piece is unencoded, so that a row range of a run can be
+    // read without the rest of its pieces (load() and view() with row_begin/row_end)
+    bool splittable() const {
+        for (const AccColumnIndexEntry& e : entries_)
+            if (e.flags & ACC_PIECE_ENCODED) return false;
+        return true;
+    }
+
+    // Loads the requested columns of one destination run, or of its rows
+    // [row_begin, row_end) (counted over all its pieces; a range may only cut
+    // unencoded pieces). Pieces whose zone (or block zone) cannot match pred
+    // are not read. Returns false if the destination has no rows in range,
+    // every piece was skipped or a block cannot be read. Thread-safe.
+    bool load(uint32_t dest, AccColumns& out, unsigned columns = ACC_COL_ALL, const AccPredicate& pred = {},
+              uint64_t row_begin = 0, uint64_t row_end = UINT64_MAX) {
+        out = AccColumns();
+        out.destination_id = dest;
+        std::vector<Slice> kept = slices(dest, pred, row_begin, row_end);
+        if (kept.empty()) return false;
+        uint64_t total = 0;
+        bool dense = true;
+        uint32_t first_origin = kept[0].e->first_origin + kept[0].skip;
+        for (const Slice& sl : kept) {
+            dense = dense && (sl.e->flags & ACC_ORIGINS_DENSE) && sl.e->first_origin + sl.skip == first_origin + total;
+            total += sl.count;
+        }
+        out.count = total;
+        out.first_origin = first_origin;
+        if (columns & ACC_COL_ORIGIN && !dense) out.origin_id.resize(total);
+        if (columns & ACC_COL_TIME) out.time.resize(total);
+        if (columns & ACC_COL_DISTANCE) out.distance.resize(total);
+
+        uint64_t row = 0;
+        for (const Slice& sl : kept) {
+            const Segment& s = segments_[entry_segments_[sl.e - entries_.begin()]];
+            FileRegion file;
+            if (!files_->find(block_path(s.dir, sl.e->block_id), file)) return false;
+            // Piece offsets are relative to the block file, which may sit inside the container
+            AccColumnIndexEntry piece = *sl.e;
+            piece.offset += file.offset;
+            bool ok = s.layout == AccLayout::Columnar ? read_columnar(file, piece, sl, row, dense, columns, out)
+                                                      : read_rows(file, piece, sl, row, columns, out);
+            if (!ok) return false;
+            row += sl.count;
+        }
+        return true;
+    }
+
+    // Reads blocks through pool (shared with other readers) from now on;
+    // nullptr goes back to DatasetFiles::read_at()
+    void set_buffer_pool(BufferPool* pool) { pool_ = pool; }
+
+    // True if view() can serve every run: all block files are mapped and no
+    // piece is codec-encoded
+    bool can_view() const {
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            const AccColumnIndexEntry& e = entries_[i];
+            FileRegion file;
+            if ((e.flags & ACC_PIECE_ENCODED) ||
+                !files_->find(block_path(segments_[entry_segments_[i]].dir, e.block_id), file) ||
+                !files_->view_at(file, 0, file.offset))
+                return false;
+        }
+        return true;
+    }
+
+    // Zero-copy form of load(): the unskipped pieces of one run (or of its
+    // rows [row_begin, row_end)) as pointers into the mapped blocks, valid
+    // while the DatasetFiles lives. Reading of the pieces is started
+    // (MADV_WILLNEED). Same return value as load(), and false for a piece
+    // that is not mapped or encoded (see can_view()). Thread-safe.
+    bool view(uint32_t dest, std::vector<AccPieceView>& out, const AccPredicate& pred = {}, uint64_t row_begin = 0,
+              uint64_t row_end = UINT64_MAX) {
+        out.clear();
+        for (const Slice& sl : slices(dest, pred, row_begin, row_end)) {
+            const AccColumnIndexEntry& e = *sl.e;
+            const Segment& s = segments_[entry_segments_[sl.e - entries_.begin()]];
+            FileRegion file;
+            if ((e.flags & ACC_PIECE_ENCODED) || !files_->find(block_path(s.dir, e.block_id), file)) return false;
+            bool columnar = s.layout == AccLayout::Columnar;
+            bool dense = e.flags & ACC_ORIGINS_DENSE;
+            // The whole piece is located; only the slice's rows are touched
+            uint64_t piece_bytes = uint64_t(e.count) * (columnar ? (dense ? 2 : 3) * sizeof(float) : sizeof(Accessibility));
+            const char* p = files_->view_at(file, piece_bytes, file.offset + e.offset);
+            if (!p) return false;
+            AccPieceView v;
+            v.count = sl.count;
+            v.first_origin = e.first_origin + sl.skip;
+            if (columnar) {
+                v.time = reinterpret_cast<const float*>(p) + sl.skip;
+                v.distance = v.time + e.count;
+                if (!dense) v.origin_id = reinterpret_cast<const uint32_t*>(v.distance + e.count);
+                for (const float* col : {v.time, v.distance})
+                    prefetch_mapped(col, uint64_t(sl.count) * sizeof(float));
+                if (v.origin_id) prefetch_mapped(v.origin_id, uint64_t(sl.count) * sizeof(uint32_t));
+                bytes_viewed_ += uint64_t(sl.count) * (dense ? 2 : 3) * sizeof(float);
+            } else {
+                v.rows = reinterpret_cast<const Accessibility*>(p) + sl.skip;
+                prefetch_mapped(v.rows, uint64_t(sl.count) * sizeof(Accessibility));
+                bytes_viewed_ += uint64_t(sl.count) * sizeof(Accessibility);
+            }
+            out.push_back(v);
+        }
+        return !out.empty();
+    }
+
+    // Bytes read from block files so far
+    uint64_t bytes_read() const { return bytes_read_; }
+    // Bytes handed out in place by view() so far
+    uint64_t bytes_viewed() const { return bytes_viewed_; }
+    // Pieces and rows skipped by zone maps so far
+    uint64_t skipped_pieces() const { return skipped_pieces_; }
+    uint64_t skipped_rows() const { return skipped_rows_; }
+    bool has_zones() const {
+        for (const auto& s : segments_)
+            if (s.block_zones.empty()) return false;
+        return true;
+    }
+
+    // Blocks whose zone cannot match pred
+    uint64_t excluded_blocks(const AccPredicate& pred) const {
+        uint64_t n = 0;
+        for (const auto& s : segments_)
+            for (const AccZone& z : s.block_zones) n += !pred.overlaps(z);
+        return n;
+    }
+
+private:
+    using Iter = std::vector<AccColumnIndexEntry>::const_iterator;
+    // Rows [skip, skip + count) of the piece e
+    struct Slice {
+        Iter e;
+        uint32_t skip, count;
+    };
+
+    // The pieces of dest's run overlapping its rows [row_begin, row_end) that
+    // pred's zone maps do not exclude. A skipped piece is counted once, by
+    // the range holding its first row.
+    std::vector<Slice> slices(uint32_t dest, const AccPredicate& pred, uint64_t row_begin, uint64_t row_end) {
+        auto [first, last] = range(dest);
+        std::vector<Slice> kept;
+        uint64_t pos = 0;
+        for (auto e = first; e != last; pos += e->count, ++e) {
+            uint64_t begin = std::max(pos, row_begin), end = std::min(pos + e->count, row_end);
+            if (begin >= end) continue;
+            size_t i = e - entries_.begin();
+            if (pred.active() && !(pred.overlaps(zones_[i]) && pred.overlaps(block_zone(i)))) {
+                if (begin == pos) skipped_pieces_++;
+                skipped_rows_ += end - begin;
+                continue;
+            }
+            kept.push_back({e, uint32_t(begin - pos), uint32_t(end - begin)});
+        }
+        return kept;
+    }
+
+    static AccZone unbounded_zone(uint64_t count) {
+        AccZone z;
+        z.time_min = z.distance_min = -INFINITY;
+        z.time_max = z.distance_max = INFINITY;
+        z.count = count;
+        return z;
+    }
+
+    // Zone of the block holding entry i
+    AccZone block_zone(size_t i) const {
+        const AccColumnIndexEntry& e = entries_[i];
+        const auto& zones = segments_[entry_segments_[i]].block_zones;
+        return e.block_id < zones.size() ? zones[e.block_id] : unbounded_zone(e.count);
+    }
+
+    std::pair<Iter, Iter> range(uint32_t dest) const {
+        return std::equal_range(entries_.begin(), entries_.end(), AccColumnIndexEntry{dest, 0, 0, 0, 0, 0, 0},
+                                [](const AccColumnIndexEntry& a, const AccColumnIndexEntry& b) { return a.id < b.id; });
+    }
+
+    // Columns of the slice sl of the piece e, at position row of out
+    bool read_columnar(const FileRegion& file, const AccColumnIndexEntry& e, const Slice& sl, uint64_t row, bool dense,
+                       unsigned columns, AccColumns& out) {
+        if (e.flags & ACC_PIECE_ENCODED) {
+            // Streams decode whole: a range must not cut an encoded piece
+            if (sl.skip != 0 || sl.count != e.count) return false;
+            return read_encoded(file, e, row, dense, columns, out);
+        }
+        uint64_t col_bytes = uint64_t(e.count) * sizeof(float);
+        uint64_t skip = uint64_t(sl.skip) * sizeof(float), len = uint64_t(sl.count) * sizeof(float);
+        bool ok = true;
+        if (columns & ACC_COL_TIME) ok = ok && read_at(file, out.time.data() + row, len, e.offset + skip);
+        if (columns & ACC_COL_DISTANCE)
+            ok = ok && read_at(file, out.distance.data() + row, len, e.offset + col_bytes + skip);
+        if (columns & ACC_COL_ORIGIN && !dense) {
+            if (e.flags & ACC_ORIGINS_DENSE) {
+                for (uint32_t i = 0; i < sl.count; ++i) out.origin_id[row + i] = e.first_origin + sl.skip + i;
+            } else {
+                ok = ok && read_at(file, out.origin_id.data() + row, len, e.offset + 2 * col_bytes + skip);
+            }
+        }
+        return ok;
+    }
+
+    // Encoded piece: time, distance and (sparse only) origin streams back to back
+    bool read_encoded(const FileRegion& file, const AccColumnIndexEntry& e, uint64_t row, bool dense, unsigned columns,
+                      AccColumns& out) {
+        std::vector<uint8_t> scratch;
+        uint32_t* time = columns & ACC_COL_TIME ? reinterpret_cast<uint32_t*>(out.time.data() + row) : nullptr;
+        uint32_t* dist = columns & ACC_COL_DISTANCE ? reinterpret_cast<uint32_t*>(out.distance.data() + row) : nullptr;
+        bool want_origin = columns & ACC_COL_ORIGIN && !dense;
+        uint64_t next = read_column_stream(*files_, file, e.offset, time, scratch, bytes_read_, pool_);
+        // Streams not needed afterwards are not even located
+        if (next && (dist || (want_origin && !(e.flags & ACC_ORIGINS_DENSE))))
+            next = read_column_stream(*files_, file, next, dist, scratch, bytes_read_, pool_);
+        if (!next) return false;
+        if (want_origin) {
+            if (e.flags & ACC_ORIGINS_DENSE) {
+                for (uint32_t i = 0; i < e.count; ++i) out.origin_id[row + i] = e.first_origin + i;
+            } else if (!read_column_stream(*files_, file, next, out.origin_id.data() + row, scratch, bytes_read_, pool_)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool read_rows(const FileRegion& file, const AccColumnIndexEntry& e, const Slice& sl, uint64_t row,
+                   unsigned columns, AccColumns& out) {
+        std::vector<Accessibility> recs(sl.count);
+        uint64_t skip = uint64_t(sl.skip) * sizeof(Accessibility);
+        if (!read_at(file, recs.data(), recs.size() * sizeof(Accessibility), e.offset + skip)) return false;
+        for (uint32_t i = 0; i < sl.count; ++i) {
+            if (columns & ACC_COL_ORIGIN) out.origin_id[row + i] = recs[i].origin_id;
+            if (columns & ACC_COL_TIME) out.time[row + i] = recs[i].time;
+            if (columns & ACC_COL_DISTANCE) out.distance[row + i] = recs[i].distance;
+        }
+        return true;
+    }
+
+    bool read_at(const FileRegion& file, void* data, uint64_t len, uint64_t offset) {
+        bytes_read_ += len;
+        return read_block(*files_, pool_, file, data, len, offset);
+    }
+
+    struct Segment {
+        std::string dir;
+        AccLayout layout = AccLayout::Rows;
+        std::vector<AccZone> block_zones;
+    };
+
+    std::unique_ptr<DatasetFiles> owned_;
+    const DatasetFiles* files_ = nullptr;      // caches the block descriptors
+    BufferPool* pool_ = nullptr;
+    std::vector<Segment> segments_;
+    std::vector<AccColumnIndexEntry> entries_;
+    std::vector<AccZone> zones_;                // zone of each entry
+    std::vector<uint32_t> entry_segments_;      // segment of each entry
+    std::atomic<uint64_t> bytes_read_{0}, bytes_viewed_{0};
+    std::atomic<uint64_t> skipped_pieces_{0}, skipped_rows_{0};
+};
+
+// Reads the tiled copy (ACC_TILES_TABLE) of every manifest segment. All
+// segments must share one tile size.
+class AccessibilityTileReader {
+public:
+    // Reads through files, which must outlive the reader
+    bool open(const DatasetFiles& files) {
+        files_ = &files;
+        bool any = false;
+        for (const DatasetSegment& seg : load_manifest(files).segments) {
+            if (seg.accessibility == 0) continue;
+            std::string dir = segment_path(seg, ACC_TILES_TABLE);
+            std::vector<AccTileIndexEntry> index;
+            if (!files.read_array(dir + "/index.bin", index)) {
+                // As for the origin-major copy: a segment with records but no tiles leaves holes
+                FileRegion records;
+                if (!any || seg.accessibility == 1 ||
+                    files.find(segment_path(seg, std::string(ACC_TABLE) + "/index.bin"), records))
+                    return false;
+                continue;
+            }
+            auto meta = read_dataset_metadata(files, segment_path(seg, "metadata.txt"));
+            uint32_t to = 0, td = 0;
+            if (!parse_tile_size(meta["tile_origins"], to) || !parse_tile_size(meta["tile_dests"], td) ||
+                (any && (to != tile_origins_ || td != tile_dests_)))
+                return false;
+            tile_origins_ = to;
+            tile_dests_ = td;
+            std::vector<AccZone> zones;
+            if (!files.read_array(dir + "/zones.bin", zones) || zones.size() != index.size()) zones.clear();
+            for (size_t i = 0; i < index.size(); ++i) {
+                tiles_.push_back(index[i]);
+                zones_.push_back(zones.empty() ? AccZone{-INFINITY, INFINITY, -INFINITY, INFINITY, index[i].count}
+                                               : zones[i]);
+                tile_dir_.push_back(seg_dirs_.size());
+            }
+            seg_dirs_.push_back(dir);
+            any = true;
+        }
+        return any;
+    }
+
+    uint32_t tile_origins() const { return tile_origins_; }
+    uint32_t tile_dests() const { return tile_dests_; }
+    size_t tiles() const { return tiles_.size(); }
+    const AccTileIndexEntry& tile(size_t i) const { return tiles_[i]; }
+
+    // Tile pieces, in storage order, whose origin and destination ranges both
+    // hold IDs of the given ascending lists and whose zone can match pred
+    std::vector<size_t> select(const std::vector<uint32_t>& origins, const std::vector<uint32_t>& dests,
+                               const AccPredicate& pred = {}) {
+        std::vector<bool> origin_tile, dest_tile;
+        for (uint32_t o : origins) mark(origin_tile, o / tile_origins_);
+        for (uint32_t d : dests) mark(dest_tile, d / tile_dests_);
+        std::vector<size_t> selected;
+        for (size_t i = 0; i < tiles_.size(); ++i) {
+            const AccTileIndexEntry& t = tiles_[i];
+            if (t.origin_tile >= origin_tile.size() || !origin_tile[t.origin_tile] || t.dest_tile >= dest_tile.size() ||
+                !dest_tile[t.dest_tile])
+                continue;
+            if (pred.active() && !pred.overlaps(zones_[i])) {
+                skipped_pieces_++;
+                skipped_rows_ += t.count;
+                continue;
+            }
+            selected.push_back(i);
+        }
+        return selected;
+    }
+
+    // Loads the records of tile piece i. Thread-safe.
+    bool load(size_t i, std::vector<Accessibility>& out) {
+        const AccTileIndexEntry& t = tiles_[i];
+        FileRegion file;
+        if (!files_->find(block_path(seg_dirs_[tile_dir_[i]], t.block_id), file)) return false;
+        out.resize(t.count);
+        bytes_read_ += uint64_t(t.count) * sizeof(Accessibility);
+        return read_block(*files_, pool_, file, out.data(), out.size() * sizeof(Accessibility), file.offset + t.offset);
+    }
+
+    // As AccessibilityReader::set_buffer_pool()
+    void set_buffer_pool(BufferPool* pool) { pool_ = pool; }
+
+    // True if view() can serve every tile piece (all blocks mapped)
+    bool can_view() const {
+        for (size_t i = 0; i < tiles_.size(); ++i) {
+            FileRegion file;
+            if (!files_->find(block_path(seg_dirs_[tile_dir_[i]], tiles_[i].block_id), file) ||
+                !files_->view_at(file, 0, file.offset))
+                return false;
+        }
+        return true;
+    }
+
+    // Zero-copy form of load(): the records of tile piece i in place in the
+    // mapped block, or nullptr if it is not mapped. Thread-safe.
+    const Accessibility* view(size_t i) {
+        const AccTileIndexEntry& t = tiles_[i];
+        FileRegion file;
+        if (!files_->find(block_path(seg_dirs_[tile_dir_[i]], t.block_id), file)) return nullptr;
+        uint64_t bytes = uint64_t(t.count) * sizeof(Accessibility);
+        const char* p = files_->view_at(file, bytes, file.offset + t.offset);
+        if (!p) return nullptr;
+        prefetch_mapped(p, bytes);
+        bytes_viewed_ += bytes;
+        return reinterpret_cast<const Accessibility*>(p);
+    }
+
+    uint64_t bytes_read() const { return bytes_read_; }
+    uint64_t bytes_viewed() const { return bytes_viewed_; }
+    uint64_t skipped_pieces() const { return skipped_pieces_; }
+    uint64_t skipped_rows() const { return skipped_rows_; }
+
+private:
+    static void mark(std::vector<bool>& v, uint32_t i) {
+        if (i >= v.size()) v.resize(i + 1, false);
+        v[i] = true;
+    }
+
+    const DatasetFiles* files_ = nullptr;
+    BufferPool* pool_ = nullptr;
+    uint32_t tile_origins_ = 0, tile_dests_ = 0;
+    std::vector<AccTileIndexEntry> tiles_;
+    std::vector<AccZone> zones_;
+    std::vector<uint32_t> tile_dir_;  // index into seg_dirs_ of each tile piece
+    std::vector<std::string> seg_dirs_;
+    std::atomic<uint64_t> bytes_read_{0}, bytes_viewed_{0};
+    std::atomic<uint64_t> skipped_pieces_{0}, skipped_rows_{0};
+};
@@ -0,0 +1,319 @@
+#pragma once
+// ===============================================
+// VECTOR FILTER KERNELS
+// ===============================================
+// The phase 7 filter of one accessibility run: keep the records whose
+// other-side ID is in the probe set (a DenseBitmap) and whose time and
+// distance satisfy the predicate, and write them out as Accessibility records.
+// AVX-512 kernels take 16 records per step: the probe words of all 16 IDs are
+// gathered at once, the bit tests and the predicate compares give one lane
+// mask, and the kept records are compressed into contiguous output. AVX2
+// kernels take 8 records and write the kept ones from the mask bits. The
+// kernels are selected at runtime from the CPU, with a scalar fallback.
+//
+// Two input shapes: columns (copied AccColumns or columnar pieces in place,
+// origins explicit or dense) and rows (rows pieces in place, or tiles).
+// Records of origin-major runs hold the destination in their origin column,
+// so the output swaps the two IDs back. Tiles mix runs: their rows filter
+// also tests each record's destination against a second probe set.
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <immintrin.h>
+#include "dataset_reader.h"
+#include "roaring.h"
+
+// Records the kernels are run on at a time (the output buffer of a call)
+constexpr size_t FILTER_BATCH = 4096;
+// Records past the kept ones a kernel may overwrite in its output
+constexpr size_t FILTER_SLACK = 16;
+
+struct RunFilter {
+    const uint32_t* bits = nullptr;  // probe set as 32-bit words
+    uint32_t clamp = 0;              // IDs above are tested at this (clear) bit
+    float time_min, time_max, distance_min, distance_max;
+    uint32_t run_id = 0;
+    bool swap = false;               // write {run, other} instead of {other, run}
+    const uint32_t* run_bits = nullptr;  // rows only: probe set of the second ID, or null (all run_id)
+    uint32_t run_clamp = 0;
+};
+
+inline RunFilter make_run_filter(const DenseBitmap& probe, const AccPredicate& pred, uint32_t run_id, bool swap) {
+    RunFilter f;
+    f.bits = reinterpret_cast<const uint32_t*>(probe.words());
+    f.clamp = uint32_t(std::min<uint64_t>(probe.limit(), UINT32_MAX));
+    f.time_min = pred.time_min;
+    f.time_max = pred.time_max;
+    f.distance_min = pred.distance_min;
+    f.distance_max = pred.distance_max;
+    f.run_id = run_id;
+    f.swap = swap;
+    return f;
+}
+
+// Filter of tile rows: both IDs of a record are probed
+inline RunFilter make_tile_filter(const DenseBitmap& origins, const DenseBitmap& dests, const AccPredicate& pred) {
+    RunFilter f = make_run_filter(origins, pred, 0, false);
+    f.run_bits = reinterpret_cast<const uint32_t*>(dests.words());
+    f.run_clamp = uint32_t(std::min<uint64_t>(dests.limit(), UINT32_MAX));
+    return f;
+}
+
+// Kernels return the number of records written to out, which holds
+// n + FILTER_SLACK records. other == nullptr means dense: first_other + k.
+using FilterColumnsFn = size_t (*)(const RunFilter& f, const uint32_t* other, uint32_t first_other,
+                                   const float* time, const float* distance, size_t n, Accessibility* out);
+using FilterRowsFn = size_t (*)(const RunFilter& f, const Accessibility* rows, size_t n, Accessibility* out);
+
+namespace filter_detail {
+
+inline bool probe(const uint32_t* bits, uint32_t clamp, uint32_t id) {
+    uint32_t c = std::min(id, clamp);
+    return bits[c >> 5] >> (c & 31) & 1;
+}
+
+inline bool keep(const RunFilter& f, uint32_t id, float time, float distance) {
+    return probe(f.bits, f.clamp, id) && time >= f.time_min && time <= f.time_max && distance >= f.distance_min &&
+           distance <= f.distance_max;
+}
+
+// Rows are stored {other, run}: kept as is, or with the two IDs exchanged
+inline Accessibility row_record(const RunFilter& f, const Accessibility& a) {
+    return f.swap ? Accessibility{a.destination_id, a.origin_id, a.time, a.distance} : a;
+}
+
+inline Accessibility record(const RunFilter& f, uint32_t id, float time, float distance) {
+    return f.swap ? Accessibility{f.run_id, id, time, distance} : Accessibility{id, f.run_id, time, distance};
+}
+
+inline size_t filter_columns_scalar(const RunFilter& f, const uint32_t* other, uint32_t first_other,
+                                    const float* time, const float* distance, size_t n, Accessibility* out) {
+    size_t w = 0;
+    for (size_t k = 0; k < n; ++k) {
+        uint32_t id = other ? other[k] : first_other + uint32_t(k);
+        if (keep(f, id, time[k], distance[k])) out[w++] = record(f, id, time[k], distance[k]);
+    }
+    return w;
+}
+
+inline size_t filter_rows_scalar(const RunFilter& f, const Accessibility* rows, size_t n, Accessibility* out) {
+    size_t w = 0;
+    for (size_t k = 0; k < n; ++k)
+        if (keep(f, rows[k].origin_id, rows[k].time, rows[k].distance) &&
+            (!f.run_bits || probe(f.run_bits, f.run_clamp, rows[k].destination_id)))
+            out[w++] = row_record(f, rows[k]);
+    return w;
+}
+
+// ---- AVX2: 8 records per step ----
+
+__attribute__((target("avx2"))) inline __m256i probe_avx2(const uint32_t* bits, uint32_t clamp, __m256i id) {
+    __m256i c = _mm256_min_epu32(id, _mm256_set1_epi32(int(clamp)));
+    __m256i word = _mm256_i32gather_epi32(reinterpret_cast<const int*>(bits), _mm256_srli_epi32(c, 5), 4);
+    __m256i bit = _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(c, _mm256_set1_epi32(31))),
+                                   _mm256_set1_epi32(1));
+    return _mm256_cmpeq_epi32(bit, _mm256_set1_epi32(1));
+}
+
+__attribute__((target("avx2"))) inline unsigned mask_avx2(const RunFilter& f, __m256i id, __m256 t, __m256 d) {
+    __m256 m = _mm256_castsi256_ps(probe_avx2(f.bits, f.clamp, id));
+    m = _mm256_and_ps(m, _mm256_cmp_ps(t, _mm256_set1_ps(f.time_min), _CMP_GE_OQ));
+    m = _mm256_and_ps(m, _mm256_cmp_ps(t, _mm256_set1_ps(f.time_max), _CMP_LE_OQ));
+    m = _mm256_and_ps(m, _mm256_cmp_ps(d, _mm256_set1_ps(f.distance_min), _CMP_GE_OQ));
+    m = _mm256_and_ps(m, _mm256_cmp_ps(d, _mm256_set1_ps(f.distance_max), _CMP_LE_OQ));
+    return unsigned(_mm256_movemask_ps(m));
+}
+
+__attribute__((target("avx2"))) inline size_t filter_columns_avx2(const RunFilter& f, const uint32_t* other,
+                                                                  uint32_t first_other, const float* time,
+                                                                  const float* distance, size_t n,
+                                                                  Accessibility* out) {
+    const __m256i iota = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    size_t w = 0, k = 0;
+    for (; k + 8 <= n; k += 8) {
+        __m256i id = other ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(other + k))
+                           : _mm256_add_epi32(_mm256_set1_epi32(int(first_other + uint32_t(k))), iota);
+        unsigned m = mask_avx2(f, id, _mm256_loadu_ps(time + k), _mm256_loadu_ps(distance + k));
+        for (; m; m &= m - 1) {
+            size_t j = k + __builtin_ctz(m);
+            out[w++] = record(f, other ? other[j] : first_other + uint32_t(j), time[j], distance[j]);
+        }
+    }
+    return w + filter_columns_scalar(f, other ? other + k : nullptr, first_other + uint32_t(k), time + k,
+                                     distance + k, n - k, out + w);
+}
+
+__attribute__((target("avx2"))) inline size_t filter_rows_avx2(const RunFilter& f, const Accessibility* rows,
+                                                               size_t n, Accessibility* out) {
+    // Field j of record i is word 4i + j
+    const __m256i stride = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+    size_t w = 0, k = 0;
+    for (; k + 8 <= n; k += 8) {
+        const int* base = reinterpret_cast<const int*>(rows + k);
+        __m256i id = _mm256_i32gather_epi32(base, stride, 4);
+        __m256 t = _mm256_i32gather_ps(reinterpret_cast<const float*>(base) + 2, stride, 4);
+        __m256 d = _mm256_i32gather_ps(reinterpret_cast<const float*>(base) + 3, stride, 4);
+        unsigned m = mask_avx2(f, id, t, d);
+        if (f.run_bits && m)
+            m &= unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(
+                probe_avx2(f.run_bits, f.run_clamp, _mm256_i32gather_epi32(base + 1, stride, 4)))));
+        for (; m; m &= m - 1) out[w++] = row_record(f, rows[k + __builtin_ctz(m)]);
+    }
+    return w + filter_rows_scalar(f, rows + k, n - k, out + w);
+}
+
+// ---- AVX-512: 16 records per step ----
+
+// GCC 12 reports the _mm512_undefined_* pass-through operand of the unmasked
+// intrinsics as maybe-uninitialized at -O2 -Wall
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f"))) inline __mmask16 probe_avx512(__mmask16 m, const uint32_t* bits,
+                                                                 uint32_t clamp, __m512i id) {
+    __m512i c = _mm512_min_epu32(id, _mm512_set1_epi32(int(clamp)));
+    __m512i word = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), m, _mm512_srli_epi32(c, 5), bits, 4);
+    return _mm512_mask_test_epi32_mask(m, _mm512_srlv_epi32(word, _mm512_and_si512(c, _mm512_set1_epi32(31))),
+                                       _mm512_set1_epi32(1));
+}
+
+__attribute__((target("avx512f"))) inline __mmask16 mask_avx512(const RunFilter& f, __m512i id, __m512 t,
+                                                                __m512 d) {
+    __mmask16 m = probe_avx512(0xFFFF, f.bits, f.clamp, id);
+    m = _mm512_mask_cmp_ps_mask(m, t, _mm512_set1_ps(f.time_min), _CMP_GE_OQ);
+    m = _mm512_mask_cmp_ps_mask(m, t, _mm512_set1_ps(f.time_max), _CMP_LE_OQ);
+    m = _mm512_mask_cmp_ps_mask(m, d, _mm512_set1_ps(f.distance_min), _CMP_GE_OQ);
+    m = _mm512_mask_cmp_ps_mask(m, d, _mm512_set1_ps(f.distance_max), _CMP_LE_OQ);
+    return m;
+}
+
+// Interleaves four columns of 16 words into 16 records (64 words at out)
+__attribute__((target("avx512f"))) inline void store_records_avx512(Accessibility* out, __m512i a, __m512i b,
+                                                                   __m512i c, __m512i d) {
+    __m512i ab_lo = _mm512_unpacklo_epi32(a, b), ab_hi = _mm512_unpackhi_epi32(a, b);
+    __m512i cd_lo = _mm512_unpacklo_epi32(c, d), cd_hi = _mm512_unpackhi_epi32(c, d);
+    // r_j holds records j, j+4, j+8, j+12, one per 128-bit lane
+    __m512i r0 = _mm512_unpacklo_epi64(ab_lo, cd_lo), r1 = _mm512_unpackhi_epi64(ab_lo, cd_lo);
+    __m512i r2 = _mm512_unpacklo_epi64(ab_hi, cd_hi), r3 = _mm512_unpackhi_epi64(ab_hi, cd_hi);
+    __m512i t0 = _mm512_shuffle_i32x4(r0, r1, 0x44), t1 = _mm512_shuffle_i32x4(r2, r3, 0x44);
+    __m512i t2 = _mm512_shuffle_i32x4(r0, r1, 0xEE), t3 = _mm512_shuffle_i32x4(r2, r3, 0xEE);
+    __m512i* p = reinterpret_cast<__m512i*>(out);
+    _mm512_storeu_si512(p + 0, _mm512_shuffle_i32x4(t0, t1, 0x88));
+    _mm512_storeu_si512(p + 1, _mm512_shuffle_i32x4(t0, t1, 0xDD));
+    _mm512_storeu_si512(p + 2, _mm512_shuffle_i32x4(t2, t3, 0x88));
+    _mm512_storeu_si512(p + 3, _mm512_shuffle_i32x4(t2, t3, 0xDD));
+}
+
+__attribute__((target("avx512f"))) inline size_t filter_columns_avx512(const RunFilter& f, const uint32_t* other,
+                                                                      uint32_t first_other, const float* time,
+                                                                      const float* distance, size_t n,
+                                                                      Accessibility* out) {
+    const __m512i iota = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i run = _mm512_set1_epi32(int(f.run_id));
+    size_t w = 0, k = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m512i id = other ? _mm512_loadu_si512(other + k)
+                           : _mm512_add_epi32(_mm512_set1_epi32(int(first_other + uint32_t(k))), iota);
+        __m512 t = _mm512_loadu_ps(time + k), d = _mm512_loadu_ps(distance + k);
+        __mmask16 m = mask_avx512(f, id, t, d);
+        if (!m) continue;
+        __m512i kept_id = _mm512_maskz_compress_epi32(m, id);
+        __m512i kept_run = _mm512_maskz_compress_epi32(m, run);
+        store_records_avx512(out + w, f.swap ? kept_run : kept_id, f.swap ? kept_id : kept_run,
+                             _mm512_maskz_compress_epi32(m, _mm512_castps_si512(t)),
+                             _mm512_maskz_compress_epi32(m, _mm512_castps_si512(d)));
+        w += __builtin_popcount(m);
+    }
+    return w + filter_columns_scalar(f, other ? other + k : nullptr, first_other + uint32_t(k), time + k,
+                                     distance + k, n - k, out + w);
+}
+
+// One field of 16 records in v (4 per register); idx picks it in the low 8 lanes
+__attribute__((target("avx512f"))) inline __m512i field_avx512(const __m512i v[4], __m512i idx) {
+    return _mm512_shuffle_i32x4(_mm512_permutex2var_epi32(v[0], idx, v[1]),
+                                _mm512_permutex2var_epi32(v[2], idx, v[3]), 0x44);
+}
+
+__attribute__((target("avx512f"))) inline size_t filter_rows_avx512(const RunFilter& f, const Accessibility* rows,
+                                                                   size_t n, Accessibility* out) {
+    const __m512i id_idx = _mm512_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m512i one = _mm512_set1_epi32(1), two = _mm512_set1_epi32(2), three = _mm512_set1_epi32(3);
+    // Each record bit selects its four words
+    static const uint16_t expand[16] = {0x0000, 0x000F, 0x00F0, 0x00FF, 0x0F00, 0x0F0F, 0x0FF0, 0x0FFF,
+                                        0xF000, 0xF00F, 0xF0F0, 0xF0FF, 0xFF00, 0xFF0F, 0xFFF0, 0xFFFF};
+    size_t w = 0, k = 0;
+    for (; k + 16 <= n; k += 16) {
+        const __m512i* p = reinterpret_cast<const __m512i*>(rows + k);
+        __m512i v[4] = {_mm512_loadu_si512(p), _mm512_loadu_si512(p + 1), _mm512_loadu_si512(p + 2),
+                        _mm512_loadu_si512(p + 3)};
+        __m512i id = field_avx512(v, id_idx);
+        __m512 t = _mm512_castsi512_ps(field_avx512(v, _mm512_add_epi32(id_idx, two)));
+        __m512 d = _mm512_castsi512_ps(field_avx512(v, _mm512_add_epi32(id_idx, three)));
+        __mmask16 m = mask_avx512(f, id, t, d);
+        if (f.run_bits && m)
+            m = probe_avx512(m, f.run_bits, f.run_clamp, field_avx512(v, _mm512_add_epi32(id_idx, one)));
+        for (int j = 0; j < 4 && m; ++j, m >>= 4) {
+            unsigned kept = m & 0xF;
+            if (!kept) continue;
+            // Rows are stored {other, run}; swapping exchanges the first two words
+            __m512i r = f.swap ? _mm512_shuffle_epi32(v[j], _MM_PERM_DCAB) : v[j];
+            _mm512_mask_compressstoreu_epi32(out + w, expand[kept], r);
+            w += __builtin_popcount(kept);
+        }
+    }
+    return w + filter_rows_scalar(f, rows + k, n - k, out + w);
+}
+
+#pragma GCC diagnostic pop
+
+}  // namespace filter_detail
+
+struct FilterKernels {
+    FilterColumnsFn columns;
+    FilterRowsFn rows;
+    const char* name;
+};
+
+// Best kernels for this CPU, chosen once
+inline const FilterKernels& filter_kernels() {
+    using namespace filter_detail;
+    static const FilterKernels k = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return FilterKernels{filter_columns_avx512, filter_rows_avx512, "avx512"};
+        if (__builtin_cpu_supports("avx2")) return FilterKernels{filter_columns_avx2, filter_rows_avx2, "avx2"};
+        return FilterKernels{filter_columns_scalar, filter_rows_scalar, "scalar"};
+    }();
+    return k;
+}
+
+// Appends the kept records of n columnar records to out, FILTER_BATCH at a time
+inline void filter_columns_into(const RunFilter& f, const uint32_t* other, uint32_t first_other, const float* time,
+                                const float* distance, size_t n, std::vector<Accessibility>& out) {
+    thread_local std::vector<Accessibility> buf(FILTER_BATCH + FILTER_SLACK);
+    FilterColumnsFn kernel = filter_kernels().columns;
+    for (size_t k = 0; k < n; k += FILTER_BATCH) {
+        size_t len = std::min(FILTER_BATCH, n - k);
+        size_t w = kernel(f, other ? other + k : nullptr, first_other + uint32_t(k), time + k, distance + k, len,
+                          buf.data());
+        out.insert(out.end(), buf.begin(), buf.begin() + w);
+    }
+}
+
+inline void filter_rows_into(const RunFilter& f, const Accessibility* rows, size_t n, std::vector<Accessibility>& out) {
+    thread_local std::vector<Accessibility> buf(FILTER_BATCH + FILTER_SLACK);
+    FilterRowsFn kernel = filter_kernels().rows;
+    for (size_t k = 0; k < n; k += FILTER_BATCH) {
+        size_t w = kernel(f, rows + k, std::min(FILTER_BATCH, n - k), buf.data());
+        out.insert(out.end(), buf.begin(), buf.begin() + w);
+    }
+}
+
+inline void filter_run_into(const RunFilter& f, const AccColumns& run, std::vector<Accessibility>& out) {
+    filter_columns_into(f, run.origin_id.empty() ? nullptr : run.origin_id.data(), run.first_origin,
+                        run.time.data(), run.distance.data(), run.count, out);
+}
+
+inline void filter_view_into(const RunFilter& f, const AccPieceView& p, std::vector<Accessibility>& out) {
+    if (p.rows) filter_rows_into(f, p.rows, p.count, out);
+    else filter_columns_into(f, p.origin_id, p.first_origin, p.time, p.distance, p.count, out);
+}
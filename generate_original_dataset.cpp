@@ -1,17 +1,15 @@
 #include <bits/stdc++.h>
+#include <thread>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include "stream_writer.h"
+#include "dataset_container.h"
+#include "dataset_format.h"
 using namespace std;
 
 constexpr uint32_t NUM_ORIGINS = 221571;
 constexpr uint32_t NUM_DESTS   = 16823;
-constexpr uint32_t ORIGIN_ATTRS = 5000;
-constexpr uint32_t DEST_ATTRS   = 2000;
-
-struct Accessibility {
-    uint32_t origin_id;
-    uint32_t destination_id;
-    float time;
-    float distance;
-};
 
 inline float frand(float a=0.0f, float b=1.0f) {
     return a + static_cast<float>(rand()) / RAND_MAX * (b - a);
@@ -23,9 +21,198 @@ inline uint64_t compute_non_nulls(uint32_t percent, uint32_t total_rows) {
     return (total_rows * percent) / 100;
 }
 
+// Non-null count of attribute column `a` (att0-att99 progressive, att100+ full).
+// Nulls are always the leading rows: id < total_rows - non_nulls is NaN.
+inline uint64_t column_non_nulls(uint32_t a, uint32_t total_rows) {
+    float percent_non_null = (a == 100) ? 1.0f : (a < 100 ? a / 100.0f : 0.0f);
+    uint64_t n_not_nulls = uint64_t(ceil(percent_non_null * total_rows));
+    if (a >= 100) n_not_nulls = total_rows;
+    if (n_not_nulls > total_rows) n_not_nulls = total_rows;
+    return n_not_nulls;
+}
+
+// ===============================================
+// COUNTER-BASED RNG (PARALLEL MODE)
+// ===============================================
+// Every value is a pure function of (table, row, column), so any thread can
+// generate any cell in any order and the output does not depend on the
+// number of threads. Not compatible with the legacy rand() stream.
+constexpr uint64_t RNG_SEED = 33;
+
+enum RngTable : uint32_t {
+    RNG_ORIGIN   = 0,
+    RNG_DEST     = 1,
+    RNG_ACC_TIME = 2,
+    RNG_ACC_DIST = 3,
+};
+
+inline uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+inline float counter_frand(uint32_t table, uint32_t row, uint32_t col, float a, float b) {
+    uint64_t key = splitmix64(RNG_SEED * 0x100000001B3ULL + table);
+    uint64_t h = splitmix64(key ^ ((uint64_t(row) << 32) | col));
+    float u = static_cast<float>(h >> 40) * (1.0f / 16777216.0f);  // 24 bits -> [0,1)
+    return a + u * (b - a);
+}
+
+inline float counter_attr_value(uint32_t table, uint32_t id, uint32_t a, uint32_t total_rows, float max_val) {
+    if (id < total_rows - column_non_nulls(a, total_rows)) return NAN;
+    return counter_frand(table, id, a, 0.0f, max_val);
+}
+
+inline Accessibility counter_accessibility(uint32_t o, uint32_t d) {
+    Accessibility a;
+    a.origin_id = o;
+    a.destination_id = d;
+    a.time = (o == d) ? 0.0f : counter_frand(RNG_ACC_TIME, o, d, 1, 120);
+    a.distance = (o == d) ? 0.0f : counter_frand(RNG_ACC_DIST, o, d, 0.5, 50.0);
+    return a;
+}
+
+// Splits [0, n) into `parts` contiguous ranges and runs fn(begin, end) as one
+// task of the shared thread pool each. Returns false if any range reported a failure.
+template <typename Fn>
+bool run_row_ranges(uint32_t n, unsigned parts, Fn fn) {
+    atomic<bool> ok{true};
+    uint32_t chunk = (n + parts - 1) / parts;
+    ThreadPool::shared().parallel_for(n, chunk, [&](size_t start, size_t end) {
+        if (!fn(uint32_t(start), uint32_t(end))) ok = false;
+    });
+    return ok;
+}
+
+// Fills an attribute table ([uint32_t id][float att0]...) in parallel.
+// Each thread owns a contiguous id range and streams it from id * row_size.
+bool generate_attribute_table_parallel(OutputFile& out, uint32_t table, uint32_t n_rows,
+                                       uint32_t n_attrs, float max_val, unsigned n_threads) {
+    uint64_t row_size = 4 + uint64_t(n_attrs) * 4;
+
+    // First non-null id of every column (nulls are a leading prefix)
+    vector<uint64_t> first_valid(n_attrs);
+    for (uint32_t a = 0; a < n_attrs; ++a)
+        first_valid[a] = n_rows - column_non_nulls(a, n_rows);
+
+    return run_row_ranges(n_rows, n_threads, [&](uint32_t start, uint32_t end) {
+        StreamWriter writer(out, uint64_t(start) * row_size);
+        vector<float> row(n_attrs);
+        for (uint32_t id = start; id < end; ++id) {
+            for (uint32_t a = 0; a < n_attrs; ++a)
+                row[a] = (id < first_valid[a]) ? NAN : counter_frand(table, id, a, 0.0f, max_val);
+            writer.write(&id, 4);
+            writer.write(row.data(), row.size() * 4);
+        }
+        return writer.flush();
+    });
+}
+
+// Fills the accessibility table (origin-major cartesian product) in parallel.
+// Each thread owns a contiguous origin range and streams it from o * num_dests * 16.
+bool generate_accessibility_parallel(OutputFile& out, uint32_t num_origins,
+                                     uint32_t num_dests, unsigned n_threads) {
+    uint64_t row_size = uint64_t(num_dests) * sizeof(Accessibility);
+
+    return run_row_ranges(num_origins, n_threads, [&](uint32_t start, uint32_t end) {
+        StreamWriter writer(out, uint64_t(start) * row_size);
+        vector<Accessibility> row(num_dests);
+        for (uint32_t o = start; o < end; ++o) {
+            for (uint32_t d = 0; d < num_dests; ++d)
+                row[d] = counter_accessibility(o, d);
+            writer.write(row.data(), row_size);
+        }
+        return writer.flush();
+    });
+}
+
+// ===============================================
+// FUSED GENERATE + PREPROCESS
+// ===============================================
+// Writes the preprocessed block layout (dataset_format.h) directly: attribute
+// runs are generated column by column and accessibility destination by
+// destination, so neither the raw row-major files nor the sort are needed.
+// Values are the counter-RNG values of the parallel mode.
+constexpr size_t FUSED_BATCH_BYTES = 256 * 1024 * 1024;  // generated data held between writes
+
+bool generate_attributes_fused(const string& dir, uint32_t table, uint32_t n_rows, uint32_t n_attrs,
+                               float max_val, size_t target_block_size, unsigned n_threads,
+                               const WriterOptions& opts, BlockCodec codec, uint32_t& blocks_created) {
+    AttributeBlockWriter writer(dir, target_block_size, opts, codec);
+    if (!writer.open()) return false;
+
+    // Batches of consecutive attributes: generated in parallel, written in attribute order
+    vector<vector<AttrValue>> runs;
+    uint32_t a0 = 0;
+    while (a0 < n_attrs) {
+        uint32_t a1 = a0;
+        size_t batch_bytes = 0;
+        while (a1 < n_attrs && (a1 == a0 || batch_bytes + column_non_nulls(a1, n_rows) * sizeof(AttrValue) <= FUSED_BATCH_BYTES))
+            batch_bytes += column_non_nulls(a1++, n_rows) * sizeof(AttrValue);
+        runs.assign(a1 - a0, {});
+
+        bool ok = run_row_ranges(a1 - a0, n_threads, [&](uint32_t start, uint32_t end) {
+            for (uint32_t i = start; i < end; ++i) {
+                uint32_t a = a0 + i;
+                uint32_t first_valid = n_rows - column_non_nulls(a, n_rows);
+                auto& run = runs[i];
+                run.resize(n_rows - first_valid);
+                for (uint32_t id = first_valid; id < n_rows; ++id)
+                    run[id - first_valid] = {id, counter_frand(table, id, a, 0.0f, max_val)};
+            }
+            return true;
+        });
+        if (!ok) return false;
+        for (const auto& run : runs)
+            if (!writer.append(run.data(), static_cast<uint32_t>(run.size()))) return false;
+        a0 = a1;
+    }
+    blocks_created = writer.blocks();
+    return writer.close();
+}
+
+bool generate_accessibility_fused(const string& dir, uint32_t num_origins, uint32_t num_dests,
+                                  unsigned n_threads, const WriterOptions& opts, AccLayout layout,
+                                  BlockCodec codec, uint32_t& blocks_created) {
+    AccessibilityBlockWriter writer(dir, TARGET_ACC_BLOCK_SIZE_BYTES, opts, layout, codec);
+    if (!writer.open()) return false;
+
+    // Batches of whole destination runs (origin order inside each run)
+    uint64_t run_bytes = uint64_t(num_origins) * sizeof(Accessibility);
+    uint32_t dests_per_batch = max<uint64_t>(1, FUSED_BATCH_BYTES / max<uint64_t>(run_bytes, 1));
+    vector<Accessibility> batch;
+    for (uint32_t d0 = 0; d0 < num_dests; d0 += dests_per_batch) {
+        uint32_t d1 = min(num_dests, d0 + dests_per_batch);
+        batch.resize(uint64_t(d1 - d0) * num_origins);
+        run_row_ranges(d1 - d0, n_threads, [&](uint32_t start, uint32_t end) {
+            for (uint32_t i = start; i < end; ++i) {
+                Accessibility* run = batch.data() + uint64_t(i) * num_origins;
+                for (uint32_t o = 0; o < num_origins; ++o)
+                    run[o] = counter_accessibility(o, d0 + i);
+            }
+            return true;
+        });
+        if (!writer.append(batch.data(), batch.size())) return false;
+    }
+    blocks_created = writer.blocks();
+    return writer.close();
+}
+
 int main(int argc, char** argv) {
     if (argc < 3) {
-        cerr << "Usage: ./generate_full_dataset <output_dir> <percent>\n";
+        cerr << "Usage: ./generate_full_dataset <output_dir> <percent> [--threads N] [--fused] [--direct]"
+                " [--no-prealloc] [--buffer-mb N] [--acc-layout rows|columnar] [--codec none|auto] [--pack]\n";
+        cerr << "  --threads N    parallel mode: counter-based RNG, output identical for any N\n";
+        cerr << "  --fused        write the preprocessed block layout to <output_dir>/<N>p directly\n"
+                "                 (implies the counter-based RNG; no raw files, no preprocess_dataset)\n";
+        cerr << "  --direct       write with O_DIRECT (page cache bypass)\n";
+        cerr << "  --no-prealloc  do not fallocate() output files upfront\n";
+        cerr << "  --buffer-mb N  write buffer per writer (default 16)\n";
+        cerr << "  --acc-layout L accessibility block layout in --fused mode (see preprocess_dataset)\n";
+        cerr << "  --codec C      block codec in --fused mode (see preprocess_dataset)\n";
+        cerr << "  --pack         pack the --fused output into <output_dir>/<N>p/dataset.aspa\n";
         return 1;
     }
 
@@ -35,12 +222,54 @@ int main(int argc, char** argv) {
         cerr << "Percent must be in (0,1].\n";
         return 1;
     }
+
+    // Optional flags
+    unsigned n_threads = 0;  // 0 = legacy single-threaded rand() stream
+    WriterOptions writer_opts;
+    bool fused = false, pack = false;
+    AccLayout acc_layout = AccLayout::Rows;
+    BlockCodec codec = BlockCodec::None;
+    for (int i = 3; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            n_threads = stoul(argv[++i]);
+            if (n_threads == 0) n_threads = max(1u, thread::hardware_concurrency());
+        } else if (arg == "--fused") {
+            fused = true;
+        } else if (arg == "--pack") {
+            pack = true;
+        } else if (arg == "--direct") {
+            writer_opts.direct = true;
+        } else if (arg == "--no-prealloc") {
+            writer_opts.prealloc = false;
+        } else if (arg == "--buffer-mb" && i + 1 < argc) {
+            writer_opts.buffer_bytes = size_t(stoul(argv[++i])) * 1024 * 1024;
+        } else if (arg == "--acc-layout" && i + 1 < argc) {
+            if (!parse_acc_layout(argv[++i], acc_layout)) {
+                cerr << "Unknown accessibility layout: " << argv[i] << "\n";
+                return 1;
+            }
+        } else if (arg == "--codec" && i + 1 < argc) {
+            if (!parse_block_codec(argv[++i], codec)) {
+                cerr << "Unknown codec: " << argv[i] << "\n";
+                return 1;
+            }
+        } else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    if (fused && n_threads == 0) n_threads = max(1u, thread::hardware_concurrency());
+    bool parallel = n_threads > 0;
+
     // Calculate percent string for filenames (e.g., 10p for 0.1)
     int percent_int = static_cast<int>(percent * 100 + 0.5f);
     string percent_str = to_string(percent_int) + "p";
 
     // Always use seed 33
     srand(33);
+    if (parallel)
+        cout << "Parallel mode: " << n_threads << " threads, counter-based RNG (seed " << RNG_SEED << ")" << endl;
 
     filesystem::create_directories(outdir);
 
@@ -61,6 +290,98 @@ int main(int argc, char** argv) {
         return buf;
     };
 
+    // One-line write throughput summary of a finished table
+    auto write_stats = [](const OutputFile& f) -> string {
+        char buf[160];
+        snprintf(buf, sizeof(buf), "%.2f MB/s (%.3f s wall, %.3f s in pwrite, O_DIRECT %s)",
+                 f.wall_mb_per_s(), f.wall_seconds(), f.io_seconds(), f.direct() ? "on" : "off");
+        return buf;
+    };
+
+    if (fused) {
+        string outBase = outdir + "/" + percent_str;
+        // A fused build replaces the dataset, including a packed one
+        DatasetManifest manifest;
+        manifest.version = load_manifest(outBase).version + 1;
+        filesystem::remove(container_path(outBase));
+        auto t_start = chrono::steady_clock::now();
+        uint32_t origin_blocks = 0, dest_blocks = 0, acc_blocks = 0;
+        auto timed = [&](const char* name, auto fn) {
+            auto t0 = chrono::steady_clock::now();
+            bool ok = fn();
+            cout << name << (ok ? " written in " : " FAILED after ")
+                 << chrono::duration<double>(chrono::steady_clock::now() - t0).count() << " s" << endl;
+            return ok;
+        };
+        bool ok =
+            timed("Origin attribute blocks", [&]() {
+                return generate_attributes_fused(outBase + "/attributes/origin", RNG_ORIGIN, num_origins, ORIGIN_ATTRS,
+                                                 1000, TARGET_ORIGIN_ATTR_BLOCK_SIZE_BYTES, n_threads, writer_opts, codec,
+                                                 origin_blocks);
+            }) &&
+            timed("Destination attribute blocks", [&]() {
+                return generate_attributes_fused(outBase + "/attributes/destination", RNG_DEST, num_dests, DEST_ATTRS,
+                                                 500, TARGET_DEST_ATTR_BLOCK_SIZE_BYTES, n_threads, writer_opts, codec,
+                                                 dest_blocks);
+            }) &&
+            timed("Accessibility blocks", [&]() {
+                return generate_accessibility_fused(outBase + "/accessibility", num_origins, num_dests,
+                                                    n_threads, writer_opts, acc_layout, codec, acc_blocks);
+            });
+        if (!ok) return 1;
+        // The keys preprocess_dataset writes for a default build, so both outputs match byte for byte
+        BlockCodec acc_codec = acc_layout == AccLayout::Columnar ? codec : BlockCodec::None;
+        map<string, string> metadata = {{"accessibility_layout", acc_layout_name(acc_layout)},
+                                        {"attribute_codec", block_codec_name(codec)},
+                                        {"accessibility_codec", block_codec_name(acc_codec)}};
+        add_block_sizes(metadata, BlockSizes());  // the TARGET_* block sizes written above
+        metadata["read_method"] = read_method_name(ReadMethod::Pread);
+        if (!write_dataset_metadata(outBase, metadata)) return 1;
+        // Its only segment is the base
+        DatasetSegment base;
+        base.origin_attrs = ORIGIN_ATTRS;
+        base.destination_attrs = DEST_ATTRS;
+        base.accessibility = 1;
+        manifest.segments.push_back(base);
+        if (!write_manifest(outBase, manifest)) return 1;
+        PackStats packed;
+        string pack_error;
+        if (pack && !pack_dataset(outBase, packed, pack_error)) {
+            cerr << "Error: " << pack_error << "\n";
+            return 1;
+        }
+        double total_time = chrono::duration<double>(chrono::steady_clock::now() - t_start).count();
+
+        string reportPath = outBase + "/preprocessing_report_" + percent_str + ".txt";
+        ofstream report(reportPath);
+        report << "========================================\n";
+        report << "PREPROCESSING REPORT (FUSED GENERATION)\n";
+        report << "========================================\n\n";
+        report << "Dataset percentage: " << percent_int << "%\n";
+        report << "Input: generated in place (counter-based RNG, seed " << RNG_SEED << ", "
+               << n_threads << " threads)\n";
+        report << "Output directory: " << outBase << "\n";
+        report << "Total processing time: " << total_time << " seconds\n\n";
+        report << "Origin attributes: " << num_origins << " rows, " << origin_blocks << " blocks of "
+               << (TARGET_ORIGIN_ATTR_BLOCK_SIZE_BYTES / (1024*1024)) << " MB\n";
+        report << "Destination attributes: " << num_dests << " rows, " << dest_blocks << " blocks of "
+               << (TARGET_DEST_ATTR_BLOCK_SIZE_BYTES / (1024*1024)) << " MB\n";
+        report << "Accessibility: " << (uint64_t(num_origins) * num_dests) << " records, " << acc_blocks
+               << " blocks of " << (TARGET_ACC_BLOCK_SIZE_BYTES / (1024*1024)) << " MB, "
+               << acc_layout_name(acc_layout) << " layout\n";
+        report << "Codec: attributes " << block_codec_name(codec) << ", accessibility " << block_codec_name(acc_codec)
+               << "\n";
+        report << "Storage: " << (pack ? "packed, " + to_string(packed.files) + " files in " + container_path(outBase) +
+                                             " (" + format_size(packed.bytes) + ")"
+                                       : string("loose files")) << "\n";
+        report << "========================================\n";
+        report.close();
+
+        cout << "\nFused dataset written to: " << outBase << " in " << total_time << " s" << endl;
+        cout << "Report generated: " << reportPath << endl;
+        return 0;
+    }
+
     // Variables for report
     uint64_t origin_bytes = 0, dest_bytes = 0, acc_bytes = 0;
     uint64_t origin_rows = 0, dest_rows = 0, acc_rows = 0;
@@ -73,7 +394,9 @@ int main(int argc, char** argv) {
         string txt_path = outdir + "/origin_" + percent_str + "_preview.txt";
         string origin_report_path = outdir + "/origin_" + percent_str + "_report.txt";
 
-        ofstream f_bin(bin_path, ios::binary);
+        uint64_t row_size = 4 + uint64_t(ORIGIN_ATTRS) * 4;
+        OutputFile f_bin;
+        if (!f_bin.open(bin_path, writer_opts, row_size * num_origins)) return 1;
         ofstream f_txt(txt_path);
 
         // Write header
@@ -83,26 +406,40 @@ int main(int argc, char** argv) {
         f_txt << "\n";
 
         // Write data
-        for (uint32_t id = 0; id < num_origins; ++id) {
-            f_bin.write((char*)&id, 4);
-            if (id < 100) f_txt << id;
-            for (uint32_t a = 0; a < ORIGIN_ATTRS; ++a) {
-                float percent_non_null = (a == 100) ? 1.0f : (a < 100 ? a / 100.0f : 0.0f);
-                uint64_t n_not_nulls = uint64_t(ceil(percent_non_null * num_origins));
-                if (a >= 100) n_not_nulls = num_origins;
-                if (n_not_nulls > num_origins) n_not_nulls = num_origins;
-                float val;
-                if (id < num_origins - n_not_nulls) {
-                    val = NAN;
-                    f_bin.write((char*)&val, 4);
-                    if (id < 100) f_txt << ",NA";
-                } else {
-                    val = frand(0, 1000);
-                    f_bin.write((char*)&val, 4);
-                    if (id < 100) f_txt << "," << val;
+        if (parallel) {
+            if (!generate_attribute_table_parallel(f_bin, RNG_ORIGIN, num_origins, ORIGIN_ATTRS, 1000, n_threads))
+                return 1;
+            for (uint32_t id = 0; id < min(num_origins, 100u); ++id) {
+                f_txt << id;
+                for (uint32_t a = 0; a < ORIGIN_ATTRS; ++a) {
+                    float val = counter_attr_value(RNG_ORIGIN, id, a, num_origins, 1000);
+                    if (isnan(val)) f_txt << ",NA";
+                    else f_txt << "," << val;
+                }
+                f_txt << "\n";
+            }
+        } else {
+            StreamWriter writer(f_bin);
+            vector<float> row(ORIGIN_ATTRS);
+            for (uint32_t id = 0; id < num_origins; ++id) {
+                if (id < 100) f_txt << id;
+                for (uint32_t a = 0; a < ORIGIN_ATTRS; ++a) {
+                    uint64_t n_not_nulls = column_non_nulls(a, num_origins);
+                    float val;
+                    if (id < num_origins - n_not_nulls) {
+                        val = NAN;
+                        if (id < 100) f_txt << ",NA";
+                    } else {
+                        val = frand(0, 1000);
+                        if (id < 100) f_txt << "," << val;
+                    }
+                    row[a] = val;
                 }
+                writer.write(&id, 4);
+                writer.write(row.data(), row.size() * 4);
+                if (id < 100) f_txt << "\n";
             }
-            if (id < 100) f_txt << "\n";
+            if (!writer.flush()) return 1;
         }
         origin_rows = num_origins;
         uint64_t origin_cells = uint64_t(num_origins) * (1 + ORIGIN_ATTRS);
@@ -114,6 +451,7 @@ int main(int argc, char** argv) {
         cout << "Origin file created: " << bin_path << endl;
         cout << "  Rows: " << num_origins << ", Columns: " << (1 + ORIGIN_ATTRS)
              << ", Bytes/cell: 4, Total: " << format_size(origin_bytes) << endl;
+        cout << "  Write throughput: " << write_stats(f_bin) << endl;
         
         // Generate origin report
         ofstream origin_report(origin_report_path);
@@ -127,7 +465,8 @@ int main(int argc, char** argv) {
         origin_report << "FILE INFORMATION:\n";
         origin_report << "  Binary file: origin_" << percent_str << ".bin\n";
         origin_report << "  Preview file: origin_preview_" << percent_str << ".txt\n";
-        origin_report << "  File size: " << format_size(origin_bytes) << " (" << origin_bytes << " bytes)\n\n";
+        origin_report << "  File size: " << format_size(origin_bytes) << " (" << origin_bytes << " bytes)\n";
+        origin_report << "  Write throughput: " << write_stats(f_bin) << "\n\n";
         
         origin_report << "TABLE STRUCTURE:\n";
         origin_report << "  Rows: " << origin_rows << "\n";
@@ -157,7 +496,9 @@ int main(int argc, char** argv) {
         origin_report << "DATA RANGES:\n";
         origin_report << "  ID values: 0 to " << (num_origins - 1) << "\n";
         origin_report << "  Attribute values (non-null): 0.0 to 1000.0\n";
-        origin_report << "  Random seed: 33\n\n";
+        origin_report << "  Random seed: 33\n";
+        origin_report << "  RNG: " << (parallel ? "counter-based splitmix64 keyed on (table, row, column)"
+                                         : "rand() sequential stream") << "\n\n";
         
         origin_report << "========================================\n";
         origin_report.close();
@@ -174,7 +515,9 @@ int main(int argc, char** argv) {
         string txt_path = outdir + "/destination_" + percent_str + "_preview.txt";
         string dest_report_path = outdir + "/destination_" + percent_str + "_report.txt";
         
-        ofstream f_bin(bin_path, ios::binary);
+        uint64_t row_size = 4 + uint64_t(DEST_ATTRS) * 4;
+        OutputFile f_bin;
+        if (!f_bin.open(bin_path, writer_opts, row_size * num_dests)) return 1;
         ofstream f_txt(txt_path);
 
         // Write header
@@ -184,26 +527,40 @@ int main(int argc, char** argv) {
         f_txt << "\n";
 
         // Write data
-        for (uint32_t id = 0; id < num_dests; ++id) {
-            f_bin.write((char*)&id, 4);
-            if (id < 100) f_txt << id;
-            for (uint32_t a = 0; a < DEST_ATTRS; ++a) {
-                float percent_non_null = (a == 100) ? 1.0f : (a < 100 ? a / 100.0f : 0.0f);
-                uint64_t n_not_nulls = uint64_t(ceil(percent_non_null * num_dests));
-                if (a >= 100) n_not_nulls = num_dests;
-                if (n_not_nulls > num_dests) n_not_nulls = num_dests;
-                float val;
-                if (id < num_dests - n_not_nulls) {
-                    val = NAN;
-                    f_bin.write((char*)&val, 4);
-                    if (id < 100) f_txt << ",NA";
-                } else {
-                    val = frand(0, 500);
-                    f_bin.write((char*)&val, 4);
-                    if (id < 100) f_txt << "," << val;
+        if (parallel) {
+            if (!generate_attribute_table_parallel(f_bin, RNG_DEST, num_dests, DEST_ATTRS, 500, n_threads))
+                return 1;
+            for (uint32_t id = 0; id < min(num_dests, 100u); ++id) {
+                f_txt << id;
+                for (uint32_t a = 0; a < DEST_ATTRS; ++a) {
+                    float val = counter_attr_value(RNG_DEST, id, a, num_dests, 500);
+                    if (isnan(val)) f_txt << ",NA";
+                    else f_txt << "," << val;
                 }
+                f_txt << "\n";
             }
-            if (id < 100) f_txt << "\n";
+        } else {
+            StreamWriter writer(f_bin);
+            vector<float> row(DEST_ATTRS);
+            for (uint32_t id = 0; id < num_dests; ++id) {
+                if (id < 100) f_txt << id;
+                for (uint32_t a = 0; a < DEST_ATTRS; ++a) {
+                    uint64_t n_not_nulls = column_non_nulls(a, num_dests);
+                    float val;
+                    if (id < num_dests - n_not_nulls) {
+                        val = NAN;
+                        if (id < 100) f_txt << ",NA";
+                    } else {
+                        val = frand(0, 500);
+                        if (id < 100) f_txt << "," << val;
+                    }
+                    row[a] = val;
+                }
+                writer.write(&id, 4);
+                writer.write(row.data(), row.size() * 4);
+                if (id < 100) f_txt << "\n";
+            }
+            if (!writer.flush()) return 1;
         }
         dest_rows = num_dests;
         uint64_t dest_cells = uint64_t(num_dests) * (1 + DEST_ATTRS);
@@ -215,6 +572,7 @@ int main(int argc, char** argv) {
         cout << "Destination file created: " << bin_path << endl;
         cout << "  Rows: " << num_dests << ", Columns: " << (1 + DEST_ATTRS)
              << ", Bytes/cell: 4, Total: " << format_size(dest_bytes) << endl;
+        cout << "  Write throughput: " << write_stats(f_bin) << endl;
         
         // Generate destination report
         ofstream dest_report(dest_report_path);
@@ -228,7 +586,8 @@ int main(int argc, char** argv) {
         dest_report << "FILE INFORMATION:\n";
         dest_report << "  Binary file: destination_" << percent_str << ".bin\n";
         dest_report << "  Preview file: destination_preview_" << percent_str << ".txt\n";
-        dest_report << "  File size: " << format_size(dest_bytes) << " (" << dest_bytes << " bytes)\n\n";
+        dest_report << "  File size: " << format_size(dest_bytes) << " (" << dest_bytes << " bytes)\n";
+        dest_report << "  Write throughput: " << write_stats(f_bin) << "\n\n";
         
         dest_report << "TABLE STRUCTURE:\n";
         dest_report << "  Rows: " << dest_rows << "\n";
@@ -258,7 +617,9 @@ int main(int argc, char** argv) {
         dest_report << "DATA RANGES:\n";
         dest_report << "  ID values: 0 to " << (num_dests - 1) << "\n";
         dest_report << "  Attribute values (non-null): 0.0 to 500.0\n";
-        dest_report << "  Random seed: 33\n\n";
+        dest_report << "  Random seed: 33\n";
+        dest_report << "  RNG: " << (parallel ? "counter-based splitmix64 keyed on (table, row, column)"
+                                         : "rand() sequential stream") << "\n\n";
         
         dest_report << "========================================\n";
         dest_report.close();
@@ -275,7 +636,9 @@ int main(int argc, char** argv) {
         string txt_path = outdir + "/accessibility_" + percent_str + "_preview.txt";
         string acc_report_path = outdir + "/accessibility_" + percent_str + "_report.txt";
         
-        ofstream f_bin(bin_path, ios::binary);
+        OutputFile f_bin;
+        if (!f_bin.open(bin_path, writer_opts, uint64_t(num_origins) * num_dests * sizeof(Accessibility)))
+            return 1;
         ofstream f_txt(txt_path);
 
         // Write header
@@ -284,23 +647,36 @@ int main(int argc, char** argv) {
         uint64_t total_pairs = 0;
 
         // Write data
-        for (uint32_t o = 0; o < num_origins; ++o) {
-            for (uint32_t d = 0; d < num_dests; ++d) {
-                Accessibility a;
-                a.origin_id = o;
-                a.destination_id = d;
-                a.time = (o == d) ? 0.0f : frand(1, 120);
-                a.distance = (o == d) ? 0.0f : frand(0.5, 50.0);
-
-                f_bin.write((char*)&a, sizeof(a));
-
-                // Only log first 100 lines for preview
-                if (total_pairs < 100)
-                    f_txt << a.origin_id << "," << a.destination_id << ","
-                          << a.time << "," << a.distance << "\n";
-
-                total_pairs++;
+        if (parallel) {
+            if (!generate_accessibility_parallel(f_bin, num_origins, num_dests, n_threads))
+                return 1;
+            total_pairs = uint64_t(num_origins) * num_dests;
+            for (uint64_t i = 0; i < min<uint64_t>(total_pairs, 100); ++i) {
+                Accessibility a = counter_accessibility(i / num_dests, i % num_dests);
+                f_txt << a.origin_id << "," << a.destination_id << ","
+                      << a.time << "," << a.distance << "\n";
+            }
+        } else {
+            StreamWriter writer(f_bin);
+            for (uint32_t o = 0; o < num_origins; ++o) {
+                for (uint32_t d = 0; d < num_dests; ++d) {
+                    Accessibility a;
+                    a.origin_id = o;
+                    a.destination_id = d;
+                    a.time = (o == d) ? 0.0f : frand(1, 120);
+                    a.distance = (o == d) ? 0.0f : frand(0.5, 50.0);
+
+                    writer.write(&a, sizeof(a));
+
+                    // Only log first 100 lines for preview
+                    if (total_pairs < 100)
+                        f_txt << a.origin_id << "," << a.destination_id << ","
+                              << a.time << "," << a.distance << "\n";
+
+                    total_pairs++;
+                }
             }
+            if (!writer.flush()) return 1;
         }
         acc_rows = total_pairs;
         uint64_t acc_cols = 4;
@@ -314,6 +690,7 @@ int main(int argc, char** argv) {
         cout << "  Rows: " << acc_rows << ", Columns: " << acc_cols
              << ", Bytes/cell: " << (acc_bytes_per_row / acc_cols)
              << ", Total: " << format_size(acc_bytes) << endl;
+        cout << "  Write throughput: " << write_stats(f_bin) << endl;
         
         // Generate accessibility report
         ofstream acc_report(acc_report_path);
@@ -327,7 +704,8 @@ int main(int argc, char** argv) {
         acc_report << "FILE INFORMATION:\n";
         acc_report << "  Binary file: accessibility_" << percent_str << ".bin\n";
         acc_report << "  Preview file: accessibility_preview_" << percent_str << ".txt\n";
-        acc_report << "  File size: " << format_size(acc_bytes) << " (" << acc_bytes << " bytes)\n\n";
+        acc_report << "  File size: " << format_size(acc_bytes) << " (" << acc_bytes << " bytes)\n";
+        acc_report << "  Write throughput: " << write_stats(f_bin) << "\n\n";
         
         acc_report << "TABLE STRUCTURE:\n";
         acc_report << "  Rows: " << acc_rows << " (full cartesian product)\n";
@@ -362,7 +740,9 @@ int main(int argc, char** argv) {
         acc_report << "  destination_id: 0 to " << (num_dests - 1) << "\n";
         acc_report << "  time: 0.0 to 120.0 (0.0 when origin == destination)\n";
         acc_report << "  distance: 0.0 to 50.0 (0.0 when origin == destination)\n";
-        acc_report << "  Random seed: 33\n\n";
+        acc_report << "  Random seed: 33\n";
+        acc_report << "  RNG: " << (parallel ? "counter-based splitmix64 keyed on (table, row, column)"
+                                         : "rand() sequential stream") << "\n\n";
         
         acc_report << "SPECIAL CASES:\n";
         acc_report << "  When origin_id == destination_id:\n";
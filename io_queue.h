@@ -0,0 +1,280 @@
+#pragma once
+// ===============================================
+// ASYNCHRONOUS WRITE QUEUE
+// ===============================================
+// Positional writes that complete in the background, so a StreamWriter can
+// fill its next buffer while the previous one is on its way to disk. Engines:
+//   uring    io_uring driven through raw syscalls (no liburing); SQEs are
+//            flagged IOSQE_ASYNC so buffered writes never run inline in the
+//            submitting thread, and one completion thread reaps the CQ ring
+//   threads  a few I/O threads calling pwrite()
+// IoQueue::create() falls back from uring to threads when io_uring_setup is
+// refused (old kernel, seccomp, kernel.io_uring_disabled).
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+constexpr unsigned IO_QUEUE_DEFAULT_DEPTH = 64;    // writes in flight
+constexpr unsigned IO_QUEUE_DEFAULT_THREADS = 4;   // threads engine
+constexpr size_t IO_QUEUE_MAX_WRITE = 1u << 30;    // io_uring lengths are 32-bit
+
+enum class IoEngine { Sync, Uring, Threads };
+
+inline const char* io_engine_name(IoEngine e) {
+    switch (e) {
+        case IoEngine::Uring: return "uring";
+        case IoEngine::Threads: return "threads";
+        default: return "sync";
+    }
+}
+
+inline bool parse_io_engine(const std::string& s, IoEngine& e) {
+    if (s == "sync") e = IoEngine::Sync;
+    else if (s == "uring") e = IoEngine::Uring;
+    else if (s == "threads") e = IoEngine::Threads;
+    else return false;
+    return true;
+}
+
+// pwrite() the whole buffer, retrying on short writes
+inline bool pwrite_all(int fd, const char* data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Writes submitted under one ticket (typically one buffer). Both fields are
+// guarded by the queue's mutex.
+struct WriteTicket {
+    uint32_t pending = 0;
+    bool ok = true;
+};
+
+class IoQueue {
+public:
+    // Returns nullptr for IoEngine::Sync
+    static std::unique_ptr<IoQueue> create(IoEngine engine, unsigned depth = IO_QUEUE_DEFAULT_DEPTH,
+                                           unsigned threads = IO_QUEUE_DEFAULT_THREADS) {
+        if (engine == IoEngine::Sync) return nullptr;
+        std::unique_ptr<IoQueue> q(new IoQueue());
+        q->depth_ = std::max(1u, depth);
+        if (engine == IoEngine::Uring && q->setup_uring()) {
+            q->engine_ = IoEngine::Uring;
+            q->workers_.emplace_back([p = q.get()] { p->reap_uring(); });
+        } else {
+            q->engine_ = IoEngine::Threads;
+            for (unsigned i = 0; i < std::max(1u, threads); ++i)
+                q->workers_.emplace_back([p = q.get()] { p->run_worker(); });
+        }
+        return q;
+    }
+
+    IoQueue(const IoQueue&) = delete;
+    IoQueue& operator=(const IoQueue&) = delete;
+    ~IoQueue() {
+        if (engine_ == IoEngine::Uring) {
+            push_sqe(IORING_OP_NOP, -1, nullptr, 0, 0, 0);  // user_data 0 stops the reaper
+        } else {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+            work_.notify_all();
+        }
+        for (auto& t : workers_) t.join();
+        if (ring_fd_ >= 0) {
+            if (sqes_) munmap(sqes_, sqes_bytes_);
+            if (cq_ring_ && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_bytes_);
+            if (sq_ring_) munmap(sq_ring_, sq_ring_bytes_);
+            close(ring_fd_);
+        }
+    }
+
+    IoEngine engine() const { return engine_; }
+    unsigned depth() const { return depth_; }
+
+    // Queues pwrite(fd, data, len, offset). data must stay untouched until
+    // wait(ticket) returns. Blocks while depth() writes are in flight.
+    void submit(int fd, const char* data, size_t len, uint64_t offset, WriteTicket& ticket) {
+        while (len > 0) {
+            size_t n = std::min(len, IO_QUEUE_MAX_WRITE);
+            Request* r = new Request{fd, data, n, offset, &ticket};
+            {
+                std::unique_lock<std::mutex> lk(mu_);
+                done_.wait(lk, [&] { return inflight_ < depth_; });
+                inflight_++;
+                ticket.pending++;
+                if (engine_ == IoEngine::Threads) {
+                    requests_.push_back(r);
+                    work_.notify_one();
+                }
+            }
+            if (engine_ == IoEngine::Uring && !push_sqe(IORING_OP_WRITE, fd, data, n, offset, uint64_t(r)))
+                finish(r, pwrite_all(fd, data, n, offset));  // ring unusable: write it here
+            data += n;
+            len -= n;
+            offset += n;
+        }
+    }
+
+    // Blocks until every write of the ticket completed; false if any failed
+    bool wait(WriteTicket& ticket) {
+        std::unique_lock<std::mutex> lk(mu_);
+        done_.wait(lk, [&] { return ticket.pending == 0; });
+        return ticket.ok;
+    }
+
+private:
+    struct Request {
+        int fd;
+        const char* data;
+        size_t len;
+        uint64_t offset;
+        WriteTicket* ticket;
+    };
+
+    IoQueue() = default;
+
+    void finish(Request* r, bool ok) {
+        std::lock_guard<std::mutex> lk(mu_);
+        r->ticket->ok = r->ticket->ok && ok;
+        r->ticket->pending--;
+        inflight_--;
+        done_.notify_all();
+        delete r;
+    }
+
+    // --- threads engine ---
+    void run_worker() {
+        for (;;) {
+            Request* r;
+            {
+                std::unique_lock<std::mutex> lk(mu_);
+                work_.wait(lk, [&] { return stop_ || !requests_.empty(); });
+                if (requests_.empty()) return;
+                r = requests_.front();
+                requests_.pop_front();
+            }
+            finish(r, pwrite_all(r->fd, r->data, r->len, r->offset));
+        }
+    }
+
+    // --- uring engine ---
+    static int enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+    }
+
+    bool setup_uring() {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        ring_fd_ = syscall(__NR_io_uring_setup, depth_, &p);
+        if (ring_fd_ < 0) return false;
+        sq_ring_bytes_ = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        cq_ring_bytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_ring_bytes_ = cq_ring_bytes_ = std::max(sq_ring_bytes_, cq_ring_bytes_);
+        auto map = [&](size_t bytes, off_t off) -> char* {
+            void* m = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, off);
+            return m == MAP_FAILED ? nullptr : static_cast<char*>(m);
+        };
+        sq_ring_ = map(sq_ring_bytes_, IORING_OFF_SQ_RING);
+        cq_ring_ = single ? sq_ring_ : map(cq_ring_bytes_, IORING_OFF_CQ_RING);
+        sqes_bytes_ = p.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = reinterpret_cast<io_uring_sqe*>(map(sqes_bytes_, IORING_OFF_SQES));
+        if (!sq_ring_ || !cq_ring_ || !sqes_) return false;  // the destructor unmaps what was mapped
+        sq_tail_ = reinterpret_cast<uint32_t*>(sq_ring_ + p.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<uint32_t*>(sq_ring_ + p.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<uint32_t*>(sq_ring_ + p.sq_off.array);
+        cq_head_ = reinterpret_cast<uint32_t*>(cq_ring_ + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<uint32_t*>(cq_ring_ + p.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<uint32_t*>(cq_ring_ + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq_ring_ + p.cq_off.cqes);
+        // inflight_ <= depth_ <= sq_entries, so the SQ never overflows
+        depth_ = std::min(depth_, p.sq_entries);
+        return true;
+    }
+
+    bool push_sqe(uint8_t op, int fd, const char* data, size_t len, uint64_t offset, uint64_t user_data) {
+        std::lock_guard<std::mutex> lk(sq_mu_);
+        uint32_t tail = *sq_tail_;
+        uint32_t idx = tail & sq_mask_;
+        io_uring_sqe& sqe = sqes_[idx];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = op;
+        sqe.flags = IOSQE_ASYNC;
+        sqe.fd = fd;
+        sqe.addr = uint64_t(data);
+        sqe.len = uint32_t(len);
+        sqe.off = offset;
+        sqe.user_data = user_data;
+        sq_array_[idx] = idx;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        for (;;) {
+            int n = enter(ring_fd_, 1, 0, 0);
+            if (n >= 0) return true;
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) break;
+        }
+        __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);  // take the entry back
+        return false;
+    }
+
+    void reap_uring() {
+        for (;;) {
+            uint32_t head = *cq_head_;
+            uint32_t tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            if (head == tail) {
+                enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+                continue;
+            }
+            bool stop = false;
+            for (; head != tail; ++head) {
+                const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+                Request* r = reinterpret_cast<Request*>(cqe.user_data);
+                if (!r) {
+                    stop = true;
+                    continue;
+                }
+                // Short or failed write: finish the rest synchronously
+                size_t done = cqe.res > 0 ? size_t(cqe.res) : 0;
+                bool ok = cqe.res >= 0 || cqe.res == -EAGAIN || cqe.res == -EINTR;
+                if (ok && done < r->len) ok = pwrite_all(r->fd, r->data + done, r->len - done, r->offset + done);
+                finish(r, ok);
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            if (stop) return;
+        }
+    }
+
+    IoEngine engine_ = IoEngine::Threads;
+    unsigned depth_ = IO_QUEUE_DEFAULT_DEPTH;
+    std::mutex mu_;
+    std::condition_variable done_, work_;
+    unsigned inflight_ = 0;
+    bool stop_ = false;
+    std::deque<Request*> requests_;
+    std::vector<std::thread> workers_;
+    // io_uring rings
+    int ring_fd_ = -1;
+    std::mutex sq_mu_;
+    char *sq_ring_ = nullptr, *cq_ring_ = nullptr;
+    size_t sq_ring_bytes_ = 0, cq_ring_bytes_ = 0, sqes_bytes_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    uint32_t *sq_tail_ = nullptr, *sq_array_ = nullptr, *cq_head_ = nullptr, *cq_tail_ = nullptr;
+    uint32_t sq_mask_ = 0, cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+};
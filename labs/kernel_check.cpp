@@ -0,0 +1,148 @@
+#include <bits/stdc++.h>
+#include "../filter_kernels.h"
+#include "../codecs.h"
+using namespace std;
+
+// Runs every vector kernel this CPU supports on random inputs and compares
+// its output with the scalar kernel's: the filter kernels (columns with
+// explicit and dense origins, rows, swapped runs and two-sided tile rows) and
+// the codec kernels (bit unpacking at every width, prefix sum). Exits with 1
+// at the first mismatch.
+
+struct Failure {
+    string what;
+};
+
+static void expect(bool ok, const string& what) {
+    if (!ok) throw Failure{what};
+}
+
+static bool same_records(const vector<Accessibility>& a, size_t na, const vector<Accessibility>& b, size_t nb) {
+    return na == nb && memcmp(a.data(), b.data(), na * sizeof(Accessibility)) == 0;
+}
+
+int main(int argc, char** argv) {
+    int cases = argc > 1 ? atoi(argv[1]) : 2000;
+    if (cases <= 0) {
+        cerr << "Usage: ./kernel_check [cases]\n";
+        return 1;
+    }
+    using namespace filter_detail;
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2"), avx512 = __builtin_cpu_supports("avx512f");
+    cout << "CPU: avx2 " << (avx2 ? "yes" : "no") << ", avx512f " << (avx512 ? "yes" : "no") << endl;
+    cout << "Dispatched: filter " << filter_kernels().name << ", codecs " << codec_kernels().name << endl;
+
+    struct ColumnsKernel {
+        const char* name;
+        FilterColumnsFn fn;
+        bool supported;
+    };
+    struct RowsKernel {
+        const char* name;
+        FilterRowsFn fn;
+        bool supported;
+    };
+    const ColumnsKernel columns[] = {{"avx2", filter_columns_avx2, avx2}, {"avx512", filter_columns_avx512, avx512}};
+    const RowsKernel rows_kernels[] = {{"avx2", filter_rows_avx2, avx2}, {"avx512", filter_rows_avx512, avx512}};
+
+    mt19937 rng(12345);
+    map<string, uint64_t> checked;
+    try {
+        for (int c = 0; c < cases; ++c) {
+            // Probe sets over [0, limit); IDs go past the limit and up to UINT32_MAX
+            uint32_t limit = rng() % 5000 + 1;
+            vector<uint32_t> origins, dests;
+            for (uint32_t i = 0; i < limit; ++i) {
+                if (rng() % 3 == 0) origins.push_back(i);
+                if (rng() % 2 == 0) dests.push_back(i);
+            }
+            DenseBitmap originSet(RoaringBitmap::from_sorted(origins.data(), origins.size()));
+            DenseBitmap destSet(RoaringBitmap::from_sorted(dests.data(), dests.size()));
+            AccPredicate pred;
+            if (c % 2) {
+                pred.time_min = 10;
+                pred.time_max = 50;
+                pred.distance_min = 5;
+            }
+            // Lengths around the vector widths, and some past a filter batch
+            size_t n = c % 50 == 0 ? rng() % (2 * FILTER_BATCH) : rng() % 300;
+            uint32_t run_id = rng() % limit, first_origin = rng() % limit;
+            vector<uint32_t> other(n);
+            vector<float> time(n), distance(n);
+            vector<Accessibility> rows(n), tile(n);
+            for (size_t k = 0; k < n; ++k) {
+                other[k] = k % 50 == 7 ? UINT32_MAX - uint32_t(k) : rng() % (limit + 200);
+                time[k] = float(rng() % 60);
+                distance[k] = k % 97 == 0 ? NAN : float(rng() % 60);
+                rows[k] = {other[k], run_id, time[k], distance[k]};
+                tile[k] = {other[k], uint32_t(rng() % (limit + 100)), time[k], distance[k]};
+            }
+            RunFilter run = make_run_filter(originSet, pred, run_id, c % 3 == 0);
+            RunFilter tiles = make_tile_filter(originSet, destSet, pred);
+
+            vector<Accessibility> expected(n + FILTER_SLACK), got(n + FILTER_SLACK);
+            for (bool dense : {false, true}) {
+                const uint32_t* ids = dense ? nullptr : other.data();
+                string shape = dense ? "dense columns" : "columns";
+                size_t ne = filter_columns_scalar(run, ids, first_origin, time.data(), distance.data(), n,
+                                                  expected.data());
+                for (const ColumnsKernel& k : columns) {
+                    if (!k.supported) continue;
+                    size_t ng = k.fn(run, ids, first_origin, time.data(), distance.data(), n, got.data());
+                    expect(same_records(expected, ne, got, ng),
+                           string(k.name) + " " + shape + ", case " + to_string(c) + ", n " + to_string(n));
+                    checked[string(k.name) + " " + shape]++;
+                }
+            }
+            auto check_rows = [&](const string& shape, const RunFilter& f, const vector<Accessibility>& in) {
+                size_t ne = filter_rows_scalar(f, in.data(), n, expected.data());
+                for (const RowsKernel& k : rows_kernels) {
+                    if (!k.supported) continue;
+                    size_t ng = k.fn(f, in.data(), n, got.data());
+                    expect(same_records(expected, ne, got, ng),
+                           string(k.name) + " " + shape + ", case " + to_string(c) + ", n " + to_string(n));
+                    checked[string(k.name) + " " + shape]++;
+                }
+            };
+            check_rows("rows", run, rows);
+            check_rows("tile rows", tiles, tile);
+
+            // Bit unpacking: every width, random bases and lengths
+            uint32_t bits = c % 33;
+            size_t m = rng() % 1000;
+            uint32_t base = rng(), mask = bits == 32 ? UINT32_MAX : (uint32_t(1) << bits) - 1;
+            vector<uint32_t> values(m);
+            for (uint32_t& v : values) v = base + (rng() & mask);
+            vector<uint8_t> packed(packed_bytes(m, bits), 0);
+            bitpack(values.data(), m, base, bits, packed.data());
+            vector<uint32_t> unpacked(m);
+            unpack_scalar(packed.data(), bits, m, base, unpacked.data());
+            expect(unpacked == values, "scalar unpack, bits " + to_string(bits));
+            for (auto [name, fn, supported] : {tuple<const char*, UnpackFn, bool>{"avx2", unpack_avx2, avx2},
+                                               {"avx512", unpack_avx512, avx512}}) {
+                if (!supported) continue;
+                fill(unpacked.begin(), unpacked.end(), 0);
+                fn(packed.data(), bits, m, base, unpacked.data());
+                expect(unpacked == values, string(name) + " unpack, bits " + to_string(bits) + ", n " + to_string(m));
+                checked[string(name) + " unpack"]++;
+            }
+
+            // Prefix sum (wrapping like the scalar kernel)
+            vector<uint32_t> sums(values), vsums(values);
+            prefix_sum_scalar(sums.data(), m);
+            if (avx2) {
+                prefix_sum_avx2(vsums.data(), m);
+                expect(vsums == sums, "avx2 prefix sum, n " + to_string(m));
+                checked["avx2 prefix sum"]++;
+            }
+        }
+    } catch (const Failure& f) {
+        cerr << "MISMATCH: " << f.what << " differs from the scalar kernel" << endl;
+        return 1;
+    }
+    for (const auto& [name, n] : checked) cout << "  " << name << ": " << n << " cases match scalar" << endl;
+    if (checked.empty()) cout << "  (no vector kernels on this CPU)" << endl;
+    cout << "All kernels match." << endl;
+    return 0;
+}
@@ -6,6 +6,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include "../thread_pool.h"
 using namespace std;
 
 // Accessibility record structure
@@ -157,8 +158,7 @@ int main(int argc, char** argv) {
         // Phase 1: Read and count all records (no operation)
         auto t_phase1_start = chrono::steady_clock::now();
         size_t total_count1 = 0;
-        size_t num_threads = thread::hardware_concurrency();
-        vector<thread> threads1;
+        ThreadPool& workers = ThreadPool::shared();
         mutex count_mutex1;
 
         auto process_dest_range1 = [&](size_t start, size_t end) {
@@ -175,14 +175,7 @@ int main(int argc, char** argv) {
         };
 
         size_t total = dest_ids.size();
-        size_t chunk = (total + num_threads - 1) / num_threads;
-        for (size_t t = 0; t < num_threads; ++t) {
-            size_t start = t * chunk;
-            size_t end = min(start + chunk, total);
-            if (start >= end) break;
-            threads1.emplace_back(process_dest_range1, start, end);
-        }
-        for (auto& th : threads1) th.join();
+        workers.parallel_for(total, workers.grain_for(total), process_dest_range1);
 
         auto t_phase1_end = chrono::steady_clock::now();
         cout << "[Phase 1] Total records counted: " << total_count1 << endl;
@@ -193,7 +186,6 @@ int main(int argc, char** argv) {
         auto t_phase2_start = chrono::steady_clock::now();
         size_t total_count2 = 0;
         size_t found_count = 0;
-        vector<thread> threads2;
         mutex count_mutex2;
 
         auto process_dest_range2 = [&](size_t start, size_t end) {
@@ -216,13 +208,7 @@ int main(int argc, char** argv) {
             found_count += local_found;
         };
 
-        for (size_t t = 0; t < num_threads; ++t) {
-            size_t start = t * chunk;
-            size_t end = min(start + chunk, total);
-            if (start >= end) break;
-            threads2.emplace_back(process_dest_range2, start, end);
-        }
-        for (auto& th : threads2) th.join();
+        workers.parallel_for(total, workers.grain_for(total), process_dest_range2);
 
         auto t_phase2_end = chrono::steady_clock::now();
         cout << "[Phase 2] Total records counted: " << total_count2 << endl;
@@ -6,6 +6,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include "../thread_pool.h"
 using namespace std;
 
 // Accessibility record structure
@@ -161,8 +162,7 @@ int main(int argc, char** argv) {
         // Count all records for selected destinations and origins
         auto t_count_start = chrono::steady_clock::now();
         size_t total_count = 0;
-        size_t num_threads = thread::hardware_concurrency();
-        vector<thread> threads;
+        ThreadPool& workers = ThreadPool::shared();
         mutex count_mutex;
 
         auto process_dest_range = [&](size_t start, size_t end) {
@@ -183,14 +183,7 @@ int main(int argc, char** argv) {
         };
 
         size_t total = selected_dest_ids.size();
-        size_t chunk = (total + num_threads - 1) / num_threads;
-        for (size_t t = 0; t < num_threads; ++t) {
-            size_t start = t * chunk;
-            size_t end = min(start + chunk, total);
-            if (start >= end) break;
-            threads.emplace_back(process_dest_range, start, end);
-        }
-        for (auto& th : threads) th.join();
+        workers.parallel_for(total, workers.grain_for(total), process_dest_range);
 
         auto t_count_end = chrono::steady_clock::now();
         cout << "Total records counted (origin & destination match): " << total_count << endl;
@@ -3,101 +3,702 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <immintrin.h>
+#include <sys/resource.h>
+#include "block_autotune.h"
+#include "dataset_container.h"
+#include "dataset_format.h"
 using namespace std;
 
+// Thread-safe console output
+mutex cout_mutex;
+void thread_safe_print(const string& msg) {
+    lock_guard<mutex> lock(cout_mutex);
+    cout << msg << flush;
+}
+
+// Row chunk read per step when streaming the attribute tables
+constexpr size_t ATTR_READ_CHUNK_BYTES = 64 * 1024 * 1024;  // 64 MB
+
 // ===============================================
-// SCHEMA PARAMETERS (IMMUTABLE)
+// NaN COMPACTION KERNELS
 // ===============================================
-// These values define the fundamental binary file structure.
-// They MUST be known beforehand and cannot be auto-calculated
-// from file size due to the unreliability of inferring binary
-// formats at runtime.
-constexpr uint32_t ORIGIN_ATTRS = 5000;
-constexpr uint32_t DEST_ATTRS   = 2000;
+// Write the (id, value) pairs of the non-NaN entries of vals[0..n) to out and
+// return how many were kept. Kernels may write up to COMPACT_SLACK pairs past
+// the returned count, so output buffers carry that much extra room.
+constexpr size_t COMPACT_SLACK = 16;
+using CompactFn = size_t (*)(const uint32_t* ids, const float* vals, size_t n, AttrValue* out);
+
+size_t compact_non_nan_scalar(const uint32_t* ids, const float* vals, size_t n, AttrValue* out) {
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i) {
+        out[k] = {ids[i], vals[i]};
+        k += !isnan(vals[i]);
+    }
+    return k;
+}
+
+__attribute__((target("avx2")))
+size_t compact_non_nan_avx2(const uint32_t* ids, const float* vals, size_t n, AttrValue* out) {
+    // Lane permutation moving the kept (id, value) pairs of a 4-bit mask to the front
+    static const auto lut = []() {
+        array<array<uint32_t, 8>, 16> t{};
+        for (int m = 0; m < 16; ++m) {
+            int j = 0;
+            for (int b = 0; b < 4; ++b) {
+                if (m >> b & 1) {
+                    t[m][2 * j] = 2 * b;
+                    t[m][2 * j + 1] = 2 * b + 1;
+                    ++j;
+                }
+            }
+        }
+        return t;
+    }();
+    size_t k = 0, i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(vals + i);
+        __m128i id = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ids + i));
+        int m = _mm_movemask_ps(_mm_cmp_ps(v, v, _CMP_ORD_Q));
+        __m256i pairs = _mm256_set_m128i(_mm_unpackhi_epi32(id, _mm_castps_si128(v)),
+                                         _mm_unpacklo_epi32(id, _mm_castps_si128(v)));
+        __m256i perm = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lut[m].data()));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + k), _mm256_permutevar8x32_epi32(pairs, perm));
+        k += __builtin_popcount(m);
+    }
+    return k + compact_non_nan_scalar(ids + i, vals + i, n - i, out + k);
+}
+
+// The widening and extract intrinsics pass an undefined register that GCC 12
+// flags at -O2 -Wall
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+size_t compact_non_nan_avx512(const uint32_t* ids, const float* vals, size_t n, AttrValue* out) {
+    size_t k = 0, i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_castps_si512(_mm512_loadu_ps(vals + i));
+        __m512i id = _mm512_loadu_si512(ids + i);
+        __mmask16 m = _mm512_cmp_ps_mask(_mm512_castsi512_ps(v), _mm512_castsi512_ps(v), _CMP_ORD_Q);
+        // 64-bit lanes holding one pair each: id in the low half, value bits in the high half
+        __m512i lo = _mm512_or_si512(_mm512_cvtepu32_epi64(_mm512_castsi512_si256(id)),
+                                     _mm512_slli_epi64(_mm512_cvtepu32_epi64(_mm512_castsi512_si256(v)), 32));
+        __m512i hi = _mm512_or_si512(_mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(id, 1)),
+                                     _mm512_slli_epi64(_mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(v, 1)), 32));
+        __mmask8 mlo = m & 0xFF, mhi = m >> 8;
+        _mm512_storeu_si512(out + k, _mm512_maskz_compress_epi64(mlo, lo));
+        k += __builtin_popcount(mlo);
+        _mm512_storeu_si512(out + k, _mm512_maskz_compress_epi64(mhi, hi));
+        k += __builtin_popcount(mhi);
+    }
+    return k + compact_non_nan_scalar(ids + i, vals + i, n - i, out + k);
+}
+#pragma GCC diagnostic pop
+
+// Picks the widest kernel the CPU supports
+CompactFn select_compact_kernel(string& name) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) { name = "avx512"; return compact_non_nan_avx512; }
+    if (__builtin_cpu_supports("avx2")) { name = "avx2"; return compact_non_nan_avx2; }
+    name = "scalar";
+    return compact_non_nan_scalar;
+}
 
 // ===============================================
-// OPTIMAL BLOCK SIZES FOR I/O EFFICIENCY
+// CACHE-BLOCKED TRANSPOSE
 // ===============================================
-// Targets chosen for Linux x64 I/O performance optimization
-constexpr size_t TARGET_DEST_ATTR_BLOCK_SIZE_BYTES   = 8 * 1024 * 1024;    // 8 MB
-constexpr size_t TARGET_ORIGIN_ATTR_BLOCK_SIZE_BYTES = 32 * 1024 * 1024;   // 32 MB
-constexpr size_t TARGET_ACC_BLOCK_SIZE_BYTES         = 256 * 1024 * 1024;  // 256 MB
-
-struct Accessibility {
-    uint32_t origin_id;
-    uint32_t destination_id;
-    float time;
-    float distance;
-};
+// Output run of one attribute. Room for every row is reserved upfront; pages
+// that are never written stay virtual, so sparse attributes cost little.
+// A mapped column points at its exact-sized run in an output block
+// (MappedAttributeTable), so cells are staged and copied without slack.
+struct AttrColumn {
+    AttrValue* data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
 
-struct AttributeIndex {
-    uint32_t block_id;
-    uint64_t offset;
-    uint32_t count;
-};
+    AttrColumn() = default;
+    AttrColumn(const AttrColumn&) = delete;
+    AttrColumn& operator=(const AttrColumn&) = delete;
+    ~AttrColumn() {
+        if (!mapped) free(data);
+    }
 
-struct AccessibilityDestIndex {
-    uint32_t destination_id;
-    uint32_t block_id;
-    uint64_t offset;
-    uint32_t count;
+    bool reserve(size_t rows) {
+        data = static_cast<AttrValue*>(malloc((rows + COMPACT_SLACK) * sizeof(AttrValue)));
+        return data != nullptr;
+    }
 };
 
-struct AccIndexEntry {
-    uint32_t id;        // destination_id
-    uint32_t block_id;
-    uint64_t offset;
-    uint32_t count;
+// Tile of rows x attributes transposed at once (512 x 128 floats = 256 KB, fits L2)
+constexpr uint32_t TRANSPOSE_TILE_ROWS  = 512;
+constexpr uint32_t TRANSPOSE_TILE_ATTRS = 128;
+
+// Transposes attributes [a_begin, a_end) of `n_rows` consecutive rows tile by tile
+// and appends their non-null cells to out[a - a0]
+void transpose_attribute_tiles(const char* rows, uint32_t n_rows, uint64_t row_size, uint32_t a_begin,
+                               uint32_t a_end, uint32_t a0, vector<AttrColumn>& out, CompactFn compact) {
+    vector<float> tile(size_t(TRANSPOSE_TILE_ATTRS) * TRANSPOSE_TILE_ROWS);
+    uint32_t ids[TRANSPOSE_TILE_ROWS];
+    vector<AttrValue> staged(TRANSPOSE_TILE_ROWS + COMPACT_SLACK);  // mapped columns
+    for (uint32_t r0 = 0; r0 < n_rows; r0 += TRANSPOSE_TILE_ROWS) {
+        uint32_t nr = min(TRANSPOSE_TILE_ROWS, n_rows - r0);
+        for (uint32_t i = 0; i < nr; ++i)
+            ids[i] = *reinterpret_cast<const uint32_t*>(rows + (r0 + i) * row_size);
+
+        for (uint32_t t0 = a_begin; t0 < a_end; t0 += TRANSPOSE_TILE_ATTRS) {
+            uint32_t na = min(TRANSPOSE_TILE_ATTRS, a_end - t0);
+            for (uint32_t i = 0; i < nr; ++i) {
+                const float* src = reinterpret_cast<const float*>(rows + (r0 + i) * row_size + 4) + t0;
+                for (uint32_t a = 0; a < na; ++a)
+                    tile[a * TRANSPOSE_TILE_ROWS + i] = src[a];
+            }
+            for (uint32_t a = 0; a < na; ++a) {
+                AttrColumn& col = out[t0 + a - a0];
+                if (col.mapped) {
+                    size_t k = compact(ids, &tile[a * TRANSPOSE_TILE_ROWS], nr, staged.data());
+                    copy(staged.begin(), staged.begin() + k, col.data + col.size);
+                    col.size += k;
+                } else {
+                    col.size += compact(ids, &tile[a * TRANSPOSE_TILE_ROWS], nr, col.data + col.size);
+                }
+            }
+        }
+    }
+}
+
+// Appends the non-null cells of attributes [a0, a1) of `n_rows` consecutive rows
+// ([uint32_t id][float att0]...) to out[a - a0]. Attributes are split across threads.
+void extract_attribute_range(const char* rows, uint32_t n_rows, uint64_t row_size, uint32_t a0, uint32_t a1,
+                             vector<AttrColumn>& out, unsigned n_threads, CompactFn compact) {
+    for_each_slice(a1 - a0, n_threads, [&](size_t begin, size_t end) {
+        transpose_attribute_tiles(rows, n_rows, row_size, a0 + begin, a0 + end, a0, out, compact);
+    });
+}
+
+// Adds the non-null cells of attributes [a0, a1) of `n_rows` consecutive rows to
+// counts[a - a0]: the layout pass of --mmap-output. Attributes are split across threads.
+void count_attribute_range(const char* rows, uint32_t n_rows, uint64_t row_size, uint32_t a0, uint32_t a1,
+                           vector<uint32_t>& counts, unsigned n_threads) {
+    for_each_slice(a1 - a0, n_threads, [&](size_t begin, size_t end) {
+        for (uint32_t r = 0; r < n_rows; ++r) {
+            const float* vals = reinterpret_cast<const float*>(rows + r * row_size + 4) + a0;
+            for (size_t a = begin; a < end; ++a) counts[a] += !isnan(vals[a]);
+        }
+    });
+}
+
+// ===============================================
+// DESTINATION PARTITIONING (COUNTING SORT)
+// ===============================================
+// Stable parallel counting sort of `in` by destination_id into `out`:
+// every thread histograms its own slice, a prefix sum over (destination,
+// thread) gives each thread its write cursors, and the slices are scattered
+// concurrently. Records keep their input (origin) order inside each run.
+// The same sort orders records by any small dense key (e.g. tile rank).
+// out_for(counts) receives the records per key and returns where the sorted
+// table goes, nullptr to abort (--mmap-output hands out the mapped blocks).
+struct DestinationKey {
+    uint32_t operator()(const Accessibility& a) const { return a.destination_id; }
 };
 
-// Thread-safe console output
-mutex cout_mutex;
-void thread_safe_print(const string& msg) {
-    lock_guard<mutex> lock(cout_mutex);
-    cout << msg << flush;
+template <typename Key, typename OutFor>
+bool partition_by_destination_into(const vector<Accessibility>& in, unsigned n_threads, Key key, OutFor out_for) {
+    size_t n = in.size();
+    size_t slice = (n + n_threads - 1) / max(1u, n_threads);
+    vector<vector<uint64_t>> hist(n_threads);
+
+    // One pool task per slice; slice t always owns hist[t]
+    auto for_each_slice = [&](auto fn) {
+        ThreadPool::shared().parallel_for(n_threads, 1, [&](size_t t0, size_t t1) {
+            for (size_t t = t0; t < t1; ++t) {
+                size_t begin = min(n, t * slice), end = min(n, begin + slice);
+                fn(unsigned(t), begin, end);
+            }
+        });
+    };
+
+    // 1. Histogram of each slice (grows to the largest destination_id seen)
+    for_each_slice([&](unsigned t, size_t begin, size_t end) {
+        auto& h = hist[t];
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t d = key(in[i]);
+            if (d >= h.size()) h.resize(d + 1, 0);
+            h[d]++;
+        }
+    });
+
+    // 2. Exclusive prefix sum in (destination, thread) order
+    size_t n_dests = 0;
+    for (const auto& h : hist) n_dests = max(n_dests, h.size());
+    for (auto& h : hist) h.resize(n_dests, 0);
+    vector<uint64_t> counts(n_dests, 0);
+    uint64_t running = 0;
+    for (size_t d = 0; d < n_dests; ++d) {
+        for (unsigned t = 0; t < n_threads; ++t) {
+            uint64_t c = hist[t][d];
+            hist[t][d] = running;
+            running += c;
+            counts[d] += c;
+        }
+    }
+
+    // 3. Scatter each slice through its own cursors
+    Accessibility* out = out_for(counts);
+    if (!out && n > 0) return false;
+    for_each_slice([&](unsigned t, size_t begin, size_t end) {
+        auto& cursor = hist[t];
+        for (size_t i = begin; i < end; ++i)
+            out[cursor[key(in[i])]++] = in[i];
+    });
+    return true;
+}
+
+template <typename Key = DestinationKey>
+void partition_by_destination(const vector<Accessibility>& in, vector<Accessibility>& out, unsigned n_threads,
+                              Key key = {}) {
+    partition_by_destination_into(in, n_threads, key, [&](const vector<uint64_t>&) {
+        out.resize(in.size());
+        return out.data();
+    });
+}
+
+// ===============================================
+// EXTERNAL-MEMORY DESTINATION PARTITIONING
+// ===============================================
+// Out-of-core variant of partition_by_destination for tables larger than the
+// memory budget. Pass 1 streams the input once to count records per
+// destination and cuts the destination space into ranges ("runs") whose
+// records fit the budget. Pass 2 streams the input again and appends every
+// record to its run file under <run_dir>. Each open file takes a buffer of at
+// least 64 KB and file descriptors, so only as many as the budget (and the
+// descriptor limit) allow are written at once. With more runs, the records
+// are first scattered to files of contiguous groups of runs, which are
+// scattered again (a recursive partition: few scans). Pass 3 loads one run at a time,
+// partitions it in memory and hands it to the block writer, so the output is
+// identical to the in-memory path. A single destination larger than a run is
+// already grouped and is streamed through in chunks.
+// Peak memory: about `budget` (one read chunk + run buffers, or one run
+// loaded twice + the writer buffer). Returns the number of runs, 0 on error.
+// swap_ids partitions by origin instead, for the origin-major copy; key and
+// the writer type select other groupings (tiles).
+template <typename Writer, typename Key = DestinationKey>
+uint32_t partition_by_destination_external(ifstream& f, uint64_t n_records, const string& run_dir, uint64_t budget,
+                                           unsigned n_threads, Writer& writer, IoQueue* queue, bool swap_ids,
+                                           Key key = {}) {
+    const uint64_t rec = sizeof(Accessibility);
+    uint64_t io_bytes = clamp<uint64_t>(budget / 8, 64 * 1024, ATTR_READ_CHUNK_BYTES) / rec * rec;
+    uint64_t room = budget > 2 * io_bytes ? budget - 2 * io_bytes : io_bytes;
+    uint64_t run_records = max<uint64_t>(1, room / (2 * rec));
+    vector<Accessibility> chunk(io_bytes / rec);
+
+    // Streams n records of in (from its start) through fn, chunk by chunk
+    auto for_each_chunk = [&](ifstream& in, uint64_t n_in, bool swap, auto fn) {
+        in.clear();
+        in.seekg(0);
+        for (uint64_t r = 0; r < n_in; r += chunk.size()) {
+            size_t n = min<uint64_t>(chunk.size(), n_in - r);
+            if (!in.read(reinterpret_cast<char*>(chunk.data()), n * rec)) return false;
+            if (swap) swap_accessibility_ids(chunk.data(), n);
+            fn(chunk.data(), n);
+        }
+        return true;
+    };
+
+    // Pass 1: records per destination
+    vector<uint64_t> count;
+    bool ok = for_each_chunk(f, n_records, swap_ids, [&](const Accessibility* a, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t d = key(a[i]);
+            if (d >= count.size()) count.resize(d + 1, 0);
+            count[d]++;
+        }
+    });
+    if (!ok) return 0;
+
+    // Cut [0, n_dests) into runs of at most run_records records
+    vector<uint32_t> run_of(count.size());
+    vector<uint64_t> run_size;
+    for (size_t d = 0; d < count.size(); ++d) {
+        if (run_size.empty() || (run_size.back() > 0 && run_size.back() + count[d] > run_records))
+            run_size.push_back(0);
+        run_of[d] = run_size.size() - 1;
+        run_size.back() += count[d];
+    }
+    uint32_t n_runs = run_size.size();
+
+    // Pass 2: scatter records to their run files. At most fan_out files are
+    // written per scan (a file may hold two descriptors, buffered and
+    // O_DIRECT). With more runs, a scan writes contiguous groups of runs to
+    // group files, and each group file is scattered again.
+    filesystem::create_directories(run_dir);
+    auto run_path = [&](uint32_t r) { return run_dir + "/run_" + to_string(r) + ".bin"; };
+    const uint64_t run_buffer = 64 * 1024;
+    uint64_t fd_room = 1024;
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur != RLIM_INFINITY)
+        fd_room = (nofile.rlim_cur - min<uint64_t>(nofile.rlim_cur / 2, 64)) / 2;
+    // Two files at least, or the groups would not shrink
+    uint32_t fan_out = uint32_t(clamp<uint64_t>(min(room / run_buffer, fd_room), 2, max<uint32_t>(n_runs, 2)));
+    uint32_t scans = 0;
+    for (uint64_t reach = 1; reach < n_runs; reach *= fan_out) scans++;
+    if (scans > 1)
+        thread_safe_print("Scattering " + to_string(n_runs) + " runs in " + to_string(scans) + " scans (" +
+                          to_string(fan_out) + " files open at a time)\n");
+    // Scatters n_in records of in, all of runs [first, last), into those runs
+    function<bool(ifstream&, uint64_t, bool, uint32_t, uint32_t)> scatter =
+        [&](ifstream& in, uint64_t n_in, bool swap, uint32_t first, uint32_t last) {
+            uint32_t span = (last - first + fan_out - 1) / fan_out;  // runs per output file
+            uint32_t outputs = (last - first + span - 1) / span;
+            auto group_path = [&](uint32_t g) {
+                return run_dir + "/group_" + to_string(first + g * span) + "_" + to_string(first + (g + 1) * span) + ".bin";
+            };
+            auto group_first = [&](uint32_t g) { return first + g * span; };
+            auto group_last = [&](uint32_t g) { return min(last, first + (g + 1) * span); };
+            vector<uint64_t> group_size(outputs, 0);
+            for (uint32_t r = first; r < last; ++r) group_size[(r - first) / span] += run_size[r];
+            {
+                WriterOptions run_opts;
+                run_opts.buffer_bytes = max(run_buffer, room / outputs);
+                run_opts.queue = queue;
+                vector<unique_ptr<OutputFile>> files(outputs);
+                vector<unique_ptr<StreamWriter>> writers(outputs);
+                for (uint32_t g = 0; g < outputs; ++g) {
+                    files[g] = make_unique<OutputFile>();
+                    string path = group_last(g) - group_first(g) == 1 ? run_path(group_first(g)) : group_path(g);
+                    if (!files[g]->open(path, run_opts, group_size[g] * rec)) return false;
+                    writers[g] = make_unique<StreamWriter>(*files[g]);
+                }
+                bool ok = for_each_chunk(in, n_in, swap, [&](const Accessibility* a, size_t n) {
+                    for (size_t i = 0; i < n; ++i) writers[(run_of[key(a[i])] - first) / span]->write(&a[i], rec);
+                });
+                for (auto& w : writers) ok = w->flush() && ok;
+                if (!ok) return false;
+            }
+            for (uint32_t g = 0; g < outputs; ++g) {
+                if (group_last(g) - group_first(g) == 1) continue;
+                {
+                    ifstream group(group_path(g), ios::binary);
+                    if (!group || !scatter(group, group_size[g], false, group_first(g), group_last(g))) return false;
+                }
+                filesystem::remove(group_path(g));
+            }
+            return true;
+        };
+    if (!scatter(f, n_records, swap_ids, 0, n_runs)) return 0;
+
+    // Pass 3: finalize runs in destination order
+    vector<Accessibility> input, sorted;
+    for (uint32_t r = 0; r < n_runs; ++r) {
+        ifstream rf(run_path(r), ios::binary);
+        if (run_size[r] > run_records) {
+            // One oversized destination: already grouped, stream it through
+            for (uint64_t done = 0; done < run_size[r]; done += chunk.size()) {
+                size_t n = min<uint64_t>(chunk.size(), run_size[r] - done);
+                if (!rf.read(reinterpret_cast<char*>(chunk.data()), n * rec)) return 0;
+                if (!writer.append(chunk.data(), n)) return 0;
+            }
+        } else {
+            input.resize(run_size[r]);
+            if (!rf.read(reinterpret_cast<char*>(input.data()), input.size() * rec)) return 0;
+            partition_by_destination(input, sorted, n_threads, key);
+            if (!writer.append(sorted.data(), sorted.size())) return 0;
+        }
+        rf.close();
+        filesystem::remove(run_path(r));
+    }
+    filesystem::remove(run_dir);
+    return n_runs;
 }
 
 int main(int argc, char** argv) {
     if (argc < 4) {
-        cerr << "Usage: ./preprocess_dataset <input_dir> <percent> <output_dir>\n";
+        cerr << "Usage: ./preprocess_dataset <input_dir> <percent> <output_dir> [--mem-budget MB] [--threads N]"
+                " [--acc-layout rows|columnar] [--codec none|auto] [--append [--new-origin-attrs K]"
+                " [--new-dest-attrs K]] [--pack] [--io-engine uring|threads|sync] [--origin-major]"
+                " [--tiles [--tile-origins N] [--tile-dests N]] [--autotune [--autotune-mb MB]]"
+                " [--mmap-output]\n";
+        cerr << "  --mem-budget MB  bound peak memory; split between the three tables by input size\n";
+        cerr << "  --threads N      worker threads per table (default: all cores)\n";
+        cerr << "  --acc-layout L   accessibility blocks as 16-byte records (rows, default) or per-destination\n"
+                "                   time/distance/origin columns with implicit dense origins (columnar)\n";
+        cerr << "  --codec C        auto: encode attribute runs and columnar accessibility pieces with the\n"
+                "                   smallest of raw/FOR/delta/byte-plane per column (codecs.h); none (default)\n";
+        cerr << "  --append         add the input files as a new segment of the existing dataset instead of\n"
+                "                   rebuilding it; tables without an input file are left untouched\n";
+        cerr << "  --new-origin-attrs K, --new-dest-attrs K\n"
+                "                   with --append: the input table holds K new attributes for existing rows\n"
+                "                   (default: new rows with all current attributes)\n";
+        cerr << "  --pack           pack the dataset into one mmap-able file, <output_dir>/<N>p/dataset.aspa\n";
+        cerr << "  --origin-major   also write an origin-major copy of accessibility (accessibility_by_origin/)\n"
+                "                   so queries with a selective origin attribute can scan by origin\n";
+        cerr << "  --tiles          also write a copy in 2D (origin range x destination range) tiles in Z-order\n"
+                "                   (accessibility_tiles/); a query reads only tiles with selected IDs on both sides\n";
+        cerr << "  --tile-origins N, --tile-dests N\n"
+                "                   tile size (default: origins whose bitmap fills half of L1, ~1M records per tile)\n";
+        cerr << "  --io-engine E    write blocks in the background through io_uring (uring, default; falls back\n"
+                "                   to threads if unavailable), a pool of pwrite threads (threads), or inline (sync)\n";
+        cerr << "  --autotune       benchmark reads on the output filesystem (block_autotune.h) and pick the block\n"
+                "                   sizes and read method recorded in metadata.txt (default: built-in sizes, pread)\n";
+        cerr << "  --autotune-mb MB size of the scratch file read by --autotune (default: 256)\n";
+        cerr << "  --mmap-output    compute the layout first, then fill pre-sized mapped blocks from all threads\n"
+                "                   (raw attribute cells and in-memory rows accessibility; others stream)\n";
         return 1;
     }
     string inDir = argv[1];
     float percent = stof(argv[2]);
     string outDir = argv[3];
+
+    // Optional flags
+    uint64_t mem_budget = 0;  // 0 = unbounded (one pass per table)
+    unsigned n_threads = 0;
+    AccLayout acc_layout = AccLayout::Rows;
+    BlockCodec codec = BlockCodec::None;
+    bool append = false, pack = false, origin_major = false, tiles = false, autotune = false, mmap_output = false;
+    uint64_t autotune_bytes = AUTOTUNE_DEFAULT_PROBE_BYTES;
+    uint32_t tile_origins = 0, tile_dests = 0;
+    uint32_t new_origin_attrs = 0, new_dest_attrs = 0;
+    IoEngine io_engine = IoEngine::Uring;
+    for (int i = 4; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--mem-budget" && i + 1 < argc) {
+            mem_budget = stoull(argv[++i]) * 1024 * 1024;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            n_threads = stoul(argv[++i]);
+        } else if (arg == "--acc-layout" && i + 1 < argc) {
+            if (!parse_acc_layout(argv[++i], acc_layout)) {
+                cerr << "Unknown accessibility layout: " << argv[i] << "\n";
+                return 1;
+            }
+        } else if (arg == "--codec" && i + 1 < argc) {
+            if (!parse_block_codec(argv[++i], codec)) {
+                cerr << "Unknown codec: " << argv[i] << "\n";
+                return 1;
+            }
+        } else if (arg == "--append") {
+            append = true;
+        } else if (arg == "--pack") {
+            pack = true;
+        } else if (arg == "--origin-major") {
+            origin_major = true;
+        } else if (arg == "--tiles") {
+            tiles = true;
+        } else if (arg == "--mmap-output") {
+            mmap_output = true;
+        } else if (arg == "--autotune") {
+            autotune = true;
+        } else if (arg == "--autotune-mb" && i + 1 < argc) {
+            autotune_bytes = stoull(argv[++i]) * 1024 * 1024;
+        } else if ((arg == "--tile-origins" || arg == "--tile-dests") && i + 1 < argc) {
+            if (!parse_tile_size(argv[++i], arg == "--tile-origins" ? tile_origins : tile_dests)) {
+                cerr << "Invalid tile size: " << argv[i] << " (expected 1 to " << UINT32_MAX << ")\n";
+                return 1;
+            }
+        } else if (arg == "--io-engine" && i + 1 < argc) {
+            if (!parse_io_engine(argv[++i], io_engine)) {
+                cerr << "Unknown I/O engine: " << argv[i] << "\n";
+                return 1;
+            }
+        } else if (arg == "--new-origin-attrs" && i + 1 < argc) {
+            new_origin_attrs = stoul(argv[++i]);
+        } else if (arg == "--new-dest-attrs" && i + 1 < argc) {
+            new_dest_attrs = stoul(argv[++i]);
+        } else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    if ((new_origin_attrs || new_dest_attrs) && !append) {
+        cerr << "--new-origin-attrs/--new-dest-attrs require --append\n";
+        return 1;
+    }
+    if (autotune && append) {
+        cerr << "--autotune applies to full builds; appended segments keep the dataset's block sizes\n";
+        return 1;
+    }
+    if (n_threads == 0) n_threads = max(1u, thread::hardware_concurrency());
     int percent_int = static_cast<int>(percent * 100 + 0.5f);
     string percent_str = to_string(percent_int) + "p";
     string suffix = percent_str;
 
-    auto t_total_start = chrono::steady_clock::now();
+    string compact_kernel;
+    CompactFn compact = select_compact_kernel(compact_kernel);
+    cout << "Threads: " << n_threads << ", NaN compaction kernel: " << compact_kernel << endl;
 
-    // Create output directories with percentage suffix
-    string outBase = outDir + "/" + suffix;
-    filesystem::create_directories(outBase + "/attributes/origin/blocks");
-    cout << "Directory created: " << outBase + "/attributes/origin/blocks" << endl;
+    // Output stage shared by all block writers: each writer fills one buffer
+    // while the other is written, so transposing and partitioning overlap the disk
+    unique_ptr<IoQueue> io_queue = IoQueue::create(io_engine);
+    string io_engine_used = io_queue ? io_engine_name(io_queue->engine()) : io_engine_name(IoEngine::Sync);
+    if (io_queue && io_queue->engine() != io_engine)
+        cout << "io_uring unavailable, falling back to " << io_engine_used << endl;
+    cout << "I/O engine: " << io_engine_used << endl;
+    WriterOptions writer_opts;
+    writer_opts.queue = io_queue.get();
+
+    auto t_total_start = chrono::steady_clock::now();
 
-    filesystem::create_directories(outBase + "/attributes/destination/blocks");
-    cout << "Directory created: " << outBase + "/attributes/destination/blocks" << endl;
+    // A full build is the only segment of a new manifest. --append writes the
+    // delta into segments/seg_N and publishes it with the next manifest version.
+    string datasetBase = outDir + "/" + suffix;
+    DatasetManifest manifest;
+    DatasetSegment segment;
+    segment.origin_attrs = ORIGIN_ATTRS;
+    segment.destination_attrs = DEST_ATTRS;
+    BlockSizes block_sizes;
+    ReadMethod read_method = ReadMethod::Pread;
+    if (append) {
+        if (!filesystem::exists(datasetBase)) {
+            cerr << "Error: --append needs an existing dataset at " << datasetBase << "\n";
+            return 1;
+        }
+        // Readers only see the container of a packed dataset, so the new segment must be packed too
+        if (filesystem::exists(container_path(datasetBase)) && !pack) {
+            cerr << "Error: " << datasetBase << " is packed; add --pack to repack it with the new segment\n";
+            return 1;
+        }
+        manifest = load_manifest(datasetBase);
+        // Keep an existing origin-major or tiled copy complete; tiles keep the base's size
+        DatasetFiles existing;
+        FileRegion copy_index;
+        if (existing.open(datasetBase)) {
+            block_sizes = block_sizes_from_metadata(read_dataset_metadata(existing, "metadata.txt"));
+            read_method = existing.read_method();
+            if (existing.find(string(ACC_BY_ORIGIN_TABLE) + "/index.bin", copy_index) && !origin_major) {
+                cout << "Dataset has an origin-major copy; extending it" << endl;
+                origin_major = true;
+            }
+            if (existing.find(string(ACC_TILES_TABLE) + "/index.bin", copy_index)) {
+                auto meta = read_dataset_metadata(existing, "metadata.txt");
+                if (!parse_tile_size(meta["tile_origins"], tile_origins) ||
+                    !parse_tile_size(meta["tile_dests"], tile_dests)) {
+                    cerr << "Dataset has a tiled copy without a valid tile size in metadata.txt\n";
+                    return 1;
+                }
+                tiles = true;
+                cout << "Dataset has a tiled copy (" << tile_origins << " x " << tile_dests << "); extending it" << endl;
+            }
+        }
+        segment.path = "segments/seg_" + to_string(manifest.segments.size());
+        // Attributes currently defined per table (the highest attribute number of any segment)
+        uint32_t origin_total = 0, dest_total = 0;
+        for (const auto& seg : manifest.segments) {
+            origin_total = max(origin_total, seg.origin_attr_begin + seg.origin_attrs - 1);
+            dest_total = max(dest_total, seg.destination_attr_begin + seg.destination_attrs - 1);
+        }
+        auto plan = [&](const string& type, uint32_t total, uint32_t new_attrs, uint32_t& begin, uint32_t& attrs) {
+            begin = new_attrs ? total + 1 : 1;
+            attrs = new_attrs ? new_attrs : total;
+            if (!filesystem::exists(inDir + "/" + type + "_" + suffix + ".bin")) attrs = 0;
+        };
+        plan("origin", origin_total, new_origin_attrs, segment.origin_attr_begin, segment.origin_attrs);
+        plan("destination", dest_total, new_dest_attrs, segment.destination_attr_begin, segment.destination_attrs);
+    }
+    string outBase = append ? datasetBase + "/" + segment.path : datasetBase;
+    if (tiles) {
+        if (tile_origins == 0) tile_origins = default_tile_origins();
+        if (tile_dests == 0) tile_dests = default_tile_dests(tile_origins);
+    }
+    if (!append) {
+        // A full build replaces the dataset, including a packed one
+        manifest.version = load_manifest(datasetBase).version;
+        filesystem::remove(container_path(datasetBase));
+        if (!origin_major) filesystem::remove_all(datasetBase + "/" + ACC_BY_ORIGIN_TABLE);
+        if (!tiles) filesystem::remove_all(datasetBase + "/" + ACC_TILES_TABLE);
+        // The old segments go with the manifest that listed them; left behind,
+        // the next append would reuse seg_1 and find their files
+        filesystem::remove_all(datasetBase + "/segments");
+    } else {
+        filesystem::remove_all(outBase);  // left by an append that failed before publishing
+    }
+    AutotuneResult tuned;
+    if (autotune) {
+        filesystem::create_directories(datasetBase);
+        cout << "Autotuning block sizes on " << datasetBase << " (" << autotune_bytes / (1024 * 1024) << " MB probe)..." << endl;
+        string error;
+        if (!autotune_block_sizes(datasetBase, autotune_bytes, tuned, &error)) {
+            cerr << "Error: " << error << "\n";
+            return 1;
+        }
+        block_sizes = tuned.sizes;
+        read_method = tuned.method;
+        cout << "  Knee: " << tuned.knee_bytes / 1024 << " KB requests, read method: " << read_method_name(read_method)
+             << ", blocks: " << block_sizes.origin_attr / (1024 * 1024) << "/" << block_sizes.dest_attr / (1024 * 1024)
+             << "/" << block_sizes.acc / (1024 * 1024) << " MB (origin/destination/accessibility)" << endl;
+    }
+    bool has_acc = !append || filesystem::exists(inDir + "/accessibility_" + suffix + ".bin");
+    segment.accessibility = has_acc;
+    if (append && segment.origin_attrs == 0 && segment.destination_attrs == 0 && !has_acc) {
+        cerr << "Error: no input files to append in " << inDir << "\n";
+        return 1;
+    }
 
-    filesystem::create_directories(outBase + "/accessibility/blocks");
-    cout << "Directory created: " << outBase + "/accessibility/blocks" << endl;
+    // Create output directories with percentage suffix
+    if (segment.origin_attrs > 0) {
+        filesystem::create_directories(outBase + "/attributes/origin/blocks");
+        cout << "Directory created: " << outBase + "/attributes/origin/blocks" << endl;
+    }
+    if (segment.destination_attrs > 0) {
+        filesystem::create_directories(outBase + "/attributes/destination/blocks");
+        cout << "Directory created: " << outBase + "/attributes/destination/blocks" << endl;
+    }
+    if (has_acc) {
+        filesystem::create_directories(outBase + "/accessibility/blocks");
+        cout << "Directory created: " << outBase + "/accessibility/blocks" << endl;
+    }
 
     // Variables for report - use atomic for thread safety
     atomic<uint64_t> origin_input_bytes{0}, dest_input_bytes{0}, acc_input_bytes{0};
     atomic<uint64_t> origin_output_bytes{0}, dest_output_bytes{0}, acc_output_bytes{0};
     atomic<uint32_t> origin_blocks{0}, dest_blocks{0}, acc_blocks{0};
+    atomic<uint64_t> acc_origin_output_bytes{0};  // --origin-major copy
+    atomic<uint32_t> acc_origin_blocks{0};
+    atomic<bool> acc_mapped{false};  // --mmap-output took the mapped path for accessibility
+    atomic<uint64_t> acc_tile_output_bytes{0}, acc_tile_count{0};  // --tiles copy
+    atomic<uint32_t> acc_tile_blocks{0};
     atomic<double> origin_time{0}, dest_time{0}, acc_time{0};
     atomic<size_t> acc_records_count{0};
+    atomic<uint32_t> origin_passes{0}, dest_passes{0}, acc_runs{0};
+    string origin_codecs, dest_codecs, acc_codecs;  // streams per codec (--codec auto)
+    // Set by any table thread that could not read or write; nothing is published then
+    atomic<bool> failed{false};
+    auto fail = [&](const string& msg) {
+        thread_safe_print("Error: " + msg + "\n");
+        failed = true;
+    };
+
+    // Memory budget share of each table, proportional to its input size
+    uint64_t origin_budget = 0, dest_budget = 0, acc_budget = 0;
+    if (mem_budget > 0) {
+        // Tables without an input file (--append) take no share
+        auto input_size = [&](const string& type) -> uint64_t {
+            error_code ec;
+            uint64_t bytes = filesystem::file_size(inDir + "/" + type + "_" + suffix + ".bin", ec);
+            return ec ? 0 : bytes;
+        };
+        uint64_t in_origin = input_size("origin");
+        uint64_t in_dest = input_size("destination");
+        uint64_t in_acc = input_size("accessibility");
+        double in_total = max<double>(1.0, double(in_origin) + in_dest + in_acc);
+        origin_budget = max<uint64_t>(1, mem_budget * (in_origin / in_total));
+        dest_budget = max<uint64_t>(1, mem_budget * (in_dest / in_total));
+        acc_budget = max<uint64_t>(1, mem_budget - origin_budget - dest_budget);
+    }
 
     // ===============================
     // 1️⃣  SIZE-BASED ATTRIBUTE BLOCKING WITH MULTITHREADING
     // ===============================
+    // Layout-first mapped output applies to raw cells only: encoded run sizes are known after encoding
+    bool mapped_attrs = mmap_output && codec == BlockCodec::None;
     auto process_table = [&](string type, uint32_t n_attrs, atomic<uint64_t>& input_bytes, 
-                             atomic<uint64_t>& output_bytes, atomic<uint32_t>& blocks_created, atomic<double>& proc_time) {
+                             atomic<uint64_t>& output_bytes, atomic<uint32_t>& blocks_created, atomic<double>& proc_time,
+                             uint64_t budget, atomic<uint32_t>& passes, string& codec_usage) {
         auto t_start = chrono::steady_clock::now();
         
         string binPath = inDir + "/" + type + "_" + suffix + ".bin";
         ifstream f(binPath, ios::binary);
+        if (!f) {
+            fail("cannot open " + binPath);
+            return;
+        }
 
         // Read total size
         f.seekg(0, ios::end);
@@ -112,75 +713,111 @@ int main(int argc, char** argv) {
                          to_string(n_attrs) + " attributes\n");
 
         // Select target block size based on type
-        size_t target_block_size = (type == "origin") ? TARGET_ORIGIN_ATTR_BLOCK_SIZE_BYTES 
-                                                       : TARGET_DEST_ATTR_BLOCK_SIZE_BYTES;
+        size_t target_block_size = (type == "origin") ? block_sizes.origin_attr : block_sizes.dest_attr;
         thread_safe_print("  Target block size: " + to_string(target_block_size / (1024*1024)) + " MB\n");
 
         string outType = (type == "destination") ? "destination" : type;
         string indexPath = outBase + "/attributes/" + outType + "/index.bin";
         
-        // Read entire file into memory for faster processing
-        vector<char> file_data(total_bytes);
-        f.read(file_data.data(), total_bytes);
-        f.close();
-        
-        thread_safe_print("  [" + type + "] File loaded into memory (" + 
-                         to_string(total_bytes / (1024*1024)) + " MB)\n");
+        // Plan passes over attribute ranges: a pass holds one row chunk plus the
+        // cells of its attributes (sized for the worst case, no nulls). Mapped
+        // output needs no cell buffers, so it reads the table in one pass.
+        uint64_t chunk_bytes = ATTR_READ_CHUNK_BYTES;
+        if (budget > 0) chunk_bytes = min<uint64_t>(chunk_bytes, budget / 4);
+        uint32_t rows_per_chunk = max<uint64_t>(1, chunk_bytes / row_size);
+        uint32_t attrs_per_pass = n_attrs;
+        if (budget > 0 && !mapped_attrs) {
+            uint64_t attr_bytes_worst = max<uint64_t>(1, uint64_t(n_rows) * sizeof(AttrValue));
+            uint64_t room = budget > rows_per_chunk * row_size ? budget - rows_per_chunk * row_size : 0;
+            attrs_per_pass = clamp<uint64_t>(room / attr_bytes_worst, 1, n_attrs);
+        }
+        passes = (n_attrs + attrs_per_pass - 1) / attrs_per_pass;
+        thread_safe_print("  [" + type + "] " + to_string(passes.load()) + " pass(es) of " + to_string(attrs_per_pass) +
+                          " attributes, " + to_string(rows_per_chunk) + " rows per read\n");
 
-        // Extract all attribute data in memory first
-        vector<vector<pair<uint32_t, float>>> all_attrs(n_attrs);
-        
-        for (uint32_t i = 0; i < n_rows; ++i) {
-            uint64_t row_offset = i * row_size;
-            uint32_t id = *reinterpret_cast<uint32_t*>(file_data.data() + row_offset);
-            
-            for (uint32_t a = 0; a < n_attrs; ++a) {
-                float val = *reinterpret_cast<float*>(file_data.data() + row_offset + 4 + a * 4);
-                if (!isnan(val)) {
-                    all_attrs[a].emplace_back(id, val);
+        // Streams the table once, handing fn each chunk of rows
+        vector<char> chunk(uint64_t(rows_per_chunk) * row_size);
+        auto for_each_chunk = [&](auto fn) {
+            f.clear();
+            f.seekg(0);
+            for (uint32_t r = 0; r < n_rows; r += rows_per_chunk) {
+                uint32_t n = min(rows_per_chunk, n_rows - r);
+                if (!f.read(chunk.data(), uint64_t(n) * row_size)) {
+                    fail("cannot read " + binPath);
+                    return false;
                 }
+                fn(chunk.data(), n);
             }
-        }
-        
-        thread_safe_print("  [" + type + "] Data extracted from memory\n");
-
-        // Write attributes in size-based blocks
-        ofstream indexFile(indexPath, ios::binary);
-        uint32_t current_block = 0;
-        ofstream currentBlockFile;
-        size_t current_block_bytes = 0;
-
-        for (uint32_t a = 0; a < n_attrs; ++a) {
-            const auto& attr_data = all_attrs[a];
-            size_t attr_bytes = attr_data.size() * sizeof(pair<uint32_t, float>);
-            
-            // Check if adding this attribute would exceed block size
-            if (current_block_bytes > 0 && current_block_bytes + attr_bytes > target_block_size) {
-                // Close current block and start new one
-                currentBlockFile.close();
-                current_block++;
-                current_block_bytes = 0;
+            return true;
+        };
+
+        uint32_t current_block;
+        if (mapped_attrs) {
+            // Layout pass: the non-null counts fix every run's block and offset,
+            // then the transpose threads write straight into the mapped blocks
+            vector<uint32_t> counts(n_attrs, 0);
+            bool ok = for_each_chunk([&](const char* rows, uint32_t n) {
+                count_attribute_range(rows, n, row_size, 0, n_attrs, counts, n_threads);
+            });
+            if (!ok) return;
+            MappedAttributeTable table(outBase + "/attributes/" + outType, target_block_size, writer_opts);
+            if (!table.open(counts)) {
+                fail("cannot map the " + type + " attribute blocks");
+                return;
+            }
+            vector<AttrColumn> attrs(n_attrs);
+            for (uint32_t a = 0; a < n_attrs; ++a) {
+                attrs[a].data = table.run(a);
+                attrs[a].mapped = true;
             }
-            
-            // Open new block file if needed
-            if (!currentBlockFile.is_open()) {
-                string blockPath = outBase + "/attributes/" + outType + "/blocks/block_" + to_string(current_block) + ".bin";
-                currentBlockFile.open(blockPath, ios::binary);
+            ok = for_each_chunk([&](const char* rows, uint32_t n) {
+                extract_attribute_range(rows, n, row_size, 0, n_attrs, attrs, n_threads, compact);
+            });
+            if (!table.close(n_threads) || !ok) {
+                if (ok) fail("cannot write the " + type + " attribute blocks");
+                return;
             }
+            codec_usage = CodecStats().summary();
+            current_block = table.blocks() - 1;
+        } else {
+            // Write attributes in size-based blocks
+            AttributeBlockWriter writer(outBase + "/attributes/" + outType, target_block_size, writer_opts, codec);
+            if (!writer.open()) {
+                fail("cannot create the " + type + " attribute blocks");
+                return;
+            }
+            for (uint32_t a0 = 0; a0 < n_attrs; a0 += attrs_per_pass) {
+                uint32_t a1 = min(n_attrs, a0 + attrs_per_pass);
+                vector<AttrColumn> attrs(a1 - a0);
+                for (auto& col : attrs) {
+                    if (!col.reserve(n_rows)) {
+                        fail("out of memory transposing " + type);
+                        return;
+                    }
+                }
 
-            uint64_t offset_start = currentBlockFile.tellp();
-            
-            // Write all data for this attribute at once
-            currentBlockFile.write(reinterpret_cast<const char*>(attr_data.data()), attr_bytes);
-            current_block_bytes += attr_bytes;
+                // Stream the table once, keeping only this attribute range
+                bool ok = for_each_chunk([&](const char* rows, uint32_t n) {
+                    extract_attribute_range(rows, n, row_size, a0, a1, attrs, n_threads, compact);
+                });
+                if (!ok) return;
 
-            // Write index entry
-            AttributeIndex idx = {current_block, offset_start, static_cast<uint32_t>(attr_data.size())};
-            indexFile.write(reinterpret_cast<const char*>(&idx), sizeof(idx));
+                for (const auto& col : attrs) {
+                    if (!writer.append(col.data, static_cast<uint32_t>(col.size))) {
+                        fail("cannot write the " + type + " attribute blocks");
+                        return;
+                    }
+                }
+            }
+            if (!writer.close()) {
+                fail("cannot write the " + type + " attribute blocks");
+                return;
+            }
+            codec_usage = writer.codec_stats().summary();
+            current_block = writer.blocks() - 1;
         }
-        
-        if (currentBlockFile.is_open()) currentBlockFile.close();
-        indexFile.close();
+        f.close();
+        thread_safe_print("  [" + type + "] Data transposed and written\n");
         
         blocks_created = current_block + 1;
         
@@ -205,113 +842,175 @@ int main(int argc, char** argv) {
 
     // Launch parallel threads for attribute processing
     thread origin_thread([&]() {
-        process_table("origin", ORIGIN_ATTRS, origin_input_bytes, origin_output_bytes, origin_blocks, origin_time);
+        if (segment.origin_attrs == 0) return;
+        process_table("origin", segment.origin_attrs, origin_input_bytes, origin_output_bytes, origin_blocks,
+                      origin_time, origin_budget, origin_passes, origin_codecs);
     });
     
     thread dest_thread([&]() {
-        process_table("destination", DEST_ATTRS, dest_input_bytes, dest_output_bytes, dest_blocks, dest_time);
+        if (segment.destination_attrs == 0) return;
+        process_table("destination", segment.destination_attrs, dest_input_bytes, dest_output_bytes, dest_blocks,
+                      dest_time, dest_budget, dest_passes, dest_codecs);
     });
 
     // ===============================
     // 2️⃣  ACCESSIBILITY WITH SIZE-BASED BLOCKING
     // ===============================
     thread acc_thread([&]() {
+        if (!has_acc) return;
         auto t_acc_start = chrono::steady_clock::now();
         
         string accPath = inDir + "/accessibility_" + suffix + ".bin";
         ifstream f(accPath, ios::binary);
+        if (!f) {
+            fail("cannot open " + accPath);
+            return;
+        }
 
         // Get input size
         f.seekg(0, ios::end);
         acc_input_bytes = f.tellg();
         f.seekg(0);
+        uint64_t n_records = acc_input_bytes / sizeof(Accessibility);
+        acc_records_count = n_records;
 
-        // Read all accessibility records into memory
-        vector<Accessibility> all_acc;
-        Accessibility a;
-        while (f.read(reinterpret_cast<char*>(&a), sizeof(a))) {
-            all_acc.push_back(a);
-        }
-        f.close();
-        acc_records_count = all_acc.size();
-        thread_safe_print("Loaded " + to_string(all_acc.size()) + " accessibility records into memory.\n");
-
-        // Sort by destination_id
-        sort(all_acc.begin(), all_acc.end(), [](const Accessibility& a, const Accessibility& b) {
-            return a.destination_id < b.destination_id;
-        });
+        WriterOptions acc_opts = writer_opts;
+        // Mapped output holds the input once; the blocks live in the page cache
+        bool mapped_acc = mmap_output && acc_layout == AccLayout::Rows && MappedAccessibilityTable::supported(block_sizes.acc) &&
+                          !(acc_budget > 0 && acc_input_bytes > acc_budget);
+        acc_mapped = mapped_acc;
+        if (acc_budget > 0) acc_opts.buffer_bytes = min<uint64_t>(acc_opts.buffer_bytes, max<uint64_t>(64 * 1024, acc_budget / 8));
 
-        // Write blocks and build index
-        string accBlockDir = outBase + "/accessibility/blocks";
-        string accIndexPath = outBase + "/accessibility/index.bin";
-        ofstream indexFile(accIndexPath, ios::binary);
-
-        size_t current_block_size = 0;
-        uint32_t current_block_id = 0;
-        ofstream blockFile;
-        uint64_t block_offset = 0;
-
-        uint32_t last_dest_id = UINT32_MAX;
-        uint64_t dest_start_offset = 0;
-        uint32_t dest_count = 0;
-
-        for (size_t i = 0; i < all_acc.size(); ++i) {
-            const Accessibility& rec = all_acc[i];
-            if (blockFile.is_open() == false) {
-                string blockPath = accBlockDir + "/block_" + to_string(current_block_id) + ".bin";
-                blockFile.open(blockPath, ios::binary);
-                block_offset = 0;
-                current_block_size = 0;
+        // Read all accessibility records into memory
+        auto load_input = [&](bool swap_ids) {
+            vector<Accessibility> input(n_records);
+            f.clear();
+            f.seekg(0);
+            if (!f.read(reinterpret_cast<char*>(input.data()), input.size() * sizeof(Accessibility)))
+                fail("cannot read " + accPath);
+            thread_safe_print("Loaded " + to_string(input.size()) + " accessibility records into memory.\n");
+            if (swap_ids) swap_accessibility_ids(input.data(), input.size());
+            return input;
+        };
+        // Groups the input by key into writer; returns the external partition
+        // runs (0 in memory). Failures go to fail().
+        auto write_partitioned = [&](const string& table, auto& writer, bool swap_ids, auto key) -> uint32_t {
+            // The in-memory partition holds the table twice
+            if (acc_budget > 0 && 2 * acc_input_bytes > acc_budget) {
+                thread_safe_print("Partitioning " + to_string(n_records) + " " + table + " records out of core (budget " +
+                                  to_string(acc_budget / 1024) + " KB)\n");
+                uint32_t runs = partition_by_destination_external(f, n_records, outBase + "/" + table + "/runs", acc_budget,
+                                                                  n_threads, writer, io_queue.get(), swap_ids, key);
+                if (runs == 0) fail("external partitioning of " + table + " failed");
+                return runs;
             }
+            vector<Accessibility> input = load_input(swap_ids);
 
-            // If new destination_id, record previous index entry
-            if (rec.destination_id != last_dest_id && last_dest_id != UINT32_MAX) {
-                AccIndexEntry idx = {last_dest_id, current_block_id, dest_start_offset, dest_count};
-                indexFile.write(reinterpret_cast<const char*>(&idx), sizeof(idx));
-                dest_start_offset = block_offset;
-                dest_count = 0;
+            // Partition by key (stable counting sort)
+            vector<Accessibility> all_acc;
+            partition_by_destination(input, all_acc, n_threads, key);
+            vector<Accessibility>().swap(input);
+            if (!writer.append(all_acc.data(), all_acc.size())) fail("cannot write the " + table + " blocks");
+            return 0;
+        };
+        // Index and block bytes of a written table
+        auto table_bytes = [&](const string& table, uint32_t blocks) {
+            string tableDir = outBase + "/" + table;
+            uint64_t total_output = filesystem::file_size(tableDir + "/index.bin");
+            for (uint32_t b = 0; b < blocks; ++b) {
+                string blockPath = block_path(tableDir, b);
+                if (filesystem::exists(blockPath)) {
+                    total_output += filesystem::file_size(blockPath);
+                }
             }
+            return total_output;
+        };
 
-            // Write record
-            blockFile.write(reinterpret_cast<const char*>(&rec), sizeof(rec));
-            block_offset += sizeof(rec);
-            current_block_size += sizeof(rec);
-            dest_count++;
-            last_dest_id = rec.destination_id;
-
-            // If block size exceeded, close and start new block
-            if (current_block_size >= TARGET_ACC_BLOCK_SIZE_BYTES) {
-                // Write last index entry for this block if needed
-                AccIndexEntry idx = {last_dest_id, current_block_id, dest_start_offset, dest_count};
-                indexFile.write(reinterpret_cast<const char*>(&idx), sizeof(idx));
-                blockFile.close();
-                current_block_id++;
-                block_offset = 0;
-                current_block_size = 0;
-                dest_start_offset = 0;
-                dest_count = 0;
-                last_dest_id = UINT32_MAX;
+        // Destination-major table, then (--origin-major) the origin-major copy,
+        // written from the same input with the IDs swapped
+        for (const char* table : {ACC_TABLE, ACC_BY_ORIGIN_TABLE}) {
+            bool by_origin = string(table) == ACC_BY_ORIGIN_TABLE;
+            if (by_origin && !origin_major) break;
+            if (mapped_acc) {
+                // The scatter of the counting sort writes straight into the mapped blocks
+                MappedAccessibilityTable mapped(outBase + "/" + table, block_sizes.acc, acc_opts);
+                vector<Accessibility> input = load_input(by_origin);
+                bool ok = partition_by_destination_into(input, n_threads, DestinationKey(),
+                                                        [&](const vector<uint64_t>& counts) {
+                                                            return mapped.open(counts) ? mapped.data() : nullptr;
+                                                        });
+                if (!ok || !mapped.close(n_threads)) {
+                    fail("cannot map the " + string(table) + " blocks");
+                    return;
+                }
+                if (by_origin) {
+                    acc_origin_blocks = mapped.blocks();
+                    acc_origin_output_bytes = table_bytes(table, mapped.blocks());
+                } else {
+                    acc_codecs = CodecStats().summary();
+                    acc_blocks = mapped.blocks();
+                    acc_output_bytes = table_bytes(table, mapped.blocks());
+                }
+                continue;
+            }
+            AccessibilityBlockWriter writer(outBase + "/" + table, block_sizes.acc, acc_opts, acc_layout, codec);
+            if (!writer.open()) {
+                fail("cannot create the " + string(table) + " blocks");
+                return;
+            }
+            uint32_t runs = write_partitioned(table, writer, by_origin, DestinationKey());
+            if (!writer.close()) fail("cannot write the " + string(table) + " blocks");
+            if (failed) return;
+            if (by_origin) {
+                acc_origin_blocks = writer.blocks();
+                acc_origin_output_bytes = table_bytes(table, writer.blocks());
+            } else {
+                acc_runs = runs;
+                acc_codecs = writer.codec_stats().summary();
+                acc_blocks = writer.blocks();
+                acc_output_bytes = table_bytes(table, writer.blocks());
             }
         }
-        // Write last index entry
-        if (dest_count > 0 && last_dest_id != UINT32_MAX) {
-            AccIndexEntry idx = {last_dest_id, current_block_id, dest_start_offset, dest_count};
-            indexFile.write(reinterpret_cast<const char*>(&idx), sizeof(idx));
-        }
-        if (blockFile.is_open()) blockFile.close();
-        indexFile.close();
 
-        acc_blocks = current_block_id + 1;
-        
-        // Calculate output size
-        uint64_t total_output = filesystem::file_size(accIndexPath);
-        for (uint32_t b = 0; b <= current_block_id; ++b) {
-            string blockPath = accBlockDir + "/block_" + to_string(b) + ".bin";
-            if (filesystem::exists(blockPath)) {
-                total_output += filesystem::file_size(blockPath);
+        // (--tiles) 2D tiled copy: records grouped by the Z-order rank of their tile
+        if (tiles) {
+            uint32_t max_origin = 0, max_dest = 0;
+            vector<Accessibility> scan(ATTR_READ_CHUNK_BYTES / sizeof(Accessibility));
+            f.clear();
+            f.seekg(0);
+            for (uint64_t r = 0; r < n_records; r += scan.size()) {
+                size_t n = min<uint64_t>(scan.size(), n_records - r);
+                if (!f.read(reinterpret_cast<char*>(scan.data()), n * sizeof(Accessibility))) break;
+                for (size_t i = 0; i < n; ++i) {
+                    max_origin = max(max_origin, scan[i].origin_id);
+                    max_dest = max(max_dest, scan[i].destination_id);
+                }
             }
+            vector<Accessibility>().swap(scan);
+            uint32_t origin_tiles = max_origin / tile_origins + 1, dest_tiles = max_dest / tile_dests + 1;
+            if (uint64_t(origin_tiles) * dest_tiles > ACC_TILE_MAX_TILES) {
+                fail("a grid of " + to_string(origin_tiles) + " x " + to_string(dest_tiles) + " tiles exceeds " +
+                     to_string(ACC_TILE_MAX_TILES) + "; use larger --tile-origins/--tile-dests");
+                return;
+            }
+            vector<uint32_t> rank = z_order_ranks(origin_tiles, dest_tiles);
+            auto tile_key = [&](const Accessibility& a) {
+                return rank[uint64_t(a.origin_id / tile_origins) * dest_tiles + a.destination_id / tile_dests];
+            };
+            AccessibilityTileWriter writer(outBase + "/" + ACC_TILES_TABLE, block_sizes.acc, acc_opts,
+                                           tile_origins, tile_dests);
+            if (!writer.open()) {
+                fail("cannot create the " + string(ACC_TILES_TABLE) + " blocks");
+                return;
+            }
+            write_partitioned(ACC_TILES_TABLE, writer, false, tile_key);
+            if (!writer.close()) fail("cannot write the " + string(ACC_TILES_TABLE) + " blocks");
+            if (failed) return;
+            acc_tile_count = writer.tiles();
+            acc_tile_blocks = writer.blocks();
+            acc_tile_output_bytes = table_bytes(ACC_TILES_TABLE, writer.blocks());
         }
-        acc_output_bytes = total_output;
+        f.close();
         
         auto t_acc_end = chrono::steady_clock::now();
         acc_time = chrono::duration<double>(t_acc_end - t_acc_start).count();
@@ -325,13 +1024,47 @@ int main(int argc, char** argv) {
     origin_thread.join();
     dest_thread.join();
     acc_thread.join();
+    if (failed) {
+        cerr << "Error: preprocessing failed; " << (append ? "the segment was not published" : "the dataset is incomplete")
+             << "\n";
+        return 1;
+    }
 
     auto t_total_end = chrono::steady_clock::now();
     double total_time = chrono::duration<double>(t_total_end - t_total_start).count();
 
+    map<string, string> metadata = {{"accessibility_layout", acc_layout_name(acc_layout)},
+                                     {"attribute_codec", block_codec_name(codec)},
+                                     {"accessibility_codec",
+                                      block_codec_name(acc_layout == AccLayout::Columnar ? codec : BlockCodec::None)}};
+    if (tiles) {
+        metadata["tile_origins"] = to_string(tile_origins);
+        metadata["tile_dests"] = to_string(tile_dests);
+    }
+    add_block_sizes(metadata, block_sizes);
+    metadata["read_method"] = read_method_name(read_method);
+    write_dataset_metadata(outBase, metadata);
+    manifest.version++;
+    if (!append) manifest.segments.clear();
+    manifest.segments.push_back(segment);
+    if (!write_manifest(datasetBase, manifest)) {
+        cerr << "Error: Cannot write " << manifest_path(datasetBase) << "\n";
+        return 1;
+    }
+    PackStats packed;
+    if (pack) {
+        string error;
+        if (!pack_dataset(datasetBase, packed, error)) {
+            cerr << "Error: " << error << "\n";
+            return 1;
+        }
+        cout << "Packed " << packed.files << " files into " << container_path(datasetBase) << endl;
+    }
+
     // ===============================
     // 3️⃣  GENERATE PROCESSING REPORT
     // ===============================
+    filesystem::create_directories(outBase);  // reports stay loose next to a packed dataset
     string reportPath = outBase + "/preprocessing_report_" + percent_str + ".txt";
     ofstream report(reportPath);
     
@@ -354,14 +1087,58 @@ int main(int argc, char** argv) {
     report << "Dataset percentage: " << percent_int << "%\n";
     report << "Input directory: " << inDir << "\n";
     report << "Output directory: " << outBase << "\n";
+    report << "Mode: " << (append ? "append (segment " + to_string(manifest.segments.size() - 1) + ")" : string("full build"))
+           << ", manifest version " << manifest.version << "\n";
+    report << "Storage: " << (pack ? "packed, " + to_string(packed.files) + " files in " + container_path(datasetBase) + " (" +
+                                         format_size(packed.bytes) + ")"
+                                   : string("loose files")) << "\n";
     report << "Total processing time: " << total_time << " seconds\n\n";
     
     report << "========================================\n";
     report << "BLOCK SIZE CONFIGURATION\n";
     report << "========================================\n";
-    report << "Origin attributes: " << (TARGET_ORIGIN_ATTR_BLOCK_SIZE_BYTES / (1024*1024)) << " MB per block\n";
-    report << "Destination attributes: " << (TARGET_DEST_ATTR_BLOCK_SIZE_BYTES / (1024*1024)) << " MB per block\n";
-    report << "Accessibility: " << (TARGET_ACC_BLOCK_SIZE_BYTES / (1024*1024)) << " MB per block\n\n";
+    report << "Origin attributes: " << (block_sizes.origin_attr / (1024*1024)) << " MB per block\n";
+    report << "Destination attributes: " << (block_sizes.dest_attr / (1024*1024)) << " MB per block\n";
+    report << "Accessibility: " << (block_sizes.acc / (1024*1024)) << " MB per block\n";
+    report << "Block sizes: " << (autotune ? "autotuned (knee at " + to_string(tuned.knee_bytes / 1024) + " KB requests)"
+                                  : append ? string("inherited from the dataset") : string("built-in defaults")) << "\n";
+    report << "Read method: " << read_method_name(read_method) << "\n";
+    report << "Accessibility layout: " << acc_layout_name(acc_layout) << "\n";
+    report << "Codec: " << block_codec_name(codec) << (codec == BlockCodec::Auto && acc_layout == AccLayout::Rows
+                                                        ? " (attributes only; accessibility rows stay raw)\n" : "\n");
+    report << "Threads per table: " << n_threads << "\n";
+    report << "NaN compaction kernel: " << compact_kernel << "\n";
+    report << "I/O engine: " << io_engine_used << "\n";
+    report << "Block output: " << (mapped_attrs || acc_mapped ? string("pre-sized mapped files (") +
+                                       (mapped_attrs ? "attributes" : "") + (mapped_attrs && acc_mapped ? ", " : "") +
+                                       (acc_mapped ? "accessibility" : "") + ")"
+                                   : string("streamed")) << "\n\n";
+
+    if (autotune) {
+        report << "========================================\n";
+        report << "FILESYSTEM READ PROBES\n";
+        report << "========================================\n";
+        report << "Scratch file: " << format_size(autotune_bytes) << " in " << datasetBase << "\n";
+        for (const ReadProbe& p : tuned.probes) {
+            char line[128];
+            snprintf(line, sizeof(line), "%-5s %-10s %10s requests: %10.1f MB/s\n", read_method_name(p.method),
+                     p.sequential ? "sequential" : "random", format_size(p.request_bytes).c_str(), p.mb_per_s);
+            report << line;
+        }
+        report << "\n";
+    }
+    
+    report << "========================================\n";
+    report << "MEMORY BUDGET\n";
+    report << "========================================\n";
+    if (mem_budget > 0) {
+        report << "Total budget: " << format_size(mem_budget) << "\n";
+        report << "Origin attributes: " << format_size(origin_budget) << "\n";
+        report << "Destination attributes: " << format_size(dest_budget) << "\n";
+        report << "Accessibility: " << format_size(acc_budget) << "\n\n";
+    } else {
+        report << "Unbounded\n\n";
+    }
     
     report << "========================================\n";
     report << "ORIGIN ATTRIBUTES\n";
@@ -369,8 +1146,10 @@ int main(int argc, char** argv) {
     report << "Input file size: " << format_size(origin_input_bytes) << " (" << origin_input_bytes << " bytes)\n";
     report << "Output size: " << format_size(origin_output_bytes) << " (" << origin_output_bytes << " bytes)\n";
     report << "Blocks created: " << origin_blocks << "\n";
+    report << "Transposition passes: " << origin_passes << "\n";
+    if (codec == BlockCodec::Auto) report << "Codec streams: " << origin_codecs << "\n";
     report << "Processing time: " << origin_time << " seconds\n";
-    report << "Compression ratio: " << fixed << setprecision(2) << (100.0 * origin_output_bytes / origin_input_bytes) << "%\n\n";
+    report << "Compression ratio: " << fixed << setprecision(2) << (100.0 * origin_output_bytes / max<uint64_t>(1, origin_input_bytes)) << "%\n\n";
     
     report << "========================================\n";
     report << "DESTINATION ATTRIBUTES\n";
@@ -378,8 +1157,10 @@ int main(int argc, char** argv) {
     report << "Input file size: " << format_size(dest_input_bytes) << " (" << dest_input_bytes << " bytes)\n";
     report << "Output size: " << format_size(dest_output_bytes) << " (" << dest_output_bytes << " bytes)\n";
     report << "Blocks created: " << dest_blocks << "\n";
+    report << "Transposition passes: " << dest_passes << "\n";
+    if (codec == BlockCodec::Auto) report << "Codec streams: " << dest_codecs << "\n";
     report << "Processing time: " << dest_time << " seconds\n";
-    report << "Compression ratio: " << fixed << setprecision(2) << (100.0 * dest_output_bytes / dest_input_bytes) << "%\n\n";
+    report << "Compression ratio: " << fixed << setprecision(2) << (100.0 * dest_output_bytes / max<uint64_t>(1, dest_input_bytes)) << "%\n\n";
     
     report << "========================================\n";
     report << "ACCESSIBILITY\n";
@@ -388,19 +1169,29 @@ int main(int argc, char** argv) {
     report << "Output size: " << format_size(acc_output_bytes) << " (" << acc_output_bytes << " bytes)\n";
     report << "Records processed: " << acc_records_count << "\n";
     report << "Blocks created: " << acc_blocks << "\n";
+    if (codec == BlockCodec::Auto && acc_layout == AccLayout::Columnar) report << "Codec streams: " << acc_codecs << "\n";
+    report << "External partition runs: " << acc_runs << (acc_runs ? "\n" : " (in memory)\n");
+    if (tiles)
+        report << "Tiled copy: " << format_size(acc_tile_output_bytes) << " (" << acc_tile_output_bytes << " bytes), "
+               << acc_tile_count << " tile pieces of " << tile_origins << " origins x " << tile_dests
+               << " destinations, " << acc_tile_blocks << " blocks\n";
+    if (origin_major)
+        report << "Origin-major copy: " << format_size(acc_origin_output_bytes) << " (" << acc_origin_output_bytes
+               << " bytes), " << acc_origin_blocks << " blocks\n";
     report << "Processing time: " << acc_time << " seconds\n";
-    report << "Overhead ratio: " << fixed << setprecision(2) << (100.0 * acc_output_bytes / acc_input_bytes) << "%\n\n";
+    report << "Overhead ratio: " << fixed << setprecision(2) << (100.0 * acc_output_bytes / max<uint64_t>(1, acc_input_bytes)) << "%\n\n";
     
     uint64_t total_input = origin_input_bytes + dest_input_bytes + acc_input_bytes;
-    uint64_t total_output = origin_output_bytes + dest_output_bytes + acc_output_bytes;
+    uint64_t total_output =
+        origin_output_bytes + dest_output_bytes + acc_output_bytes + acc_origin_output_bytes + acc_tile_output_bytes;
     
     report << "========================================\n";
     report << "SUMMARY\n";
     report << "========================================\n";
     report << "Total input: " << format_size(total_input) << " (" << total_input << " bytes)\n";
     report << "Total output: " << format_size(total_output) << " (" << total_output << " bytes)\n";
-    report << "Total blocks: " << (origin_blocks + dest_blocks + acc_blocks) << "\n";
-    report << "Overall ratio: " << fixed << setprecision(2) << (100.0 * total_output / total_input) << "%\n";
+    report << "Total blocks: " << (origin_blocks + dest_blocks + acc_blocks + acc_origin_blocks + acc_tile_blocks) << "\n";
+    report << "Overall ratio: " << fixed << setprecision(2) << (100.0 * total_output / max<uint64_t>(1, total_input)) << "%\n";
     report << "========================================\n";
     
     report.close();
@@ -7,8 +7,15 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <fstream>
+#include "dataset_format.h"
+#include "dataset_reader.h"
+#include "filter_kernels.h"
+#include "thread_pool.h"
 using namespace std;
 
+// Records per morsel of the pipelined execution
+constexpr uint64_t PIPELINE_MORSEL_ROWS = 1 << 16;
+
 // Function to get current RAM usage in bytes
 size_t get_current_ram_usage() {
     ifstream stat_file("/proc/meminfo");
@@ -30,135 +37,24 @@ size_t get_current_ram_usage() {
     return mem_active; // Return active memory
 }
 
-struct Accessibility {
-    uint32_t origin_id;
-    uint32_t destination_id;
-    float time;
-    float distance;
-};
-
-struct AttributeIndex {
-    uint32_t block_id;
-    uint64_t offset;
-    uint32_t count;
-};
-
-// Nueva estructura para el índice de destino
-struct AccessibilityDestIndex {
-    uint32_t destination_id;
-    uint32_t block_id;
-    uint64_t offset;
-    uint32_t count;
-};
-
-// New struct for accessibility index
-struct AccIndexEntry {
-    uint32_t id;        // destination_id
-    uint32_t block_id;
-    uint64_t offset;
-    uint32_t count;
-};
-
-// Loads attribute values from block-based structure using mmap
-unordered_map<uint32_t, float> load_attribute_values(const string& basePath, uint32_t attr_num) {
-    uint32_t attr_index = attr_num - 1;
-    string indexPath = basePath + "/index.bin";
-    ifstream indexFile(indexPath, ios::binary);
-    if (!indexFile) {
-        cerr << "Error: Cannot open index file: " << indexPath << endl;
-        return {};
-    }
-    indexFile.seekg(attr_index * sizeof(AttributeIndex));
-    AttributeIndex idx;
-    if (!indexFile.read((char*)&idx, sizeof(idx))) {
-        cerr << "Error: Cannot read index for attribute " << attr_num << endl;
-        return {};
-    }
-    indexFile.close();
-
-    string blockPath = basePath + "/blocks/block_" + to_string(idx.block_id) + ".bin";
-    int fd = open(blockPath.c_str(), O_RDONLY);
-    if (fd < 0) {
-        cerr << "Error: Cannot open block file: " << blockPath << endl;
-        return {};
-    }
-    struct stat sb;
-    if (fstat(fd, &sb) == -1) {
-        cerr << "Error: fstat failed for " << blockPath << endl;
-        close(fd);
-        return {};
-    }
-    size_t map_len = sb.st_size;
-    void* map = mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (map == MAP_FAILED) {
-        cerr << "Error: mmap failed for " << blockPath << endl;
-        close(fd);
-        return {};
-    }
-    unordered_map<uint32_t, float> values;
-    char* ptr = (char*)map + idx.offset;
-    for (uint32_t i = 0; i < idx.count; ++i) {
-        uint32_t id = *reinterpret_cast<uint32_t*>(ptr + i * 8);
-        float val = *reinterpret_cast<float*>(ptr + i * 8 + 4);
-        values[id] = val;
-    }
-    munmap(map, map_len);
-    close(fd);
-    return values;
-}
-
-// Loads accessibility index into memory for fast lookup
-unordered_map<uint32_t, AccIndexEntry> load_accessibility_index(const string& basePath) {
-    unordered_map<uint32_t, AccIndexEntry> index_map;
-    string indexPath = basePath + "/index.bin";
-    ifstream indexFile(indexPath, ios::binary);
-    AccIndexEntry idx;
-    while (indexFile.read(reinterpret_cast<char*>(&idx), sizeof(idx))) {
-        index_map[idx.id] = idx;
-    }
-    indexFile.close();
-    return index_map;
-}
-
-// Loads accessibility records for a given destination_id using index in memory + mmap
-vector<Accessibility> load_accessibility_block(const string& basePath, const AccIndexEntry& idx) {
-    string blockPath = basePath + "/blocks/block_" + to_string(idx.block_id) + ".bin";
-    int fd = open(blockPath.c_str(), O_RDONLY);
-    if (fd < 0) return {};
-    struct stat sb;
-    if (fstat(fd, &sb) == -1) { close(fd); return {}; }
-    size_t map_len = sb.st_size;
-    void* map = mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (map == MAP_FAILED) { close(fd); return {}; }
-    vector<Accessibility> records;
-    records.reserve(idx.count);
-    char* ptr = (char*)map + idx.offset;
-    for (uint32_t i = 0; i < idx.count; ++i) {
-        Accessibility a = *reinterpret_cast<Accessibility*>(ptr + i * sizeof(Accessibility));
-        records.push_back(a);
-    }
-    munmap(map, map_len);
-    close(fd);
-    return records;
-}
-
-// Calculate total size of all files in a directory (recursively)
-size_t get_directory_size(const string& dirPath) {
-    size_t total_size = 0;
-    if (filesystem::exists(dirPath) && filesystem::is_directory(dirPath)) {
-        for (const auto& entry : filesystem::recursive_directory_iterator(dirPath)) {
-            if (entry.is_regular_file()) {
-                total_size += entry.file_size();
-            }
-        }
-    }
-    return total_size;
-}
-
 int main(int argc, char** argv) {
     if (argc < 6) {
-        cerr << "Usage: ./query_filter <preprocessed_data_dir> <percent> <origin_attr_name> <dest_attr_name> <results_dir>\n";
+        cerr << "Usage: ./query_filter <preprocessed_data_dir> <percent> <origin_attr_name> <dest_attr_name> <results_dir>"
+                " [--time-min T] [--time-max T] [--distance-min D] [--distance-max D] [--scan auto|destination|origin|tiles]"
+                " [--read-method auto|pread|mmap] [--zero-copy auto|on|off] [--cache-mb MB]"
+                " [--execution phased|pipelined]\n";
         cerr << "Example: ./query_filter out 0.01 or1 dst1 results  (for 1% dataset)\n";
+        cerr << "- --time-*/--distance-*: keep only records in range; runs and blocks outside it are skipped via zone maps\n";
+        cerr << "- --scan: drive the scan from the destination runs, the origin-major copy (preprocess --origin-major)\n"
+                "  or the 2D tiles (preprocess --tiles); auto picks the order that loads fewer records\n";
+        cerr << "- --read-method: read blocks with pread() or copy them from a mapping; auto uses the method\n"
+                "  recorded by preprocess --autotune (pread for datasets without one)\n";
+        cerr << "- --zero-copy: filter uncompressed records in place in the mapped blocks instead of copying them;\n"
+                "  auto when the blocks are mapped anyway (packed or mmap datasets), on maps loose blocks for the query\n";
+        cerr << "- --cache-mb: read accessibility blocks through a buffer pool of MB megabytes shared by the threads\n"
+                "  (CLOCK eviction, page cache dropped behind it); implies copying, not zero-copy\n";
+        cerr << "- --execution: load all runs and then filter them (phased), or load, filter and emit morsels of\n"
+                "  runs in one pass on every thread (pipelined)\n";
         return 1;
     }
 
@@ -174,6 +70,58 @@ int main(int argc, char** argv) {
     string originAttr = argv[3];
     string destAttr = argv[4];
     string resultsDir = argv[5];
+    AccPredicate predicate;
+    string scan = "auto";
+    string read_method = "auto";
+    string zero_copy_mode = "auto";
+    uint64_t cache_mb = 0;
+    string execution = "phased";
+    for (int i = 6; i < argc; ++i) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "Missing value for " << arg << "\n";
+            return 1;
+        }
+        if (arg == "--time-min") predicate.time_min = stof(argv[++i]);
+        else if (arg == "--time-max") predicate.time_max = stof(argv[++i]);
+        else if (arg == "--distance-min") predicate.distance_min = stof(argv[++i]);
+        else if (arg == "--distance-max") predicate.distance_max = stof(argv[++i]);
+        else if (arg == "--scan") scan = argv[++i];
+        else if (arg == "--read-method") read_method = argv[++i];
+        else if (arg == "--zero-copy") zero_copy_mode = argv[++i];
+        else if (arg == "--cache-mb") cache_mb = stoull(argv[++i]);
+        else if (arg == "--execution") execution = argv[++i];
+        else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    if (scan != "auto" && scan != "destination" && scan != "origin" && scan != "tiles") {
+        cerr << "Unknown scan order: " << scan << "\n";
+        return 1;
+    }
+    ReadMethod forced_method = ReadMethod::Pread;
+    if (read_method != "auto" && !parse_read_method(read_method, forced_method)) {
+        cerr << "Unknown read method: " << read_method << "\n";
+        return 1;
+    }
+    if (zero_copy_mode != "auto" && zero_copy_mode != "on" && zero_copy_mode != "off") {
+        cerr << "Unknown zero-copy mode: " << zero_copy_mode << "\n";
+        return 1;
+    }
+    if (zero_copy_mode == "on" && read_method == "pread") {
+        cerr << "--zero-copy on maps the blocks and cannot be combined with --read-method pread\n";
+        return 1;
+    }
+    if (execution != "phased" && execution != "pipelined") {
+        cerr << "Unknown execution mode: " << execution << "\n";
+        return 1;
+    }
+    bool pipelined = execution == "pipelined";
+    if (zero_copy_mode == "on" && cache_mb > 0) {
+        cerr << "--zero-copy on reads in place and cannot be combined with --cache-mb\n";
+        return 1;
+    }
     
     int percent_int = static_cast<int>(percent_float * 100 + 0.5f);
     string percent = to_string(percent_int);
@@ -190,11 +138,10 @@ int main(int argc, char** argv) {
     uint32_t destAttrNum = stoi(destAttr.substr(3));
     
     string preprocessedDataBase = preprocessedDir + "/" + suffix;
-    string originBasePath = preprocessedDataBase + "/attributes/origin";
-    string destBasePath = preprocessedDataBase + "/attributes/destination";
-    string accBasePath = preprocessedDataBase + "/accessibility";
     
-    size_t num_threads = thread::hardware_concurrency();
+    // Parallel phases run as tasks on the shared work-stealing pool
+    ThreadPool& workers = ThreadPool::shared();
+    size_t num_threads = workers.size();
     
     cout << "Dataset: " << percent << "%, Origin: " << originAttr 
          << ", Dest: " << destAttr << ", Threads: " << num_threads << endl;
@@ -209,82 +156,78 @@ int main(int argc, char** argv) {
     // === PHASE 1: Load origin attribute index ===
     auto t_phase1_start = chrono::steady_clock::now();
     
-    uint32_t attr_index = originAttrNum - 1;
-    string originIndexPath = originBasePath + "/index.bin";
-    ifstream originIndexFile(originIndexPath, ios::binary);
-    if (!originIndexFile) {
-        cerr << "Error: Cannot open origin index file" << endl;
+    // Packed datasets open with one mmap of dataset.aspa, loose ones file by file
+    DatasetFiles files;
+    string openError;
+    if (!files.open(preprocessedDataBase, &openError)) {
+        cerr << "Error: " << openError << endl;
         return 1;
     }
-    originIndexFile.seekg(attr_index * sizeof(AttributeIndex));
+    if (read_method != "auto") files.set_read_method(forced_method);
+    // Loose block files are then mapped once, on first use
+    if (zero_copy_mode == "on") files.set_read_method(ReadMethod::Mmap);
+    AttributeReader originReader;
     AttributeIndex originIdx;
-    if (!originIndexFile.read((char*)&originIdx, sizeof(originIdx))) {
+    string originBlockDir;  // table directory of the segment holding the attribute
+    if (!originReader.open(files, "origin")) {
+        cerr << "Error: Cannot open origin index file" << endl;
+        return 1;
+    }
+    if (!originReader.entry(originAttrNum, originIdx, &originBlockDir)) {
         cerr << "Error: Cannot read origin index" << endl;
         return 1;
     }
-    originIndexFile.close();
     
     auto t_phase1_end = chrono::steady_clock::now();
     double or_idx_load_time = chrono::duration<double>(t_phase1_end - t_phase1_start).count();
     
     update_ram();
     cout << "Phase 1 (load origin index): " << or_idx_load_time << " s" << endl;
+    cout << "  Dataset storage: " << (files.packed() ? "packed (" + to_string(files.packed_files()) + " files)" : string("loose files"))
+         << ", read method: " << read_method_name(files.read_method()) << endl;
 
     // === PHASE 2: Load origin attribute block ===
     auto t_phase2_start = chrono::steady_clock::now();
     
-    string originBlockPath = originBasePath + "/blocks/block_" + to_string(originIdx.block_id) + ".bin";
-    int or_fd = open(originBlockPath.c_str(), O_RDONLY);
-    if (or_fd < 0) {
-        cerr << "Error: Cannot open origin block file" << endl;
+    FileRegion originBlock;
+    files.find(block_path(originBlockDir, originIdx.block_id), originBlock);
+    size_t or_bin_size = originBlock.size;
+    // The filter only tests for non-null origins: load the validity bitmap, not the values
+    RoaringBitmap originValid;
+    if (!originReader.load_validity(originAttrNum, originValid)) {
+        cerr << "Error: Cannot load origin attribute " << originAttrNum << endl;
         return 1;
     }
-    struct stat or_sb;
-    fstat(or_fd, &or_sb);
-    size_t or_bin_size = or_sb.st_size;
-    void* or_map = mmap(nullptr, or_bin_size, PROT_READ, MAP_PRIVATE, or_fd, 0);
-    
-    unordered_map<uint32_t, float> originValues;
-    char* or_ptr = (char*)or_map + originIdx.offset;
-    for (uint32_t i = 0; i < originIdx.count; ++i) {
-        uint32_t id = *reinterpret_cast<uint32_t*>(or_ptr + i * 8);
-        float val = *reinterpret_cast<float*>(or_ptr + i * 8 + 4);
-        originValues[id] = val;
-    }
-    munmap(or_map, or_bin_size);
-    close(or_fd);
     
     // Get total size of origin directory (includes blocks and index)
-    size_t or_blocks_total_size = get_directory_size(originBasePath);
+    size_t or_blocks_total_size = files.bytes_under("attributes/origin");
     
     auto t_phase2_end = chrono::steady_clock::now();
     double or_bin_load_time = chrono::duration<double>(t_phase2_end - t_phase2_start).count();
-    size_t or_bin_loaded_rows = originValues.size();
-    size_t or_bin_loaded_size = or_bin_loaded_rows * 8;
+    size_t or_bin_loaded_rows = originValid.cardinality();
+    size_t or_bin_loaded_size = originReader.bytes_read();
     
     update_ram();
     cout << "Phase 2 (load origin attributes): " << or_bin_load_time << " s" << endl;
     cout << "  Origin loaded rows: " << or_bin_loaded_rows << endl;
+    cout << "  Origin loaded size: " << or_bin_loaded_size << " bytes" << (originReader.has_validity() ? " (validity bitmap)" : "") << endl;
     cout << "  Origin block file size: " << or_bin_size << " bytes" << endl;
     cout << "  Origin directory total on disk: " << or_blocks_total_size << " bytes" << endl;
 
     // === PHASE 3: Load destination attribute index ===
     auto t_phase3_start = chrono::steady_clock::now();
     
-    uint32_t dest_attr_index = destAttrNum - 1;
-    string destIndexPath = destBasePath + "/index.bin";
-    ifstream destIndexFile(destIndexPath, ios::binary);
-    if (!destIndexFile) {
+    AttributeReader destReader;
+    AttributeIndex destIdx;
+    string destBlockDir;
+    if (!destReader.open(files, "destination")) {
         cerr << "Error: Cannot open dest index file" << endl;
         return 1;
     }
-    destIndexFile.seekg(dest_attr_index * sizeof(AttributeIndex));
-    AttributeIndex destIdx;
-    if (!destIndexFile.read((char*)&destIdx, sizeof(destIdx))) {
+    if (!destReader.entry(destAttrNum, destIdx, &destBlockDir)) {
         cerr << "Error: Cannot read dest index" << endl;
         return 1;
     }
-    destIndexFile.close();
     
     auto t_phase3_end = chrono::steady_clock::now();
     double dst_idx_load_time = chrono::duration<double>(t_phase3_end - t_phase3_start).count();
@@ -295,153 +238,368 @@ int main(int argc, char** argv) {
     // === PHASE 4: Load destination attribute block ===
     auto t_phase4_start = chrono::steady_clock::now();
     
-    string destBlockPath = destBasePath + "/blocks/block_" + to_string(destIdx.block_id) + ".bin";
-    int dst_fd = open(destBlockPath.c_str(), O_RDONLY);
-    if (dst_fd < 0) {
-        cerr << "Error: Cannot open dest block file" << endl;
+    FileRegion destBlock;
+    files.find(block_path(destBlockDir, destIdx.block_id), destBlock);
+    size_t dst_bin_size = destBlock.size;
+    RoaringBitmap destValid;
+    if (!destReader.load_validity(destAttrNum, destValid)) {
+        cerr << "Error: Cannot load destination attribute " << destAttrNum << endl;
         return 1;
     }
-    struct stat dst_sb;
-    fstat(dst_fd, &dst_sb);
-    size_t dst_bin_size = dst_sb.st_size;
-    void* dst_map = mmap(nullptr, dst_bin_size, PROT_READ, MAP_PRIVATE, dst_fd, 0);
-    
-    unordered_map<uint32_t, float> destValues;
-    char* dst_ptr = (char*)dst_map + destIdx.offset;
-    for (uint32_t i = 0; i < destIdx.count; ++i) {
-        uint32_t id = *reinterpret_cast<uint32_t*>(dst_ptr + i * 8);
-        float val = *reinterpret_cast<float*>(dst_ptr + i * 8 + 4);
-        destValues[id] = val;
-    }
-    munmap(dst_map, dst_bin_size);
-    close(dst_fd);
     
     // Get total size of destination directory (includes blocks and index)
-    size_t dst_blocks_total_size = get_directory_size(destBasePath);
+    size_t dst_blocks_total_size = files.bytes_under("attributes/destination");
     
     auto t_phase4_end = chrono::steady_clock::now();
     double dst_bin_load_time = chrono::duration<double>(t_phase4_end - t_phase4_start).count();
-    size_t dst_bin_loaded_rows = destValues.size();
-    size_t dst_bin_loaded_size = dst_bin_loaded_rows * 8;
+    size_t dst_bin_loaded_rows = destValid.cardinality();
+    size_t dst_bin_loaded_size = destReader.bytes_read();
     
     update_ram();
     cout << "Phase 4 (load dest attributes): " << dst_bin_load_time << " s" << endl;
     cout << "  Destination loaded rows: " << dst_bin_loaded_rows << endl;
+    cout << "  Destination loaded size: " << dst_bin_loaded_size << " bytes" << (destReader.has_validity() ? " (validity bitmap)" : "") << endl;
     cout << "  Destination block file size: " << dst_bin_size << " bytes" << endl;
     cout << "  Destination directory total on disk: " << dst_blocks_total_size << " bytes" << endl;
 
     // === PHASE 5: Load accessibility index ===
     auto t_phase5_start = chrono::steady_clock::now();
     
-    unordered_map<uint32_t, AccIndexEntry> accIndexMap;
-    string accIndexPath = accBasePath + "/index.bin";
-    ifstream accIndexFile(accIndexPath, ios::binary);
-    AccIndexEntry idx;
-    while (accIndexFile.read(reinterpret_cast<char*>(&idx), sizeof(idx))) {
-        accIndexMap[idx.id] = idx;
+    AccessibilityReader destMajor, originMajor;
+    if (!destMajor.open(files)) {
+        cerr << "Error: Cannot open accessibility index" << endl;
+        return 1;
     }
-    accIndexFile.close();
-    
-    vector<uint32_t> selected_dest_ids;
-    for (const auto& [dest_id, _] : destValues) {
-        selected_dest_ids.push_back(dest_id);
+    bool has_origin_major = originMajor.open(files, ACC_BY_ORIGIN_TABLE);
+    AccessibilityTileReader tileReader;
+    bool has_tiles = tileReader.open(files);
+    if (scan == "origin" && !has_origin_major) {
+        cerr << "Error: --scan origin needs a dataset preprocessed with --origin-major" << endl;
+        return 1;
+    }
+    if (scan == "tiles" && !has_tiles) {
+        cerr << "Error: --scan tiles needs a dataset preprocessed with --tiles" << endl;
+        return 1;
+    }
+
+    // Scan the runs of the more selective side and probe the other side's
+    // bitmap, or read only the tiles holding selected IDs on both sides.
+    // auto compares the records each order would load.
+    vector<uint32_t> selected_dest_ids = destValid.to_vector();
+    vector<uint32_t> selected_origin_ids =
+        has_origin_major || has_tiles ? originValid.to_vector() : vector<uint32_t>();
+    vector<size_t> selected_tiles;
+    if (has_tiles && (scan == "auto" || scan == "tiles"))
+        selected_tiles = tileReader.select(selected_origin_ids, selected_dest_ids, predicate);
+    string order = scan;
+    if (scan == "auto") {
+        uint64_t best = 0;
+        for (uint32_t d : selected_dest_ids) best += destMajor.run_rows(d);
+        order = "destination";
+        if (has_origin_major) {
+            uint64_t origin_rows = 0;
+            for (uint32_t o : selected_origin_ids) origin_rows += originMajor.run_rows(o);
+            if (origin_rows < best) best = origin_rows, order = "origin";
+        }
+        if (has_tiles) {
+            uint64_t tile_rows = 0;
+            for (size_t i : selected_tiles) tile_rows += tileReader.tile(i).count;
+            if (tile_rows < best) order = "tiles";
+        }
+    }
+    bool by_origin = order == "origin", by_tiles = order == "tiles";
+    string scan_name = by_tiles ? "tiles" : by_origin ? "origin-major" : "destination-major";
+    AccessibilityReader& accReader = by_origin ? originMajor : destMajor;
+    vector<uint32_t>& selected_run_ids = by_origin ? selected_origin_ids : selected_dest_ids;
+    // The side probed per record, direct-addressed: one bit per ID. Tiles
+    // probe both sides.
+    DenseBitmap probeSet(by_origin ? destValid : originValid);
+    DenseBitmap tileDestSet;
+    if (by_tiles) tileDestSet = DenseBitmap(destValid);
+    // An attribute whose zone map has no non-null cells selects nothing
+    AttrZone originZone, destZone;
+    bool attr_zone_empty = (originReader.zone(originAttrNum, originZone) && originZone.count == 0) ||
+                           (destReader.zone(destAttrNum, destZone) && destZone.count == 0);
+    if (attr_zone_empty) {
+        selected_run_ids.clear();
+        selected_tiles.clear();
     }
+    // Scan in place when every block of the chosen copy is mapped and
+    // uncompressed, unless blocks go through the buffer pool
+    unique_ptr<BufferPool> pool;
+    if (cache_mb > 0) {
+        pool = make_unique<BufferPool>(cache_mb << 20);
+        accReader.set_buffer_pool(pool.get());
+        tileReader.set_buffer_pool(pool.get());
+    }
+    bool zero_copy = !pool && zero_copy_mode != "off" && (by_tiles ? tileReader.can_view() : accReader.can_view());
     
     auto t_phase5_end = chrono::steady_clock::now();
     double acc_idx_load_time = chrono::duration<double>(t_phase5_end - t_phase5_start).count();
     
     update_ram();
     cout << "Phase 5 (load accessibility index): " << acc_idx_load_time << " s" << endl;
-    cout << "  Selected destinations: " << selected_dest_ids.size() << endl;
+    cout << "  Accessibility layout: " << acc_layout_name(accReader.layout()) << endl;
+    cout << "  Scan order: " << scan_name << (has_origin_major || has_tiles ? "" : " (no secondary layout)") << endl;
+    if (by_tiles) {
+        cout << "  Selected tiles: " << selected_tiles.size() << " of " << tileReader.tiles() << " ("
+             << tileReader.tile_origins() << " origins x " << tileReader.tile_dests() << " destinations)" << endl;
+    } else {
+        cout << "  Selected " << (by_origin ? "origins" : "destinations") << ": " << selected_run_ids.size() << endl;
+        cout << "  Probe set: dense bitmap of " << probeSet.bytes() << " bytes" << endl;
+    }
+    cout << "  Record access: "
+         << (zero_copy ? "zero-copy views of the mapped blocks"
+             : pool    ? "copied through a " + to_string(pool->budget() >> 20) + " MB buffer pool"
+                       : string("copied"))
+         << endl;
+    if (zero_copy_mode == "on" && !zero_copy) cout << "  (zero-copy needs uncompressed blocks)" << endl;
+    if (predicate.active() && !by_tiles)
+        cout << "  Blocks excluded by zone maps: " << accReader.excluded_blocks(predicate)
+             << (accReader.has_zones() ? "" : " (no zone maps)") << endl;
+
+    // Filter kernels, shared by the phased and the pipelined execution.
+    // Origin-major runs hold the destinations in their origin column.
+    auto filter_run = [&](vector<Accessibility>& out, uint32_t run_id, const AccColumns& run) {
+        filter_run_into(make_run_filter(probeSet, predicate, run_id, by_origin), run, out);
+    };
+    auto filter_views = [&](vector<Accessibility>& out, uint32_t run_id, const vector<AccPieceView>& views) {
+        RunFilter f = make_run_filter(probeSet, predicate, run_id, by_origin);
+        for (const AccPieceView& p : views) filter_view_into(f, p, out);
+    };
+    // Tiles mix runs: both IDs of every record are probed
+    RunFilter tile_filter = make_tile_filter(probeSet, tileDestSet, predicate);
+    auto filter_tile = [&](vector<Accessibility>& out, size_t tile, const Accessibility* recs) {
+        filter_rows_into(tile_filter, recs, tileReader.tile(tile).count, out);
+    };
+
+    // The output file is created up front: the pipelined execution writes
+    // each morsel's results as soon as they are filtered
+    int out_fd = open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        cerr << "Error: Cannot create " << outputPath << endl;
+        return 1;
+    }
+    atomic<bool> write_failed{false};
 
     // === PHASE 6: Load accessibility blocks (data) ===
     auto t_phase6_start = chrono::steady_clock::now();
     
-    unordered_map<uint32_t, vector<Accessibility>> loaded_acc_data;
-    size_t acc_bin_loaded_rows = 0;
-    
-    for (uint32_t dest_id : selected_dest_ids) {
-        auto it = accIndexMap.find(dest_id);
-        if (it == accIndexMap.end()) continue;
-        auto records = load_accessibility_block(accBasePath, it->second);
-        acc_bin_loaded_rows += records.size();
-        loaded_acc_data[dest_id] = move(records);
+    // Runs by position in selected_run_ids (runs skipped entirely stay empty),
+    // copied or, zero-copy, as views of their pieces. Views only resolve the
+    // pieces and start their reads; the pages arrive while phase 7 scans.
+    // The pipelined execution keeps none of them.
+    size_t items = by_tiles ? selected_tiles.size() : selected_run_ids.size();
+    size_t kept_runs = pipelined || by_tiles ? 0 : items;
+    size_t kept_tiles = pipelined || !by_tiles ? 0 : items;
+    vector<AccColumns> loaded_runs(zero_copy ? 0 : kept_runs);
+    vector<vector<AccPieceView>> run_views(zero_copy ? kept_runs : 0);
+    vector<vector<Accessibility>> loaded_tiles(zero_copy ? 0 : kept_tiles);
+    vector<const Accessibility*> tile_views(zero_copy ? kept_tiles : 0);
+    atomic<size_t> loaded_rows{0};
+    atomic<bool> load_failed{false};
+    // Kept records in parts filtered independently (one per phase 7 task),
+    // written out at prefix-sum offsets in phase 8
+    vector<vector<Accessibility>> result_parts;
+    
+    // Copies are loaded by the worker threads in tasks of contiguous ranges,
+    // so that neighbouring runs (often in one block) share buffer pool frames
+    auto load_range = [&](size_t start, size_t end) {
+        for (size_t i = start; i < end && !load_failed; ++i) {
+            if (by_tiles) {
+                bool ok = zero_copy ? (tile_views[i] = tileReader.view(selected_tiles[i])) != nullptr
+                                    : tileReader.load(selected_tiles[i], loaded_tiles[i]);
+                if (!ok) {
+                    cerr << "Error: Cannot read accessibility tile " << selected_tiles[i] << endl;
+                    load_failed = true;
+                }
+                loaded_rows += tileReader.tile(selected_tiles[i]).count;
+            } else if (zero_copy) {
+                if (!accReader.view(selected_run_ids[i], run_views[i], predicate)) continue;
+                for (const AccPieceView& p : run_views[i]) loaded_rows += p.count;
+            } else {
+                if (!accReader.load(selected_run_ids[i], loaded_runs[i], ACC_COL_ALL, predicate)) continue;
+                loaded_rows += loaded_runs[i].count;
+            }
+        }
+    };
+
+    // Pipelined: consecutive runs (or tiles) are cut into morsels of about
+    // PIPELINE_MORSEL_ROWS records, one pool task each; a larger run is split
+    // into morsels of row ranges when its pieces can be read in part. A worker
+    // loads, filters and writes one morsel before the next, at an output
+    // offset it reserves once the morsel's results are known, so in-flight
+    // results are bounded by the threads and the morsel size. The records then
+    // come out in morsel completion order.
+    struct Morsel {
+        size_t first, last;
+        uint64_t row_begin = 0, row_end = UINT64_MAX;
+    };
+    vector<Morsel> morsels;
+    if (pipelined) {
+        bool split_runs = !by_tiles && (zero_copy || accReader.splittable());
+        uint64_t rows = 0;
+        for (size_t i = 0; i < items; ++i) {
+            uint64_t n = by_tiles ? tileReader.tile(selected_tiles[i]).count : accReader.run_rows(selected_run_ids[i]);
+            if (split_runs && n > PIPELINE_MORSEL_ROWS) {
+                for (uint64_t r = 0; r < n; r += PIPELINE_MORSEL_ROWS)
+                    morsels.push_back({i, i + 1, r, min(n, r + PIPELINE_MORSEL_ROWS)});
+                rows = PIPELINE_MORSEL_ROWS;
+                continue;
+            }
+            if (morsels.empty() || rows >= PIPELINE_MORSEL_ROWS) {
+                morsels.push_back({i, i});
+                rows = 0;
+            }
+            morsels.back().last = i + 1;
+            rows += n;
+        }
+    }
+    atomic<uint64_t> written_rows{0};
+    auto run_morsels = [&](size_t first, size_t last) {
+        AccColumns run;
+        vector<AccPieceView> views;
+        vector<Accessibility> tile, out;
+        for (size_t m = first; !load_failed && !write_failed && m < last; ++m) {
+            const Morsel& mo = morsels[m];
+            out.clear();
+            for (size_t i = mo.first; i < mo.last; ++i) {
+                if (by_tiles) {
+                    const Accessibility* recs = zero_copy ? tileReader.view(selected_tiles[i])
+                                                : tileReader.load(selected_tiles[i], tile) ? tile.data()
+                                                                                           : nullptr;
+                    if (!recs) {
+                        cerr << "Error: Cannot read accessibility tile " << selected_tiles[i] << endl;
+                        load_failed = true;
+                        break;
+                    }
+                    loaded_rows += tileReader.tile(selected_tiles[i]).count;
+                    filter_tile(out, selected_tiles[i], recs);
+                } else if (zero_copy) {
+                    if (!accReader.view(selected_run_ids[i], views, predicate, mo.row_begin, mo.row_end)) continue;
+                    for (const AccPieceView& p : views) loaded_rows += p.count;
+                    filter_views(out, selected_run_ids[i], views);
+                } else {
+                    if (!accReader.load(selected_run_ids[i], run, ACC_COL_ALL, predicate, mo.row_begin, mo.row_end))
+                        continue;
+                    loaded_rows += run.count;
+                    filter_run(out, selected_run_ids[i], run);
+                }
+            }
+            if (out.empty() || load_failed) continue;
+            uint64_t at = written_rows.fetch_add(out.size());
+            if (!pwrite_all(out_fd, reinterpret_cast<const char*>(out.data()), out.size() * sizeof(Accessibility),
+                            at * sizeof(Accessibility)))
+                write_failed = true;
+        }
+    };
+
+    if (pipelined) workers.parallel_for(morsels.size(), 1, run_morsels);
+    else if (zero_copy) load_range(0, items);
+    else workers.parallel_for(items, workers.grain_for(items), load_range);
+    size_t acc_bin_loaded_rows = loaded_rows;
+    if (load_failed) return 1;
+    if (write_failed) {
+        cerr << "Error: Cannot write " << outputPath << endl;
+        return 1;
     }
+    // Zero-copy scans count the bytes they reference in place
+    size_t acc_bin_loaded_size = by_tiles ? tileReader.bytes_read() + tileReader.bytes_viewed()
+                                          : accReader.bytes_read() + accReader.bytes_viewed();
+    uint64_t skipped_pieces = by_tiles ? tileReader.skipped_pieces() : accReader.skipped_pieces();
+    uint64_t skipped_rows = by_tiles ? tileReader.skipped_rows() : accReader.skipped_rows();
     
     // Get total size of accessibility directory (includes blocks and index)
-    size_t acc_blocks_total_size = get_directory_size(accBasePath);
+    size_t acc_blocks_total_size =
+        files.bytes_under(by_tiles ? ACC_TILES_TABLE : by_origin ? ACC_BY_ORIGIN_TABLE : ACC_TABLE);
     
     auto t_phase6_end = chrono::steady_clock::now();
     double acc_bin_load_time = chrono::duration<double>(t_phase6_end - t_phase6_start).count();
     
     update_ram();
-    cout << "Phase 6 (load accessibility blocks): " << acc_bin_load_time << " s" << endl;
+    if (pipelined)
+        cout << "Phase 6+7 (pipelined load and filter): " << acc_bin_load_time << " s, " << morsels.size()
+             << " morsels" << endl;
+    else
+        cout << "Phase 6 (load accessibility blocks): " << acc_bin_load_time << " s" << endl;
     cout << "  Accessibility loaded rows: " << acc_bin_loaded_rows << endl;
-    cout << "  Accessibility loaded size: " << (acc_bin_loaded_rows * sizeof(Accessibility)) << " bytes" << endl;
+    cout << "  Accessibility loaded size: " << acc_bin_loaded_size << " bytes" << endl;
+    if (predicate.active())
+        cout << "  Skipped by zone maps: " << skipped_pieces << " pieces, " << skipped_rows << " rows" << endl;
     cout << "  Accessibility directory total on disk: " << acc_blocks_total_size << " bytes" << endl;
+    if (pool)
+        cout << "  Buffer pool: " << pool->hits() << " hits, " << pool->misses() << " misses, " << pool->evictions()
+             << " evictions, " << pool->resident_bytes() << " of " << pool->budget() << " bytes resident" << endl;
 
     // === PHASE 7: Filtering (in-memory) ===
     auto t_phase7_start = chrono::steady_clock::now();
     
-    vector<thread> threads;
-    mutex results_mutex;
-    vector<Accessibility> filtered_results;
-    size_t result_acc_rows = 0;
-    
-    auto process_dest_range = [&](size_t start, size_t end) {
-        vector<Accessibility> local_results;
-        
-        for (size_t i = start; i < end; ++i) {
-            uint32_t dest_id = selected_dest_ids[i];
-            auto data_it = loaded_acc_data.find(dest_id);
-            if (data_it == loaded_acc_data.end()) continue;
-            
-            for (const auto& a : data_it->second) {
-                auto originIt = originValues.find(a.origin_id);
-                if (originIt != originValues.end()) {
-                    local_results.push_back(a);
-                }
+    // One result part per task of `grain` consecutive runs (or tiles), so no
+    // task shares its output. Fine-grained tasks: runs differ widely in size,
+    // and idle workers steal the rest of a straggler's range. Already done by
+    // the pipelined execution.
+    size_t grain = workers.grain_for(items);
+    auto process_parts = [&](size_t first, size_t last) {
+        for (size_t p = first; p < last; ++p) {
+            vector<Accessibility>& out = result_parts[p];
+            for (size_t i = p * grain; i < min(items, (p + 1) * grain); ++i) {
+                if (by_tiles)
+                    filter_tile(out, selected_tiles[i], zero_copy ? tile_views[i] : loaded_tiles[i].data());
+                else if (zero_copy) filter_views(out, selected_run_ids[i], run_views[i]);
+                else filter_run(out, selected_run_ids[i], loaded_runs[i]);
             }
         }
-        
-        lock_guard<mutex> lock(results_mutex);
-        filtered_results.insert(filtered_results.end(), local_results.begin(), local_results.end());
     };
-    
-    size_t total = selected_dest_ids.size();
-    size_t chunk = (total + num_threads - 1) / num_threads;
-    for (size_t t = 0; t < num_threads; ++t) {
-        size_t start = t * chunk;
-        size_t end = min(start + chunk, total);
-        if (start >= end) break;
-        threads.emplace_back(process_dest_range, start, end);
+    if (!pipelined) {
+        result_parts.resize((items + grain - 1) / grain);
+        workers.parallel_for(result_parts.size(), 1, process_parts);
     }
-    for (auto& th : threads) th.join();
     
-    result_acc_rows = filtered_results.size();
+    // Output position of every part: exclusive prefix sum of the part sizes
+    vector<uint64_t> part_offsets(result_parts.size() + 1, 0);
+    for (size_t p = 0; p < result_parts.size(); ++p) part_offsets[p + 1] = part_offsets[p] + result_parts[p].size();
+    size_t result_acc_rows = pipelined ? written_rows.load() : part_offsets.back();
     
     auto t_phase7_end = chrono::steady_clock::now();
     double time_filtering = chrono::duration<double>(t_phase7_end - t_phase7_start).count();
     size_t result_acc_size = result_acc_rows * sizeof(Accessibility);
     
     update_ram();
-    cout << "Phase 7 (filtering): " << time_filtering << " s" << endl;
+    cout << "Phase 7 (filtering): " << time_filtering << " s" << (pipelined ? " (fused into phase 6)" : "") << endl;
     cout << "  Result rows: " << result_acc_rows << endl;
     cout << "  Result size: " << result_acc_size << " bytes" << endl;
+    cout << "  Filter kernels: " << filter_kernels().name << endl;
 
     // === PHASE 8: Write results as binary ===
     auto t_phase8_start = chrono::steady_clock::now();
     
-    ofstream fout(outputPath, ios::binary);
-    fout.write(reinterpret_cast<const char*>(filtered_results.data()), 
-               filtered_results.size() * sizeof(Accessibility));
-    fout.close();
+    // The file is allocated at its final size, then the workers pwrite() the
+    // parts at their offsets concurrently and free them. The pipelined
+    // execution has written its results already.
+    if (!pipelined && result_acc_size > 0 && fallocate(out_fd, 0, 0, result_acc_size) != 0 &&
+        ftruncate(out_fd, result_acc_size) != 0)
+        write_failed = true;
+    workers.parallel_for(result_parts.size(), 1, [&](size_t first, size_t last) {
+        for (size_t p = first; p < last && !write_failed; ++p) {
+            vector<Accessibility>& part = result_parts[p];
+            if (!pwrite_all(out_fd, reinterpret_cast<const char*>(part.data()), part.size() * sizeof(Accessibility),
+                            part_offsets[p] * sizeof(Accessibility)))
+                write_failed = true;
+            vector<Accessibility>().swap(part);
+        }
+    });
+    if (close(out_fd) != 0) write_failed = true;
+    if (write_failed) {
+        cerr << "Error: Cannot write " << outputPath << endl;
+        return 1;
+    }
     
     auto t_phase8_end = chrono::steady_clock::now();
     double time_write_bin = chrono::duration<double>(t_phase8_end - t_phase8_start).count();
     
     update_ram();
-    cout << "Phase 8 (write binary results): " << time_write_bin << " s" << endl;
+    cout << "Phase 8 (write binary results): " << time_write_bin << " s" << (pipelined ? " (fused into phase 6)" : "")
+         << endl;
     
     // === Generate result report ===
     ofstream report(reportPath);
@@ -451,7 +609,21 @@ int main(int argc, char** argv) {
     report << "Binary file: " << outputPath << "\n";
     report << "Dataset percentage: " << percent << "%\n";
     report << "Origin attribute: " << originAttr << " (attr #" << originAttrNum << ")\n";
-    report << "Destination attribute: " << destAttr << " (attr #" << destAttrNum << ")\n\n";
+    report << "Destination attribute: " << destAttr << " (attr #" << destAttrNum << ")\n";
+    report << "Scan order: " << scan_name << "\n";
+    report << "Read method: " << read_method_name(files.read_method()) << (read_method == "auto" ? "\n" : " (forced)\n");
+    report << "Execution: " << execution << "\n";
+    report << "Record access: " << (zero_copy ? "zero-copy (in place in the mapped blocks)" : "copied") << "\n";
+    report << "Filter kernels: " << filter_kernels().name << "\n";
+    if (pool)
+        report << "Buffer pool: " << pool->budget() << " bytes budget, " << pool->resident_bytes() << " resident, "
+               << pool->hits() << " hits, " << pool->misses() << " misses, " << pool->evictions() << " evictions\n";
+    if (predicate.active()) {
+        report << "Predicate: time in [" << predicate.time_min << ", " << predicate.time_max << "], distance in ["
+               << predicate.distance_min << ", " << predicate.distance_max << "]\n";
+        report << "Skipped by zone maps: " << skipped_pieces << " run pieces, " << skipped_rows << " rows\n";
+    }
+    report << "\n";
     
     report << "========================================\n";
     report << "BINARY FORMAT DESCRIPTION\n";
@@ -488,7 +660,7 @@ int main(int argc, char** argv) {
     report << "Accessibility records loaded: " << acc_bin_loaded_rows << " rows\n";
     report << "Result records: " << result_acc_rows << " rows\n";
     report << "Selectivity: " << fixed << setprecision(2) 
-           << (100.0 * result_acc_rows / acc_bin_loaded_rows) << "%\n";
+           << (100.0 * result_acc_rows / max<size_t>(1, acc_bin_loaded_rows)) << "%\n";
     
     report << "\n========================================\n";
     report << "RAM USAGE STATISTICS\n";
@@ -527,12 +699,10 @@ int main(int argc, char** argv) {
                << "num_threads,RAM_min (B),RAM_max (B),RAM_max-min (B)\n";
     }
     
-    size_t acc_bin_loaded_size_bytes = acc_bin_loaded_rows * sizeof(Accessibility);
-    
     // Write data row
     csvOut << percent << "," << originAttr << "," << destAttr << ","
            << or_bin_loaded_rows << "," << dst_bin_loaded_rows << "," << acc_bin_loaded_rows << ","
-           << or_bin_loaded_size << "," << dst_bin_loaded_size << "," << acc_bin_loaded_size_bytes << ","
+           << or_bin_loaded_size << "," << dst_bin_loaded_size << "," << acc_bin_loaded_size << ","
            << or_bin_load_time << "," << dst_bin_load_time << "," << acc_bin_load_time << ","
            << time_filtering << "," << time_write_bin << "," << total_time << ","
            << result_acc_size << ","
@@ -7,6 +7,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <fstream>
+#include "dataset_format.h"
+#include "dataset_reader.h"
+#include "filter_kernels.h"
+#include "thread_pool.h"
 using namespace std;
 
 // ============================================================
@@ -58,26 +62,6 @@ vector<uint32_t> parse_attribute_list(const string& attr_string) {
     return result;
 }
 
-struct Accessibility {
-    uint32_t origin_id;
-    uint32_t destination_id;
-    float time;
-    float distance;
-};
-
-struct AttributeIndex {
-    uint32_t block_id;
-    uint64_t offset;
-    uint32_t count;
-};
-
-struct AccIndexEntry {
-    uint32_t id;
-    uint32_t block_id;
-    uint64_t offset;
-    uint32_t count;
-};
-
 // Thread-safe logging
 mutex cout_mutex;
 void log_msg(const string& msg) {
@@ -85,107 +69,26 @@ void log_msg(const string& msg) {
     cout << msg << flush;
 }
 
-// Load attribute values using mmap
-unordered_map<uint32_t, float> load_attribute_values(const string& basePath, uint32_t attr_num) {
-    uint32_t attr_index = attr_num - 1;
-    string indexPath = basePath + "/index.bin";
-    ifstream indexFile(indexPath, ios::binary);
-    if (!indexFile) {
-        cerr << "Error: Cannot open index file: " << indexPath << endl;
-        return {};
-    }
-    indexFile.seekg(attr_index * sizeof(AttributeIndex));
-    AttributeIndex idx;
-    if (!indexFile.read((char*)&idx, sizeof(idx))) {
-        cerr << "Error: Cannot read index for attribute " << attr_num << endl;
-        return {};
-    }
-    indexFile.close();
-
-    string blockPath = basePath + "/blocks/block_" + to_string(idx.block_id) + ".bin";
-    int fd = open(blockPath.c_str(), O_RDONLY);
-    if (fd < 0) {
-        cerr << "Error: Cannot open block file: " << blockPath << endl;
-        return {};
-    }
-    struct stat sb;
-    if (fstat(fd, &sb) == -1) {
-        cerr << "Error: fstat failed for " << blockPath << endl;
-        close(fd);
-        return {};
-    }
-    size_t map_len = sb.st_size;
-    void* map = mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (map == MAP_FAILED) {
-        cerr << "Error: mmap failed for " << blockPath << endl;
-        close(fd);
-        return {};
-    }
-    unordered_map<uint32_t, float> values;
-    char* ptr = (char*)map + idx.offset;
-    for (uint32_t i = 0; i < idx.count; ++i) {
-        uint32_t id = *reinterpret_cast<uint32_t*>(ptr + i * 8);
-        float val = *reinterpret_cast<float*>(ptr + i * 8 + 4);
-        values[id] = val;
-    }
-    munmap(map, map_len);
-    close(fd);
-    return values;
-}
-
-// Load accessibility index
-unordered_map<uint32_t, AccIndexEntry> load_accessibility_index(const string& basePath) {
-    unordered_map<uint32_t, AccIndexEntry> index_map;
-    string indexPath = basePath + "/index.bin";
-    ifstream indexFile(indexPath, ios::binary);
-    AccIndexEntry idx;
-    while (indexFile.read(reinterpret_cast<char*>(&idx), sizeof(idx))) {
-        index_map[idx.id] = idx;
-    }
-    indexFile.close();
-    return index_map;
-}
-
-// Load accessibility block
-vector<Accessibility> load_accessibility_block(const string& basePath, const AccIndexEntry& idx) {
-    string blockPath = basePath + "/blocks/block_" + to_string(idx.block_id) + ".bin";
-    int fd = open(blockPath.c_str(), O_RDONLY);
-    if (fd < 0) return {};
-    struct stat sb;
-    if (fstat(fd, &sb) == -1) { close(fd); return {}; }
-    size_t map_len = sb.st_size;
-    void* map = mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (map == MAP_FAILED) { close(fd); return {}; }
-    vector<Accessibility> records;
-    records.reserve(idx.count);
-    char* ptr = (char*)map + idx.offset;
-    for (uint32_t i = 0; i < idx.count; ++i) {
-        Accessibility a = *reinterpret_cast<Accessibility*>(ptr + i * sizeof(Accessibility));
-        records.push_back(a);
+// Loads the set of non-null IDs of one attribute (its validity bitmap)
+RoaringBitmap load_attribute_validity(AttributeReader& reader, uint32_t attr_num) {
+    RoaringBitmap valid;
+    if (!reader.load_validity(attr_num, valid)) {
+        cerr << "Error: Cannot load attribute " << attr_num << " from " << reader.dir() << endl;
     }
-    munmap(map, map_len);
-    close(fd);
-    return records;
-}
-
-size_t get_directory_size(const string& dirPath) {
-    size_t total_size = 0;
-    if (filesystem::exists(dirPath) && filesystem::is_directory(dirPath)) {
-        for (const auto& entry : filesystem::recursive_directory_iterator(dirPath)) {
-            if (entry.is_regular_file()) {
-                total_size += entry.file_size();
-            }
-        }
-    }
-    return total_size;
+    return valid;
 }
 
 int main(int argc, char** argv) {
     if (argc < 6) {
-        cerr << "Usage: ./query_filter_multi <preprocessed_data_dir> <percent> <origin_attrs> <dest_attrs> <results_dir>\n";
+        cerr << "Usage: ./query_filter_multi <preprocessed_data_dir> <percent> <origin_attrs> <dest_attrs> <results_dir>"
+                " [--time-min T] [--time-max T] [--distance-min D] [--distance-max D] [--zero-copy auto|on|off]"
+                " [--cache-mb MB]\n";
         cerr << "Example: ./query_filter_multi dataset_processed 0.01 \"1,5,10\" \"25,30\" results\n";
         cerr << "- origin_attrs: comma-separated attribute numbers (e.g., \"1,5,10\")\n";
         cerr << "- dest_attrs: comma-separated attribute numbers (e.g., \"25,30\")\n";
+        cerr << "- --time-*/--distance-*: keep only records in range; runs and blocks outside it are skipped via zone maps\n";
+        cerr << "- --zero-copy: filter uncompressed records in place in the mapped blocks (see query_filter)\n";
+        cerr << "- --cache-mb: read accessibility blocks through a shared buffer pool of MB megabytes (see query_filter)\n";
         return 1;
     }
 
@@ -200,6 +103,34 @@ int main(int argc, char** argv) {
     string originAttrsStr = argv[3];
     string destAttrsStr = argv[4];
     string resultsDir = argv[5];
+    AccPredicate predicate;
+    string zero_copy_mode = "auto";
+    uint64_t cache_mb = 0;
+    for (int i = 6; i < argc; ++i) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "Missing value for " << arg << "\n";
+            return 1;
+        }
+        if (arg == "--time-min") predicate.time_min = stof(argv[++i]);
+        else if (arg == "--time-max") predicate.time_max = stof(argv[++i]);
+        else if (arg == "--distance-min") predicate.distance_min = stof(argv[++i]);
+        else if (arg == "--distance-max") predicate.distance_max = stof(argv[++i]);
+        else if (arg == "--zero-copy") zero_copy_mode = argv[++i];
+        else if (arg == "--cache-mb") cache_mb = stoull(argv[++i]);
+        else {
+            cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    if (zero_copy_mode != "auto" && zero_copy_mode != "on" && zero_copy_mode != "off") {
+        cerr << "Unknown zero-copy mode: " << zero_copy_mode << "\n";
+        return 1;
+    }
+    if (zero_copy_mode == "on" && cache_mb > 0) {
+        cerr << "--zero-copy on reads in place and cannot be combined with --cache-mb\n";
+        return 1;
+    }
     
     // Parse attribute lists
     vector<uint32_t> originAttrNums = parse_attribute_list(originAttrsStr);
@@ -226,11 +157,10 @@ int main(int argc, char** argv) {
     string reportPath = resultsDir + "/result_" + suffix + "_or_" + originStr + "_dst_" + destStr + "_report.txt";
     
     string preprocessedDataBase = preprocessedDir + "/" + suffix;
-    string originBasePath = preprocessedDataBase + "/attributes/origin";
-    string destBasePath = preprocessedDataBase + "/attributes/destination";
-    string accBasePath = preprocessedDataBase + "/accessibility";
     
-    size_t num_threads = thread::hardware_concurrency();
+    // Parallel phases run as tasks on the shared work-stealing pool
+    ThreadPool& workers = ThreadPool::shared();
+    size_t num_threads = workers.size();
     
     log_msg("Dataset: " + percent + "%, Origin attrs: " + originAttrsStr + 
             ", Dest attrs: " + destAttrsStr + ", Threads: " + to_string(num_threads) + "\n");
@@ -244,61 +174,91 @@ int main(int argc, char** argv) {
     // === PHASE 1-2: Load ALL origin attributes ===
     auto t_phase12_start = chrono::steady_clock::now();
     
-    vector<unordered_map<uint32_t, float>> originMaps;
+    vector<RoaringBitmap> originMaps;
     size_t or_total_loaded_rows = 0;
     
+    // Packed datasets open with one mmap of dataset.aspa, loose ones file by file
+    DatasetFiles files;
+    string openError;
+    if (!files.open(preprocessedDataBase, &openError)) {
+        cerr << "Error: " << openError << endl;
+        return 1;
+    }
+    // Loose block files are then mapped once, on first use
+    if (zero_copy_mode == "on") files.set_read_method(ReadMethod::Mmap);
+    AttributeReader originReader;
+    if (!originReader.open(files, "origin")) {
+        cerr << "Error: Cannot open origin index file" << endl;
+        return 1;
+    }
     for (uint32_t attr : originAttrNums) {
-        auto values = load_attribute_values(originBasePath, attr);
-        originMaps.push_back(values);
-        or_total_loaded_rows += values.size();
+        originMaps.push_back(load_attribute_validity(originReader, attr));
+        or_total_loaded_rows += originMaps.back().cardinality();
     }
     
-    size_t or_blocks_total_size = get_directory_size(originBasePath);
+    size_t or_blocks_total_size = files.bytes_under("attributes/origin");
     auto t_phase12_end = chrono::steady_clock::now();
     double or_load_time = chrono::duration<double>(t_phase12_end - t_phase12_start).count();
     
     update_ram();
     log_msg("Phase 1-2 (load origin attributes): " + to_string(or_load_time) + " s\n");
+    log_msg("  Dataset storage: " + (files.packed() ? "packed (" + to_string(files.packed_files()) + " files)" : string("loose files")) + "\n");
     log_msg("  Origin total loaded rows: " + to_string(or_total_loaded_rows) + "\n");
+    log_msg("  Origin loaded size: " + to_string(originReader.bytes_read()) + " bytes\n");
 
     // === PHASE 3-4: Load ALL destination attributes ===
     auto t_phase34_start = chrono::steady_clock::now();
     
-    vector<unordered_map<uint32_t, float>> destMaps;
+    vector<RoaringBitmap> destMaps;
     size_t dst_total_loaded_rows = 0;
     
+    AttributeReader destReader;
+    if (!destReader.open(files, "destination")) {
+        cerr << "Error: Cannot open dest index file" << endl;
+        return 1;
+    }
     for (uint32_t attr : destAttrNums) {
-        auto values = load_attribute_values(destBasePath, attr);
-        destMaps.push_back(values);
-        dst_total_loaded_rows += values.size();
+        destMaps.push_back(load_attribute_validity(destReader, attr));
+        dst_total_loaded_rows += destMaps.back().cardinality();
     }
     
-    size_t dst_blocks_total_size = get_directory_size(destBasePath);
+    size_t dst_blocks_total_size = files.bytes_under("attributes/destination");
     auto t_phase34_end = chrono::steady_clock::now();
     double dst_load_time = chrono::duration<double>(t_phase34_end - t_phase34_start).count();
     
     update_ram();
     log_msg("Phase 3-4 (load dest attributes): " + to_string(dst_load_time) + " s\n");
     log_msg("  Destination total loaded rows: " + to_string(dst_total_loaded_rows) + "\n");
+    log_msg("  Destination loaded size: " + to_string(destReader.bytes_read()) + " bytes\n");
 
     // === PHASE 5: Load accessibility index ===
     auto t_phase5_start = chrono::steady_clock::now();
     
-    unordered_map<uint32_t, AccIndexEntry> accIndexMap = load_accessibility_index(accBasePath);
+    AccessibilityReader accReader;
+    if (!accReader.open(files)) {
+        cerr << "Error: Cannot open accessibility index" << endl;
+        return 1;
+    }
     
-    // Compute intersection of destination IDs
-    set<uint32_t> dest_ids_set;
-    for (const auto& [dest_id, _] : destMaps[0]) {
-        bool in_all = true;
-        for (size_t i = 1; i < destMaps.size(); i++) {
-            if (destMaps[i].find(dest_id) == destMaps[i].end()) {
-                in_all = false;
-                break;
-            }
-        }
-        if (in_all) dest_ids_set.insert(dest_id);
+    // AND of the attributes of each side as direct-addressed bitmaps: the
+    // origin set is probed once per record, the destination set is enumerated
+    DenseBitmap destSet(destMaps[0]), originSet(originMaps[0]);
+    for (size_t i = 1; i < destMaps.size(); i++) destSet.intersect(DenseBitmap(destMaps[i]));
+    for (size_t i = 1; i < originMaps.size(); i++) originSet.intersect(DenseBitmap(originMaps[i]));
+    vector<uint32_t> selected_dest_ids = destSet.to_vector();
+    // An origin attribute whose zone map has no non-null cells selects nothing
+    for (uint32_t attr : originAttrNums) {
+        AttrZone zone;
+        if (originReader.zone(attr, zone) && zone.count == 0) selected_dest_ids.clear();
+    }
+    // Scan in place when every block is mapped and uncompressed, unless
+    // blocks go through the buffer pool
+    unique_ptr<BufferPool> pool;
+    if (cache_mb > 0) {
+        pool = make_unique<BufferPool>(cache_mb << 20);
+        accReader.set_buffer_pool(pool.get());
     }
-    vector<uint32_t> selected_dest_ids(dest_ids_set.begin(), dest_ids_set.end());
+    bool zero_copy = !pool && zero_copy_mode != "off" && accReader.can_view();
     
     auto t_phase5_end = chrono::steady_clock::now();
     double acc_idx_load_time = chrono::duration<double>(t_phase5_end - t_phase5_start).count();
@@ -306,75 +266,87 @@ int main(int argc, char** argv) {
     update_ram();
     log_msg("Phase 5 (load accessibility index): " + to_string(acc_idx_load_time) + " s\n");
     log_msg("  Selected destinations (intersection): " + to_string(selected_dest_ids.size()) + "\n");
+    log_msg("  Selected origins (intersection): " + to_string(originSet.cardinality()) + ", dense bitmap of " +
+            to_string(originSet.bytes()) + " bytes\n");
+    log_msg("  Accessibility layout: " + string(acc_layout_name(accReader.layout())) + "\n");
+    log_msg(string("  Record access: ") +
+            (zero_copy ? "zero-copy views of the mapped blocks\n"
+             : pool    ? "copied through a " + to_string(pool->budget() >> 20) + " MB buffer pool\n"
+                       : "copied\n"));
+    if (predicate.active())
+        log_msg("  Blocks excluded by zone maps: " + to_string(accReader.excluded_blocks(predicate)) +
+                (accReader.has_zones() ? "\n" : " (no zone maps)\n"));
 
     // === PHASE 6: Load accessibility blocks ===
     auto t_phase6_start = chrono::steady_clock::now();
     
-    unordered_map<uint32_t, vector<Accessibility>> loaded_acc_data;
-    size_t acc_bin_loaded_rows = 0;
+    // Runs by position in selected_dest_ids (runs skipped entirely stay empty),
+    // copied or, zero-copy, as views of their pieces
+    vector<AccColumns> loaded_runs(zero_copy ? 0 : selected_dest_ids.size());
+    vector<vector<AccPieceView>> run_views(zero_copy ? selected_dest_ids.size() : 0);
+    atomic<size_t> loaded_rows{0};
     
-    for (uint32_t dest_id : selected_dest_ids) {
-        auto it = accIndexMap.find(dest_id);
-        if (it == accIndexMap.end()) continue;
-        auto records = load_accessibility_block(accBasePath, it->second);
-        acc_bin_loaded_rows += records.size();
-        loaded_acc_data[dest_id] = move(records);
-    }
+    // Copies are loaded by the worker threads over contiguous ranges (see query_filter)
+    auto load_range = [&](size_t start, size_t end) {
+        for (size_t i = start; i < end; ++i) {
+            if (zero_copy) {
+                if (!accReader.view(selected_dest_ids[i], run_views[i], predicate)) continue;
+                for (const AccPieceView& p : run_views[i]) loaded_rows += p.count;
+                continue;
+            }
+            if (!accReader.load(selected_dest_ids[i], loaded_runs[i], ACC_COL_ALL, predicate)) continue;
+            loaded_rows += loaded_runs[i].count;
+        }
+    };
+    if (zero_copy) load_range(0, selected_dest_ids.size());
+    else workers.parallel_for(selected_dest_ids.size(), workers.grain_for(selected_dest_ids.size()), load_range);
+    size_t acc_bin_loaded_rows = loaded_rows;
     
-    size_t acc_blocks_total_size = get_directory_size(accBasePath);
+    size_t acc_blocks_total_size = files.bytes_under("accessibility");
     auto t_phase6_end = chrono::steady_clock::now();
     double acc_bin_load_time = chrono::duration<double>(t_phase6_end - t_phase6_start).count();
     
     update_ram();
     log_msg("Phase 6 (load accessibility blocks): " + to_string(acc_bin_load_time) + " s\n");
     log_msg("  Accessibility loaded rows: " + to_string(acc_bin_loaded_rows) + "\n");
+    log_msg("  Accessibility loaded size: " + to_string(accReader.bytes_read() + accReader.bytes_viewed()) + " bytes\n");
+    if (pool)
+        log_msg("  Buffer pool: " + to_string(pool->hits()) + " hits, " + to_string(pool->misses()) + " misses, " +
+                to_string(pool->evictions()) + " evictions, " + to_string(pool->resident_bytes()) + " of " +
+                to_string(pool->budget()) + " bytes resident\n");
+    if (predicate.active())
+        log_msg("  Skipped by zone maps: " + to_string(accReader.skipped_pieces()) + " pieces, " +
+                to_string(accReader.skipped_rows()) + " rows\n");
 
     // === PHASE 7: Filtering with multi-attribute AND logic ===
     auto t_phase7_start = chrono::steady_clock::now();
     
-    vector<thread> threads;
-    mutex results_mutex;
-    vector<Accessibility> filtered_results;
-    
-    auto process_dest_range = [&](size_t start, size_t end) {
-        vector<Accessibility> local_results;
-        
-        for (size_t i = start; i < end; ++i) {
-            uint32_t dest_id = selected_dest_ids[i];
-            auto data_it = loaded_acc_data.find(dest_id);
-            if (data_it == loaded_acc_data.end()) continue;
-            
-            for (const auto& a : data_it->second) {
-                // Check if origin_id exists in ALL origin attribute maps (AND logic)
-                bool origin_match = true;
-                for (const auto& originMap : originMaps) {
-                    if (originMap.find(a.origin_id) == originMap.end()) {
-                        origin_match = false;
-                        break;
-                    }
-                }
-                
-                if (origin_match) {
-                    local_results.push_back(a);
+    // One result part per task of `grain` destinations, written at its
+    // prefix-sum offset in phase 8 (see query_filter)
+    size_t total = selected_dest_ids.size();
+    size_t grain = workers.grain_for(total);
+    vector<vector<Accessibility>> result_parts((total + grain - 1) / grain);
+    
+    auto process_parts = [&](size_t first, size_t last) {
+        for (size_t p = first; p < last; ++p) {
+            // originSet holds the origins non-null in ALL origin attributes (AND logic)
+            for (size_t i = p * grain; i < min(total, (p + 1) * grain); ++i) {
+                RunFilter f = make_run_filter(originSet, predicate, selected_dest_ids[i], false);
+                if (zero_copy) {
+                    for (const AccPieceView& v : run_views[i]) filter_view_into(f, v, result_parts[p]);
+                    continue;
                 }
+                filter_run_into(f, loaded_runs[i], result_parts[p]);
             }
         }
-        
-        lock_guard<mutex> lock(results_mutex);
-        filtered_results.insert(filtered_results.end(), local_results.begin(), local_results.end());
     };
     
-    size_t total = selected_dest_ids.size();
-    size_t chunk = (total + num_threads - 1) / num_threads;
-    for (size_t t = 0; t < num_threads; ++t) {
-        size_t start = t * chunk;
-        size_t end = min(start + chunk, total);
-        if (start >= end) break;
-        threads.emplace_back(process_dest_range, start, end);
-    }
-    for (auto& th : threads) th.join();
+    // Fine-grained tasks, stolen by idle workers (see query_filter)
+    workers.parallel_for(result_parts.size(), 1, process_parts);
     
-    size_t result_acc_rows = filtered_results.size();
+    vector<uint64_t> part_offsets(result_parts.size() + 1, 0);
+    for (size_t p = 0; p < result_parts.size(); ++p) part_offsets[p + 1] = part_offsets[p] + result_parts[p].size();
+    size_t result_acc_rows = part_offsets.back();
     auto t_phase7_end = chrono::steady_clock::now();
     double time_filtering = chrono::duration<double>(t_phase7_end - t_phase7_start).count();
     size_t result_acc_size = result_acc_rows * sizeof(Accessibility);
@@ -382,14 +354,32 @@ int main(int argc, char** argv) {
     update_ram();
     log_msg("Phase 7 (filtering): " + to_string(time_filtering) + " s\n");
     log_msg("  Result rows: " + to_string(result_acc_rows) + "\n");
+    log_msg("  Filter kernels: " + string(filter_kernels().name) + "\n");
 
     // === PHASE 8: Write results ===
     auto t_phase8_start = chrono::steady_clock::now();
     
-    ofstream fout(outputPath, ios::binary);
-    fout.write(reinterpret_cast<const char*>(filtered_results.data()), 
-               filtered_results.size() * sizeof(Accessibility));
-    fout.close();
+    int out_fd = open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        cerr << "Error: Cannot create " << outputPath << endl;
+        return 1;
+    }
+    atomic<bool> write_failed{result_acc_size > 0 && fallocate(out_fd, 0, 0, result_acc_size) != 0 &&
+                              ftruncate(out_fd, result_acc_size) != 0};
+    workers.parallel_for(result_parts.size(), 1, [&](size_t first, size_t last) {
+        for (size_t p = first; p < last && !write_failed; ++p) {
+            vector<Accessibility>& part = result_parts[p];
+            if (!pwrite_all(out_fd, reinterpret_cast<const char*>(part.data()), part.size() * sizeof(Accessibility),
+                            part_offsets[p] * sizeof(Accessibility)))
+                write_failed = true;
+            vector<Accessibility>().swap(part);
+        }
+    });
+    if (close(out_fd) != 0) write_failed = true;
+    if (write_failed) {
+        cerr << "Error: Cannot write " << outputPath << endl;
+        return 1;
+    }
     
     auto t_phase8_end = chrono::steady_clock::now();
     double time_write_bin = chrono::duration<double>(t_phase8_end - t_phase8_start).count();
@@ -409,7 +399,14 @@ int main(int argc, char** argv) {
     report << "Dataset percentage: " << percent << "%\n";
     report << "Origin attributes: " << originAttrsStr << "\n";
     report << "Destination attributes: " << destAttrsStr << "\n";
-    report << "Filter logic: AND (all attributes must have non-null value)\n\n";
+    report << "Filter logic: AND (all attributes must have non-null value)\n";
+    if (predicate.active()) {
+        report << "Predicate: time in [" << predicate.time_min << ", " << predicate.time_max << "], distance in ["
+               << predicate.distance_min << ", " << predicate.distance_max << "]\n";
+        report << "Skipped by zone maps: " << accReader.skipped_pieces() << " run pieces, " << accReader.skipped_rows()
+               << " rows\n";
+    }
+    report << "\n";
     
     report << "========================================\n";
     report << "PERFORMANCE SUMMARY\n";
@@ -0,0 +1,257 @@
+#pragma once
+// ===============================================
+// ROARING VALIDITY BITMAPS
+// ===============================================
+// Set of non-null IDs of one attribute. IDs are split by their high 16 bits
+// into chunks; each chunk is stored in the smallest of three containers:
+//   array   sorted low 16-bit values          (2 bytes per ID)
+//   bitmap  65536 bits                        (8 KB)
+//   run     (start, length - 1) pairs         (4 bytes per run)
+// The generator's nulls form one prefix of every column, so most chunks are
+// a single run. Serialized form: uint32 container count, then per container
+// a RoaringContainerHeader followed by its payload.
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+enum RoaringType : uint8_t { ROARING_ARRAY = 0, ROARING_BITMAP = 1, ROARING_RUN = 2 };
+
+struct RoaringContainerHeader {
+    uint16_t key;        // high 16 bits of the IDs
+    uint8_t type;        // RoaringType
+    uint8_t reserved;
+    uint32_t n;          // array values, bitmap words (1024) or runs
+};
+
+class RoaringBitmap {
+public:
+    // Builds the set from ascending IDs
+    static RoaringBitmap from_sorted(const uint32_t* ids, size_t n) {
+        RoaringBitmap bm;
+        size_t i = 0;
+        while (i < n) {
+            uint16_t key = ids[i] >> 16;
+            size_t j = i;
+            size_t runs = 0;
+            while (j < n && (ids[j] >> 16) == key) {
+                if (j == i || ids[j] != ids[j - 1] + 1) ++runs;
+                ++j;
+            }
+            Container c;
+            c.key = key;
+            c.cardinality = j - i;
+            size_t array_bytes = 2 * (j - i), run_bytes = 4 * runs, bitmap_bytes = 8192;
+            if (run_bytes <= array_bytes && run_bytes <= bitmap_bytes) {
+                c.type = ROARING_RUN;
+                for (size_t k = i; k < j; ++k) {
+                    uint16_t low = ids[k] & 0xFFFF;
+                    if (k == i || ids[k] != ids[k - 1] + 1) {
+                        c.values.push_back(low);
+                        c.values.push_back(0);
+                    } else {
+                        c.values.back()++;
+                    }
+                }
+            } else if (array_bytes <= bitmap_bytes) {
+                c.type = ROARING_ARRAY;
+                for (size_t k = i; k < j; ++k) c.values.push_back(ids[k] & 0xFFFF);
+            } else {
+                c.type = ROARING_BITMAP;
+                c.bits.assign(1024, 0);
+                for (size_t k = i; k < j; ++k) c.bits[(ids[k] & 0xFFFF) >> 6] |= uint64_t(1) << (ids[k] & 63);
+            }
+            bm.containers_.push_back(std::move(c));
+            i = j;
+        }
+        return bm;
+    }
+
+    bool contains(uint32_t id) const {
+        uint16_t key = id >> 16, low = id & 0xFFFF;
+        auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                                   [](const Container& c, uint16_t k) { return c.key < k; });
+        if (it == containers_.end() || it->key != key) return false;
+        const Container& c = *it;
+        if (c.type == ROARING_BITMAP) return c.bits[low >> 6] >> (low & 63) & 1;
+        if (c.type == ROARING_ARRAY) return std::binary_search(c.values.begin(), c.values.end(), low);
+        // Last run starting at or before low
+        size_t lo = 0, hi = c.values.size() / 2;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (c.values[2 * mid] <= low) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo > 0 && low - c.values[2 * (lo - 1)] <= c.values[2 * (lo - 1) + 1];
+    }
+
+    uint64_t cardinality() const {
+        uint64_t n = 0;
+        for (const auto& c : containers_) n += c.cardinality;
+        return n;
+    }
+
+    // Ascending IDs of the set
+    std::vector<uint32_t> to_vector() const {
+        std::vector<uint32_t> ids;
+        ids.reserve(cardinality());
+        for (const auto& c : containers_) {
+            uint32_t high = uint32_t(c.key) << 16;
+            if (c.type == ROARING_ARRAY) {
+                for (uint16_t v : c.values) ids.push_back(high | v);
+            } else if (c.type == ROARING_RUN) {
+                for (size_t r = 0; r < c.values.size(); r += 2)
+                    for (uint32_t v = c.values[r]; v <= uint32_t(c.values[r]) + c.values[r + 1]; ++v)
+                        ids.push_back(high | v);
+            } else {
+                for (uint32_t w = 0; w < 1024; ++w)
+                    for (uint64_t b = c.bits[w]; b; b &= b - 1) ids.push_back(high | (w << 6 | __builtin_ctzll(b)));
+            }
+        }
+        return ids;
+    }
+
+    // The set as one bit per ID, in 64-bit words up to the one holding the largest ID
+    std::vector<uint64_t> to_dense() const {
+        std::vector<uint64_t> words(containers_.empty() ? 0 : (size_t(containers_.back().key) + 1) * 1024, 0);
+        for (const auto& c : containers_) {
+            uint64_t* w = words.data() + size_t(c.key) * 1024;
+            if (c.type == ROARING_BITMAP) {
+                std::copy(c.bits.begin(), c.bits.end(), w);
+            } else if (c.type == ROARING_ARRAY) {
+                for (uint16_t v : c.values) w[v >> 6] |= uint64_t(1) << (v & 63);
+            } else {
+                for (size_t r = 0; r < c.values.size(); r += 2)
+                    for (uint32_t v = c.values[r]; v <= uint32_t(c.values[r]) + c.values[r + 1]; ++v)
+                        w[v >> 6] |= uint64_t(1) << (v & 63);
+            }
+        }
+        while (!words.empty() && words.back() == 0) words.pop_back();
+        return words;
+    }
+
+    // Containers of each type (ROARING_ARRAY, ROARING_BITMAP, ROARING_RUN)
+    void container_counts(uint64_t counts[3]) const {
+        for (const auto& c : containers_) counts[c.type]++;
+    }
+
+    void serialize(std::vector<char>& out) const {
+        uint32_t n = containers_.size();
+        append(out, &n, sizeof(n));
+        for (const auto& c : containers_) {
+            RoaringContainerHeader h;
+            memset(&h, 0, sizeof(h));
+            h.key = c.key;
+            h.type = c.type;
+            if (c.type == ROARING_BITMAP) {
+                h.n = c.bits.size();
+                append(out, &h, sizeof(h));
+                append(out, c.bits.data(), c.bits.size() * sizeof(uint64_t));
+            } else {
+                h.n = c.type == ROARING_RUN ? c.values.size() / 2 : c.values.size();
+                append(out, &h, sizeof(h));
+                append(out, c.values.data(), c.values.size() * sizeof(uint16_t));
+            }
+        }
+    }
+
+    bool deserialize(const char* data, size_t len) {
+        containers_.clear();
+        const char* end = data + len;
+        uint32_t n;
+        if (len < sizeof(n)) return false;
+        memcpy(&n, data, sizeof(n));
+        data += sizeof(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            RoaringContainerHeader h;
+            if (end - data < ptrdiff_t(sizeof(h))) return false;
+            memcpy(&h, data, sizeof(h));
+            data += sizeof(h);
+            Container c;
+            c.key = h.key;
+            c.type = h.type;
+            size_t bytes = h.type == ROARING_BITMAP ? size_t(h.n) * 8 : size_t(h.n) * (h.type == ROARING_RUN ? 4 : 2);
+            if (end - data < ptrdiff_t(bytes)) return false;
+            if (h.type == ROARING_BITMAP) {
+                c.bits.resize(h.n);
+                memcpy(c.bits.data(), data, bytes);
+                for (uint64_t w : c.bits) c.cardinality += __builtin_popcountll(w);
+            } else {
+                c.values.resize(bytes / 2);
+                memcpy(c.values.data(), data, bytes);
+                if (h.type == ROARING_ARRAY) c.cardinality = h.n;
+                else
+                    for (size_t r = 0; r < c.values.size(); r += 2) c.cardinality += c.values[r + 1] + 1u;
+            }
+            data += bytes;
+            containers_.push_back(std::move(c));
+        }
+        return true;
+    }
+
+private:
+    struct Container {
+        uint16_t key = 0;
+        uint8_t type = ROARING_ARRAY;
+        uint32_t cardinality = 0;
+        std::vector<uint16_t> values;  // array values, or (start, length - 1) run pairs
+        std::vector<uint64_t> bits;    // bitmap words
+    };
+
+    static void append(std::vector<char>& out, const void* p, size_t n) {
+        out.insert(out.end(), static_cast<const char*>(p), static_cast<const char*>(p) + n);
+    }
+
+    std::vector<Container> containers_;
+};
+
+// ===============================================
+// DENSE ID SETS
+// ===============================================
+// Direct-addressed form of a set for probing in the filter loops: one bit
+// per ID up to the largest member (221571 IDs take 27 KB, so the whole set
+// stays in L1/L2). contains() is a shift and a mask with no branch: IDs past
+// the end are clamped onto a trailing word that is always zero.
+class DenseBitmap {
+public:
+    DenseBitmap() : words_(1, 0) {}
+    explicit DenseBitmap(const RoaringBitmap& bm) : words_(bm.to_dense()) {
+        limit_ = uint64_t(words_.size()) * 64;
+        words_.push_back(0);
+    }
+
+    bool contains(uint32_t id) const {
+        uint64_t i = std::min<uint64_t>(id, limit_);
+        return words_[i >> 6] >> (i & 63) & 1;
+    }
+
+    // Keeps the IDs that are also in other (AND of several attributes)
+    void intersect(const DenseBitmap& other) {
+        for (size_t i = 0; i < words_.size(); ++i) words_[i] &= i < other.words_.size() ? other.words_[i] : 0;
+    }
+
+    uint64_t cardinality() const {
+        uint64_t n = 0;
+        for (uint64_t w : words_) n += __builtin_popcountll(w);
+        return n;
+    }
+
+    // Ascending IDs of the set
+    std::vector<uint32_t> to_vector() const {
+        std::vector<uint32_t> ids;
+        for (size_t i = 0; i < words_.size(); ++i)
+            for (uint64_t b = words_[i]; b; b &= b - 1) ids.push_back(uint32_t(i << 6 | __builtin_ctzll(b)));
+        return ids;
+    }
+
+    size_t bytes() const { return words_.size() * sizeof(uint64_t); }
+
+    // Raw words for vector kernels (filter_kernels.h): an ID at or above
+    // limit() is tested at bit limit(), which is always clear
+    const uint64_t* words() const { return words_.data(); }
+    uint64_t limit() const { return limit_; }
+
+private:
+    std::vector<uint64_t> words_;  // plus one trailing zero word
+    uint64_t limit_ = 0;           // first ID of the trailing word
+};
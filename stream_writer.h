@@ -0,0 +1,276 @@
+#pragma once
+// ===============================================
+// LARGE-BUFFER STREAMING WRITER
+// ===============================================
+// OutputFile owns the file descriptors of one output file (an optional
+// O_DIRECT descriptor plus a regular one for unaligned head/tail bytes)
+// and accumulates write statistics. StreamWriter appends into a large
+// aligned buffer and flushes it with pwrite() at its own file offset, so
+// several writers (one per thread) can fill disjoint ranges of the same file.
+// With an IoQueue (io_queue.h) in the options the buffer is split in two:
+// one half is written in the background while the other is being filled.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include "io_queue.h"
+
+constexpr size_t STREAM_WRITER_ALIGN = 4096;                          // O_DIRECT alignment
+constexpr size_t STREAM_WRITER_DEFAULT_BUFFER_BYTES = 16 * 1024 * 1024;  // 16 MB
+
+struct WriterOptions {
+    bool direct = false;      // O_DIRECT for the aligned part of every flush
+    bool prealloc = true;     // fallocate() the expected size upfront
+    size_t buffer_bytes = STREAM_WRITER_DEFAULT_BUFFER_BYTES;
+    IoQueue* queue = nullptr;  // background writes; nullptr writes synchronously
+};
+
+class OutputFile {
+public:
+    OutputFile() = default;
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+    ~OutputFile() { close(); }
+
+    // Creates (truncates) the file. expected_bytes > 0 preallocates and fixes the final size.
+    bool open(const std::string& path, const WriterOptions& opts, uint64_t expected_bytes = 0) {
+        path_ = path;
+        opts_ = opts;
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            fprintf(stderr, "Error: Cannot create %s\n", path.c_str());
+            return false;
+        }
+        if (expected_bytes > 0) {
+            bool allocated = opts.prealloc && fallocate(fd_, 0, 0, expected_bytes) == 0;
+            if (!allocated && ftruncate(fd_, expected_bytes) != 0) {
+                fprintf(stderr, "Error: Cannot size %s\n", path.c_str());
+                return false;
+            }
+        }
+        if (opts.direct) {
+            direct_fd_ = ::open(path.c_str(), O_WRONLY | O_DIRECT);
+            if (direct_fd_ < 0)
+                fprintf(stderr, "Warning: O_DIRECT not supported for %s, using buffered writes\n", path.c_str());
+        }
+        t_open_ = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    // Thread-safe positional write. `aligned` means data, len and offset all
+    // satisfy STREAM_WRITER_ALIGN, so the O_DIRECT descriptor may be used.
+    bool write_at(const char* data, size_t len, uint64_t offset, bool aligned = false) {
+        if (len == 0) return true;
+        auto t0 = std::chrono::steady_clock::now();
+        int fd = (aligned && direct_fd_ >= 0) ? direct_fd_ : fd_;
+        bool ok = pwrite_all(fd, data, len, offset);
+        auto t1 = std::chrono::steady_clock::now();
+        io_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+        bytes_ += len;
+        if (!ok) fprintf(stderr, "Error: write failed for %s\n", path_.c_str());
+        return ok;
+    }
+
+    // Queues the same write as write_at() on options().queue. The data must
+    // stay untouched until wait(ticket) returns.
+    void submit_at(const char* data, size_t len, uint64_t offset, bool aligned, WriteTicket& ticket) {
+        if (len == 0) return;
+        int fd = (aligned && direct_fd_ >= 0) ? direct_fd_ : fd_;
+        opts_.queue->submit(fd, data, len, offset, ticket);
+        bytes_ += len;
+    }
+
+    // Waits for the writes queued under ticket; the stall counts as I/O time
+    bool wait(WriteTicket& ticket) {
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = opts_.queue->wait(ticket);
+        auto t1 = std::chrono::steady_clock::now();
+        io_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+        if (!ok) fprintf(stderr, "Error: write failed for %s\n", path_.c_str());
+        return ok;
+    }
+
+    void close() {
+        if (direct_fd_ >= 0) { ::close(direct_fd_); direct_fd_ = -1; }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+            t_close_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    const WriterOptions& options() const { return opts_; }
+    bool direct() const { return direct_fd_ >= 0; }
+    uint64_t bytes_written() const { return bytes_; }
+    // Seconds spent inside pwrite() or waiting for queued writes, summed over all threads
+    double io_seconds() const { return io_ns_ / 1e9; }
+    // Wall time between open() and close()
+    double wall_seconds() const {
+        auto end = (fd_ >= 0) ? std::chrono::steady_clock::now() : t_close_;
+        return std::chrono::duration<double>(end - t_open_).count();
+    }
+    double wall_mb_per_s() const {
+        double s = wall_seconds();
+        return s > 0 ? bytes_ / (1024.0 * 1024.0) / s : 0.0;
+    }
+
+private:
+    std::string path_;
+    WriterOptions opts_;
+    int fd_ = -1;
+    int direct_fd_ = -1;
+    std::atomic<uint64_t> bytes_{0};
+    std::atomic<uint64_t> io_ns_{0};
+    std::chrono::steady_clock::time_point t_open_, t_close_;
+};
+
+class StreamWriter {
+public:
+    // Appends sequentially starting at file offset `start_offset`
+    StreamWriter(OutputFile& file, uint64_t start_offset = 0)
+        : file_(file), async_(file.options().queue != nullptr) {
+        // Double buffering splits the budget, so memory use is the same either way
+        size_t n_bufs = async_ ? 2 : 1;
+        capacity_ = std::max(file.options().buffer_bytes / n_bufs, 2 * STREAM_WRITER_ALIGN);
+        capacity_ = (capacity_ + STREAM_WRITER_ALIGN - 1) / STREAM_WRITER_ALIGN * STREAM_WRITER_ALIGN;
+        for (size_t b = 0; b < n_bufs; ++b)
+            if (posix_memalign(reinterpret_cast<void**>(&bufs_[b]), STREAM_WRITER_ALIGN, capacity_) != 0)
+                bufs_[b] = nullptr;
+        buf_ = bufs_[0];
+        reset(start_offset);
+    }
+    StreamWriter(const StreamWriter&) = delete;
+    StreamWriter& operator=(const StreamWriter&) = delete;
+    ~StreamWriter() {
+        flush();
+        free(bufs_[0]);
+        free(bufs_[1]);
+    }
+
+    bool ok() const { return ok_ && bufs_[0] != nullptr && (!async_ || bufs_[1] != nullptr); }
+
+    // Logical file offset of the next byte written
+    uint64_t offset() const { return pos_ + fill_; }
+
+    bool write(const void* data, size_t len) {
+        const char* src = static_cast<const char*>(data);
+        while (len > 0) {
+            size_t room = capacity_ - lead_ - fill_;
+            if (room == 0) {
+                if (!flush_aligned()) return false;
+                continue;
+            }
+            size_t n = std::min(room, len);
+            memcpy(buf_ + lead_ + fill_, src, n);
+            fill_ += n;
+            src += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    // Writes out everything buffered (including an unaligned tail) and waits
+    // for the queued writes. The wait also happens after an error: the queue
+    // may still be reading both buffers, which the destructor frees.
+    bool flush() {
+        if (ok() && fill_ > 0 && flush_aligned()) {
+            ok_ = write_range(buf_ + lead_, fill_, pos_, false);
+            pos_ += fill_;
+            fill_ = 0;
+            lead_ = pos_ % STREAM_WRITER_ALIGN;
+        }
+        if (async_) {
+            ok_ = file_.wait(tickets_[0]) && ok_;
+            ok_ = file_.wait(tickets_[1]) && ok_;
+        }
+        return ok();
+    }
+
+    // Flushes and continues at another file offset
+    bool seek(uint64_t offset) {
+        if (!flush()) return false;
+        reset(offset);
+        return true;
+    }
+
+private:
+    void reset(uint64_t offset) {
+        pos_ = offset;
+        fill_ = 0;
+        // Keep buffer address and file offset congruent modulo the alignment so the
+        // aligned middle of every flush is also aligned in memory (O_DIRECT requirement)
+        lead_ = offset % STREAM_WRITER_ALIGN;
+    }
+
+    // Writes the aligned part of the buffer and keeps the unaligned tail
+    bool flush_aligned() {
+        if (!ok()) return false;
+        uint64_t end = pos_ + fill_;
+        uint64_t aligned_begin = (pos_ + STREAM_WRITER_ALIGN - 1) / STREAM_WRITER_ALIGN * STREAM_WRITER_ALIGN;
+        uint64_t aligned_end = end / STREAM_WRITER_ALIGN * STREAM_WRITER_ALIGN;
+        if (aligned_end <= aligned_begin) {
+            // Less than one aligned page buffered: write everything buffered
+            ok_ = write_range(buf_ + lead_, fill_, pos_, false);
+            ok_ = next_buffer(nullptr, 0) && ok_;
+            pos_ = end;
+            fill_ = 0;
+            lead_ = pos_ % STREAM_WRITER_ALIGN;
+            return ok_;
+        }
+        // buf_ holds file offset pos_ - lead_, which is aligned
+        uint64_t buf_file_offset = pos_ - lead_;
+        // Unaligned head (only the first flush after open/seek can have one)
+        if (aligned_begin > pos_)
+            ok_ = write_range(buf_ + lead_, aligned_begin - pos_, pos_, false);
+        if (ok_)
+            ok_ = write_range(buf_ + (aligned_begin - buf_file_offset), aligned_end - aligned_begin, aligned_begin,
+                              true);
+        // Move the unaligned tail to the front of the (next) buffer
+        size_t tail = end - aligned_end;
+        ok_ = next_buffer(buf_ + lead_ + (aligned_end - pos_), tail) && ok_;
+        pos_ = aligned_end;
+        lead_ = 0;
+        fill_ = tail;
+        return ok_;
+    }
+
+    // Writes now, or queues the write under the current buffer's ticket
+    bool write_range(const char* data, size_t len, uint64_t offset, bool aligned) {
+        if (!async_) return file_.write_at(data, len, offset, aligned);
+        file_.submit_at(data, len, offset, aligned, tickets_[cur_]);
+        return true;
+    }
+
+    // Continues in the other buffer once its writes are done (async), carrying
+    // over n bytes from src; synchronously the single buffer is reused
+    bool next_buffer(const char* src, size_t n) {
+        if (!async_) {
+            if (n > 0) memmove(buf_, src, n);
+            return true;
+        }
+        int next = cur_ ^ 1;
+        bool ok = file_.wait(tickets_[next]);
+        if (n > 0) memcpy(bufs_[next], src, n);
+        cur_ = next;
+        buf_ = bufs_[next];
+        return ok;
+    }
+
+    OutputFile& file_;
+    bool async_;
+    char* bufs_[2] = {nullptr, nullptr};
+    WriteTicket tickets_[2];
+    int cur_ = 0;
+    char* buf_ = nullptr;   // bufs_[cur_]
+    size_t capacity_;
+    size_t lead_ = 0;    // bytes at the front of buf_ that precede pos_ in the aligned page
+    size_t fill_ = 0;    // bytes buffered after lead_
+    uint64_t pos_ = 0;   // file offset of buf_[lead_]
+    bool ok_ = true;
+};
@@ -0,0 +1,160 @@
+#pragma once
+// ===============================================
+// WORK-STEALING THREAD POOL
+// ===============================================
+// One set of persistent workers (ThreadPool::shared()) for every data-parallel
+// phase of the query tools, the preprocessing, the generator and the labs, so
+// short phases do not pay for creating threads.
+//
+// parallel_for() cuts [0, n) into tasks of `grain` items and seeds them to
+// the workers' deques in contiguous stretches, so neighbouring items (runs of
+// one block, say) start on one worker. A worker takes its own tasks from the
+// front, in order; an idle worker steals from the back of another's deque, so
+// the tail of a stretch behind a large item moves to whoever is free instead
+// of waiting for it. The calling thread runs tasks too while it waits, which
+// keeps nested or concurrent parallel_for() calls from deadlocking.
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+constexpr size_t THREAD_POOL_TASKS_PER_THREAD = 16;  // grain_for(): tasks per worker
+
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned n_threads = std::thread::hardware_concurrency()) {
+        n_threads = std::max(1u, n_threads);
+        for (unsigned i = 0; i < n_threads; ++i) queues_.push_back(std::make_unique<Queue>());
+        for (unsigned i = 0; i < n_threads; ++i) workers_.emplace_back([this, i] { run(i); });
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lk(idle_mu_);
+            stop_ = true;
+        }
+        idle_cv_.notify_all();
+        for (auto& t : workers_) t.join();
+    }
+
+    // The process-wide pool, one worker per hardware thread, started on first use
+    static ThreadPool& shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    unsigned size() const { return workers_.size(); }
+
+    // A grain giving about THREAD_POOL_TASKS_PER_THREAD tasks per worker
+    size_t grain_for(size_t n) const {
+        return std::max<size_t>(1, n / (size_t(size()) * THREAD_POOL_TASKS_PER_THREAD));
+    }
+
+    // Calls fn(begin, end) over [0, n) in tasks of at most `grain` items and
+    // returns when all are done. Tasks run concurrently, in no fixed order.
+    template <typename Fn>
+    void parallel_for(size_t n, size_t grain, Fn&& fn) {
+        if (n == 0) return;
+        grain = std::max<size_t>(1, grain);
+        size_t tasks = (n + grain - 1) / grain;
+        if (tasks == 1) {
+            fn(size_t(0), n);
+            return;
+        }
+        Job job;
+        job.fn = [&fn](size_t begin, size_t end) { fn(begin, end); };
+        job.pending = tasks;
+        {
+            std::lock_guard<std::mutex> lk(idle_mu_);
+            queued_ += tasks;
+        }
+        for (size_t k = 0; k < tasks; ++k) {
+            Queue& q = *queues_[k * queues_.size() / tasks];
+            std::lock_guard<std::mutex> lk(q.mu);
+            q.tasks.push_back({&job, k * grain, std::min(n, (k + 1) * grain)});
+        }
+        idle_cv_.notify_all();
+
+        // Help until every task of the job has been taken, then wait for the rest
+        Task t;
+        while (job_pending(job) && take(0, t, false)) execute(t);
+        std::unique_lock<std::mutex> lk(job.mu);
+        job.done.wait(lk, [&] { return job.pending == 0; });
+    }
+
+private:
+    struct Job {
+        std::function<void(size_t, size_t)> fn;
+        std::mutex mu;
+        std::condition_variable done;
+        size_t pending = 0;  // tasks not finished, guarded by mu
+    };
+    struct Task {
+        Job* job = nullptr;
+        size_t begin = 0, end = 0;
+    };
+    struct Queue {
+        std::mutex mu;
+        std::deque<Task> tasks;
+    };
+
+    static bool job_pending(Job& job) {
+        std::lock_guard<std::mutex> lk(job.mu);
+        return job.pending > 0;
+    }
+
+    // Own queue `self` from the front (if own), then the others from the back
+    bool take(unsigned self, Task& t, bool own) {
+        for (size_t k = 0; k < queues_.size(); ++k) {
+            Queue& q = *queues_[(self + k) % queues_.size()];
+            bool front = own && k == 0;
+            std::lock_guard<std::mutex> lk(q.mu);
+            if (q.tasks.empty()) continue;
+            if (front) {
+                t = q.tasks.front();
+                q.tasks.pop_front();
+            } else {
+                t = q.tasks.back();
+                q.tasks.pop_back();
+            }
+            queued_--;
+            return true;
+        }
+        return false;
+    }
+
+    // The job lives on its caller's stack until pending reaches 0 under its
+    // mutex, so nothing touches it after that
+    static void execute(const Task& t) {
+        t.job->fn(t.begin, t.end);
+        std::lock_guard<std::mutex> lk(t.job->mu);
+        if (--t.job->pending == 0) t.job->done.notify_all();
+    }
+
+    void run(unsigned self) {
+        for (;;) {
+            Task t;
+            if (take(self, t, true)) {
+                execute(t);
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(idle_mu_);
+            idle_cv_.wait(lk, [&] { return stop_ || queued_ > 0; });
+            if (stop_ && queued_ <= 0) return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex idle_mu_;
+    std::condition_variable idle_cv_;
+    std::atomic<long> queued_{0};  // tasks in the deques (counted before they are pushed)
+    bool stop_ = false;
+};